@@ -0,0 +1,209 @@
+// Renders PBRT scenes with the ray tracer without creating a window or a D3D device,
+// writing the image named by the scene's Film directive
+//
+// BatchRenderer.exe -s scene.pbrt [-spp N | -frames N] [-o output.png|.exr|.pfm] [-stats stats.json] [-heatmap]
+//
+// -heatmap also writes the cycles and rays spent on each part of the image as false color
+// PNGs next to the render, named <output>_cycles.png and <output>_rays.png
+
+#include "RTRenderer.h"
+#include "RendererException.h"
+#include "MemoryCanvas.h"
+#include "ImageWriter.h"
+#include "SceneLoader.h"
+#include "PBRTParser.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef std::chrono::steady_clock Clock;
+
+const UINT DefaultWidth = 800;
+const UINT DefaultHeight = 600;
+const UINT DefaultSamplesPerPixel = 16;
+
+double MillisecondsSince(Clock::time_point Start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - Start).count();
+}
+
+void PrintUsage()
+{
+    printf("Usage: BatchRenderer -s scene.pbrt [-spp samplesPerPixel | -frames frameCount] [-o output.png|.exr|.pfm] [-stats stats.json] [-heatmap]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::string SceneFilePath;
+    std::string OutputFilePath;
+    std::string StatsFilePath;
+    bool bWriteHeatmaps = false;
+    UINT SamplesPerPixel = 0;
+    UINT FrameCount = 0;
+    for (int ArgIndex = 1; ArgIndex < argc; ArgIndex++)
+    {
+        const std::string Arg = argv[ArgIndex];
+        const bool bHasValue = ArgIndex < argc - 1;
+        if (Arg.compare("-s") == 0 && bHasValue)
+        {
+            SceneFilePath = argv[++ArgIndex];
+        }
+        else if (Arg.compare("-o") == 0 && bHasValue)
+        {
+            OutputFilePath = argv[++ArgIndex];
+        }
+        else if (Arg.compare("-stats") == 0 && bHasValue)
+        {
+            StatsFilePath = argv[++ArgIndex];
+        }
+        else if (Arg.compare("-heatmap") == 0)
+        {
+            bWriteHeatmaps = true;
+        }
+        else if (Arg.compare("-spp") == 0 && bHasValue)
+        {
+            SamplesPerPixel = atoi(argv[++ArgIndex]);
+        }
+        else if (Arg.compare("-frames") == 0 && bHasValue)
+        {
+            FrameCount = atoi(argv[++ArgIndex]);
+        }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if (SceneFilePath.size() < 4 || SceneFilePath.substr(SceneFilePath.size() - 4, 4).compare("pbrt") != 0)
+    {
+        // Unknown scene file format
+        PrintUsage();
+        return 1;
+    }
+
+    try
+    {
+        const Clock::time_point StartTime = Clock::now();
+
+        SceneParser::Scene FileScene;
+        PBRTParser::PBRTParser().Parse(SceneFilePath, FileScene);
+        printf("Parsed %s in %.1f ms\n", SceneFilePath.c_str(), MillisecondsSince(StartTime));
+
+        UINT Width = DefaultWidth;
+        UINT Height = DefaultHeight;
+        if (FileScene.m_Film.m_ResolutionX > 0 && FileScene.m_Film.m_ResolutionY > 0)
+        {
+            Width = FileScene.m_Film.m_ResolutionX;
+            Height = FileScene.m_Film.m_ResolutionY;
+        }
+
+        if (OutputFilePath.empty())
+        {
+            OutputFilePath = FileScene.m_Film.m_Filename.empty() ? "output.png" : FileScene.m_Film.m_Filename;
+        }
+
+        // The first frame is a preview that isn't accumulated, every frame after it adds a sample per pixel
+        if (FrameCount == 0)
+        {
+            if (SamplesPerPixel == 0)
+            {
+                SamplesPerPixel = FileScene.m_Sampler.m_PixelSamples > 0 ? FileScene.m_Sampler.m_PixelSamples : DefaultSamplesPerPixel;
+            }
+            FrameCount = SamplesPerPixel + 1;
+        }
+
+        // Frames past the accumulation limit wouldn't add anything to the image
+        const UINT MaxFrameCount = RT_MAX_ACCUMULATED_FRAMES + 1;
+        if (FrameCount > MaxFrameCount)
+        {
+            fprintf(stderr, "Warning: %u frames requested, rendering %u (%u samples per pixel is the accumulation limit)\n", FrameCount, MaxFrameCount, MaxFrameCount - 1);
+            FrameCount = MaxFrameCount;
+        }
+
+        // HDR formats keep linear colors, gamma is only applied to 8-bit output
+        const bool bHDROutput = IsHDRImageFile(OutputFilePath);
+        FloatCanvas HDRCanvas(bHDROutput ? Width : 0, bHDROutput ? Height : 0);
+        RGBA8Canvas LDRCanvas(bHDROutput ? 0 : Width, bHDROutput ? 0 : Height);
+        RenderSettings Settings(!bHDROutput);
+        Settings.m_SamplerType = GetSamplerType(FileScene, Settings.m_SamplerType);
+
+        const Clock::time_point SceneBuildStartTime = Clock::now();
+        RTRenderer *pRenderer = new RTRenderer(Width, Height);
+        MEM_CHK(pRenderer);
+        pRenderer->SetCanvas(bHDROutput ? (Canvas *)&HDRCanvas : (Canvas *)&LDRCanvas);
+        if (StatsFilePath.size())
+        {
+            pRenderer->EnableRenderStats(StatsFilePath.c_str());
+        }
+        pRenderer->EnableCostHeatmap(bWriteHeatmaps);
+
+        EnvironmentMap *pEnvironmentMap;
+        Scene *pScene;
+        Camera *pCamera;
+        std::unordered_map<std::string, Material *> MaterialList;
+        InitEnvironmentMap(pRenderer, FileScene.m_EnvironmentMap.m_FileName.c_str(), "Assets\\EnvironmentMap\\Uffizi\\irrad", &pEnvironmentMap);
+        InitSceneAndCamera(pRenderer, pEnvironmentMap, FileScene, false, MaterialList, &pScene, &pCamera);
+        printf("Built scene in %.1f ms\n", MillisecondsSince(SceneBuildStartTime));
+
+        const Clock::time_point RenderStartTime = Clock::now();
+        for (UINT Frame = 0; Frame < FrameCount; Frame++)
+        {
+            const Clock::time_point FrameStartTime = Clock::now();
+            pRenderer->DrawScene(pCamera, pScene, Settings);
+            printf("Frame %u/%u: %.1f ms\n", Frame + 1, FrameCount, MillisecondsSince(FrameStartTime));
+        }
+        const double RenderTime = MillisecondsSince(RenderStartTime);
+        printf("Rendered %u frames at %ux%u in %.1f ms (%.1f ms per frame)\n", FrameCount, Width, Height, RenderTime, RenderTime / FrameCount);
+
+        if (bHDROutput)
+        {
+            if (GetImageFileExtension(OutputFilePath) == "pfm")
+            {
+                WritePFM(OutputFilePath, HDRCanvas.GetPixels(), Width, Height);
+            }
+            else
+            {
+                WriteEXR(OutputFilePath, HDRCanvas.GetPixels(), Width, Height);
+            }
+        }
+        else
+        {
+            WritePNG(OutputFilePath, LDRCanvas.GetPixels(), Width, Height);
+        }
+        if (bWriteHeatmaps)
+        {
+            const std::string OutputBaseName = OutputFilePath.substr(0, OutputFilePath.find_last_of('.'));
+            const std::pair<RTCostMetric, const char *> Heatmaps[] = { { RT_COST_CYCLES, "_cycles.png" }, { RT_COST_RAYS, "_rays.png" } };
+            for (auto &Heatmap : Heatmaps)
+            {
+                RGBA8Canvas HeatmapCanvas(Width, Height);
+                pRenderer->DrawCostHeatmap(&HeatmapCanvas, Heatmap.first);
+                WritePNG(OutputBaseName + Heatmap.second, HeatmapCanvas.GetPixels(), Width, Height);
+            }
+        }
+        printf("Wrote %s, total time %.1f ms\n", OutputFilePath.c_str(), MillisecondsSince(StartTime));
+
+        pRenderer->DestroyCamera(pCamera);
+        pRenderer->DestroyScene(pScene);
+        pRenderer->DestroyEnviromentMap(pEnvironmentMap);
+        for (auto &MaterialKeyValuePair : MaterialList)
+        {
+            pRenderer->DestroyMaterial(MaterialKeyValuePair.second);
+        }
+        delete pRenderer;
+    }
+    catch (RendererException *pException)
+    {
+        fprintf(stderr, "Render failed: %s\n", pException->GetErrorMessage().c_str());
+        delete pException;
+        return 1;
+    }
+    catch (const std::exception &Exception)
+    {
+        fprintf(stderr, "Failed to load %s: %s\n", SceneFilePath.c_str(), Exception.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Runs the microbenchmarks registered with BENCHMARK, see Benchmark.h
+//
+// Benchmark.exe [-filter text] [-repetitions N] [-mintime ms] [-json results.json]
+//               [-baseline results.json] [-tolerance percent]
+//
+// Every benchmark is repeated and the median time per iteration is reported. With -baseline
+// the exit code is 1 if any benchmark got slower than the baseline by more than -tolerance,
+// unknown or incomplete arguments print the usage and exit with 2
+
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+void EscapePointer(const void *pData)
+{
+    static const void *volatile s_pEscapedPointer;
+    s_pEscapedPointer = pData;
+}
+
+std::vector<RegisteredBenchmark> &GetRegisteredBenchmarks()
+{
+    static std::vector<RegisteredBenchmark> Benchmarks;
+    return Benchmarks;
+}
+
+struct BenchmarkResult
+{
+    std::string m_Name;
+    unsigned long long m_NumIterations;
+    double m_MedianNanoseconds; // Per iteration
+    double m_MinNanoseconds;
+    double m_ItemsPerSecond;
+};
+
+double RunIterations(const RegisteredBenchmark &Benchmark, unsigned long long NumIterations, unsigned long long &ItemsPerIteration)
+{
+    BenchmarkState State(NumIterations);
+    Benchmark.m_Function(State);
+    ItemsPerIteration = State.GetItemsPerIteration();
+    return State.GetElapsedNanoseconds();
+}
+
+BenchmarkResult RunBenchmark(const RegisteredBenchmark &Benchmark, unsigned int NumRepetitions, double MinimumRunNanoseconds)
+{
+    // Grow the iteration count until a single run is long enough for the clock to be trusted. A benchmark
+    // that never calls KeepRunning measures no time at all, the cap stops it from growing forever
+    const unsigned long long cMaxIterations = 1000000000;
+    unsigned long long ItemsPerIteration;
+    unsigned long long NumIterations = 1;
+    double Elapsed = RunIterations(Benchmark, NumIterations, ItemsPerIteration);
+    while (Elapsed < MinimumRunNanoseconds && NumIterations < cMaxIterations)
+    {
+        const double Scale = Elapsed > 0.0 ? 1.4 * MinimumRunNanoseconds / Elapsed : 10.0;
+        NumIterations = std::min((unsigned long long)(NumIterations * std::min(std::max(Scale, 2.0), 10.0)), cMaxIterations);
+        Elapsed = RunIterations(Benchmark, NumIterations, ItemsPerIteration);
+    }
+
+    std::vector<double> NanosecondsPerIteration;
+    for (unsigned int Repetition = 0; Repetition < NumRepetitions; Repetition++)
+    {
+        NanosecondsPerIteration.push_back(RunIterations(Benchmark, NumIterations, ItemsPerIteration) / NumIterations);
+    }
+    std::sort(NanosecondsPerIteration.begin(), NanosecondsPerIteration.end());
+
+    BenchmarkResult Result;
+    Result.m_Name = Benchmark.m_Name;
+    Result.m_NumIterations = NumIterations;
+    Result.m_MedianNanoseconds = NanosecondsPerIteration[NanosecondsPerIteration.size() / 2];
+    Result.m_MinNanoseconds = NanosecondsPerIteration[0];
+    Result.m_ItemsPerSecond = Result.m_MedianNanoseconds > 0.0 ? ItemsPerIteration * 1e9 / Result.m_MedianNanoseconds : 0.0;
+    return Result;
+}
+
+// Reads back the one-benchmark-per-line files written by WriteResults
+std::map<std::string, double> ReadBaseline(const std::string &FileName)
+{
+    std::map<std::string, double> Baseline;
+    std::ifstream File(FileName);
+    std::string Line;
+    while (std::getline(File, Line))
+    {
+        char Name[256];
+        double MedianNanoseconds;
+        if (sscanf(Line.c_str(), " {\"name\":\"%255[^\"]\",\"medianNs\":%lf", Name, &MedianNanoseconds) == 2)
+        {
+            Baseline[Name] = MedianNanoseconds;
+        }
+    }
+    return Baseline;
+}
+
+void WriteResults(const std::string &FileName, const std::vector<BenchmarkResult> &Results)
+{
+    std::ofstream File(FileName);
+    File << "[\n";
+    for (size_t i = 0; i < Results.size(); i++)
+    {
+        const BenchmarkResult &Result = Results[i];
+        File << "{\"name\":\"" << Result.m_Name << "\",\"medianNs\":" << Result.m_MedianNanoseconds
+            << ",\"minNs\":" << Result.m_MinNanoseconds
+            << ",\"iterations\":" << Result.m_NumIterations
+            << ",\"itemsPerSecond\":" << Result.m_ItemsPerSecond << "}"
+            << (i + 1 < Results.size() ? "," : "") << "\n";
+    }
+    File << "]\n";
+}
+
+void PrintUsage()
+{
+    printf("Usage: Benchmark [-filter text] [-repetitions N] [-mintime ms] [-json results.json] [-baseline results.json] [-tolerance percent]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::string Filter;
+    std::string OutputFileName;
+    std::string BaselineFileName;
+    unsigned int NumRepetitions = 5;
+    double MinimumRunMilliseconds = 200.0;
+    double TolerancePercent = 5.0;
+    for (int ArgIndex = 1; ArgIndex < argc; ArgIndex++)
+    {
+        const std::string Arg = argv[ArgIndex];
+        const bool bHasValue = ArgIndex < argc - 1;
+        if (Arg.compare("-filter") == 0 && bHasValue) Filter = argv[++ArgIndex];
+        else if (Arg.compare("-json") == 0 && bHasValue) OutputFileName = argv[++ArgIndex];
+        else if (Arg.compare("-baseline") == 0 && bHasValue) BaselineFileName = argv[++ArgIndex];
+        else if (Arg.compare("-repetitions") == 0 && bHasValue) NumRepetitions = std::max(atoi(argv[++ArgIndex]), 1);
+        else if (Arg.compare("-mintime") == 0 && bHasValue) MinimumRunMilliseconds = atof(argv[++ArgIndex]);
+        else if (Arg.compare("-tolerance") == 0 && bHasValue) TolerancePercent = atof(argv[++ArgIndex]);
+        else
+        {
+            // A regression exits with 1, so a bad command line can't pass for one
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    const std::map<std::string, double> Baseline = BaselineFileName.empty() ? std::map<std::string, double>() : ReadBaseline(BaselineFileName);
+
+    printf("%-48s %14s %14s %14s %16s\n", "Benchmark", "Iterations", "Median ns", "Min ns", "Items/s");
+    std::vector<BenchmarkResult> Results;
+    bool bRegressed = false;
+    for (const RegisteredBenchmark &Benchmark : GetRegisteredBenchmarks())
+    {
+        if (!Filter.empty() && Benchmark.m_Name.find(Filter) == std::string::npos) continue;
+
+        const BenchmarkResult Result = RunBenchmark(Benchmark, NumRepetitions, MinimumRunMilliseconds * 1e6);
+        printf("%-48s %14llu %14.1f %14.1f %16.4g", Result.m_Name.c_str(), Result.m_NumIterations, Result.m_MedianNanoseconds, Result.m_MinNanoseconds, Result.m_ItemsPerSecond);
+
+        auto BaselineResult = Baseline.find(Result.m_Name);
+        if (BaselineResult != Baseline.end())
+        {
+            const double Change = 100.0 * (Result.m_MedianNanoseconds / BaselineResult->second - 1.0);
+            const bool bSlower = Change > TolerancePercent;
+            printf("  %+6.1f%%%s", Change, bSlower ? " REGRESSED" : "");
+            bRegressed |= bSlower;
+        }
+        printf("\n");
+        Results.push_back(Result);
+    }
+
+    if (!OutputFileName.empty())
+    {
+        WriteResults(OutputFileName, Results);
+    }
+    return bRegressed ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Minimal harness in the style of Google Benchmark. A benchmark loops on State.KeepRunning(), 
+// the runner picks an iteration count that takes at least the minimum run time and repeats 
+// the run so the median can be compared against a baseline
+class BenchmarkState
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    BenchmarkState(unsigned long long NumIterations) :
+        m_NumIterations(NumIterations), m_IterationsLeft(NumIterations), m_ItemsPerIteration(1), m_bStarted(false) {}
+
+    // The clock starts on the first call so any setup before the loop isn't measured
+    bool KeepRunning()
+    {
+        if (!m_bStarted)
+        {
+            m_bStarted = true;
+            m_StartTime = Clock::now();
+        }
+
+        if (m_IterationsLeft > 0)
+        {
+            m_IterationsLeft--;
+            return true;
+        }
+
+        m_EndTime = Clock::now();
+        return false;
+    }
+
+    // Rays, texels, BRDF evaluations etc. handled per iteration, reported as a throughput
+    void SetItemsPerIteration(unsigned long long NumItems) { m_ItemsPerIteration = NumItems; }
+
+    unsigned long long GetNumIterations() const { return m_NumIterations; }
+    unsigned long long GetItemsPerIteration() const { return m_ItemsPerIteration; }
+    double GetElapsedNanoseconds() const { return std::chrono::duration<double, std::nano>(m_EndTime - m_StartTime).count(); }
+
+private:
+    unsigned long long m_NumIterations;
+    unsigned long long m_IterationsLeft;
+    unsigned long long m_ItemsPerIteration;
+    bool m_bStarted;
+    Clock::time_point m_StartTime;
+    Clock::time_point m_EndTime;
+};
+
+// For results written to memory, like the output arrays of batched functions. The pointer is 
+// stored through a function that's never inlined and the barrier keeps the writes before it
+void EscapePointer(const void *pData);
+
+inline void ClobberMemory()
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+// Keeps the compiler from discarding a result that's otherwise unused. The object's address 
+// escapes and memory is clobbered, so the whole object has to be computed even when the 
+// benchmarked function is inlined, at a fixed cost that doesn't grow with sizeof(T)
+template<class T>
+inline void DoNotOptimize(const T &Value)
+{
+    EscapePointer(&Value);
+    ClobberMemory();
+}
+
+typedef std::function<void(BenchmarkState &)> BenchmarkFunction;
+
+struct RegisteredBenchmark
+{
+    std::string m_Name;
+    BenchmarkFunction m_Function;
+};
+
+std::vector<RegisteredBenchmark> &GetRegisteredBenchmarks();
+
+struct BenchmarkRegistration
+{
+    BenchmarkRegistration(const std::string &Name, const BenchmarkFunction &Function)
+    {
+        RegisteredBenchmark Benchmark = { Name, Function };
+        GetRegisteredBenchmarks().push_back(Benchmark);
+    }
+};
+
+#define BENCHMARK_CONCAT_INTERNAL(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_INTERNAL(a, b)
+
+#define BENCHMARK(Function) \
+    static BenchmarkRegistration BENCHMARK_CONCAT(g_BenchmarkRegistration, __LINE__)(#Function, Function)
+
+// Registers Function(State, Arg) under the name Function/Arg
+#define BENCHMARK_WITH_ARG(Function, Arg) \
+    static BenchmarkRegistration BENCHMARK_CONCAT(g_BenchmarkRegistration, __LINE__)(#Function "/" #Arg, [](BenchmarkState &State) { Function(State, Arg); })
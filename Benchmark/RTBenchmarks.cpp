@@ -0,0 +1,447 @@
+// Microbenchmarks for the ray tracer's hot paths. Everything runs against synthetic assets
+// generated on first use (a tessellated sphere, noise textures and a PLY grid) so no scene
+// files or GPU are needed and the numbers only move when the code does
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "Benchmark.h"
+
+#include "RTRenderer.h"
+#include "RTBRDF.h"
+#include "ImageWriter.h"
+#include "SceneParser.h"
+#include "PlyParser.h"
+
+#include <fstream>
+#include <random>
+
+const char *g_BenchmarkTextureName = "BenchmarkTexture.png";
+const char *g_BenchmarkPanoramaName = "BenchmarkPanorama.png";
+const char *g_BenchmarkPlyName = "BenchmarkGrid.ply";
+
+const UINT g_TextureSize = 1024;
+const UINT g_SphereSlices = 256; // ~65k triangles
+const UINT g_SphereStacks = 128;
+const UINT g_PlyGridSize = 512;
+
+// Inputs are precomputed and cycled through so random number generation isn't measured
+const UINT g_NumSamples = 4096;
+
+void WriteNoiseTexture(const char *FileName, UINT Width, UINT Height)
+{
+    // Smooth gradients with noise on top, so mip levels and the panorama's luminance distribution aren't trivial
+    std::mt19937 Generator(Width * Height);
+    std::uniform_int_distribution<int> Noise(0, 63);
+    std::vector<RGBA8Pixel> Pixels(Width * Height);
+    for (UINT y = 0; y < Height; y++)
+    {
+        for (UINT x = 0; x < Width; x++)
+        {
+            RGBA8Pixel &Pixel = Pixels[y * Width + x];
+            Pixel.r = (unsigned char)(x * 192 / Width + Noise(Generator));
+            Pixel.g = (unsigned char)(y * 192 / Height + Noise(Generator));
+            Pixel.b = (unsigned char)(((x / 32 + y / 32) % 2) * 128 + Noise(Generator));
+            Pixel.a = 255;
+        }
+    }
+    WritePNG(FileName, Pixels.data(), Width, Height);
+}
+
+void WritePlyGrid(const char *FileName, UINT GridSize)
+{
+    std::ofstream File(FileName, std::ios::binary);
+    File << "ply\nformat binary_little_endian 1.0\n"
+        << "element vertex " << GridSize * GridSize << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "property float nx\nproperty float ny\nproperty float nz\n"
+        << "property float u\nproperty float v\n"
+        << "element face " << (GridSize - 1) * (GridSize - 1) * 2 << "\n"
+        << "property list uchar int vertex_indices\n"
+        << "end_header\n";
+
+    for (UINT y = 0; y < GridSize; y++)
+    {
+        for (UINT x = 0; x < GridSize; x++)
+        {
+            const float u = (float)x / (GridSize - 1);
+            const float v = (float)y / (GridSize - 1);
+            const float Vertex[] = { u, 0.0f, v, 0.0f, 1.0f, 0.0f, u, v };
+            File.write((const char *)Vertex, sizeof(Vertex));
+        }
+    }
+
+    for (UINT y = 0; y + 1 < GridSize; y++)
+    {
+        for (UINT x = 0; x + 1 < GridSize; x++)
+        {
+            const int Corner = y * GridSize + x;
+            const int Triangles[2][3] = { { Corner, Corner + 1, Corner + (int)GridSize }, { Corner + 1, Corner + (int)GridSize + 1, Corner + (int)GridSize } };
+            for (auto &Triangle : Triangles)
+            {
+                const unsigned char NumIndices = 3;
+                File.write((const char *)&NumIndices, sizeof(NumIndices));
+                File.write((const char *)Triangle, sizeof(Triangle));
+            }
+        }
+    }
+}
+
+// A textured, normal mapped unit sphere at the origin in its own scene, plus the inputs the
+// benchmarks feed it. Built once and shared by every benchmark
+class BenchmarkScene
+{
+public:
+    static BenchmarkScene &Get()
+    {
+        static BenchmarkScene Scene;
+        return Scene;
+    }
+
+    ~BenchmarkScene()
+    {
+        m_Renderer.DestroyScene(m_pScene);
+        m_Renderer.DestroyGeometry(m_pSphere);
+        m_Renderer.DestroyMaterial(m_pMaterial);
+    }
+
+    RTRenderer m_Renderer;
+    Material *m_pMaterial;
+    RTGeometry *m_pSphere;
+    RTScene *m_pScene;
+
+    // Primary rays from a pinhole camera looking at the sphere, ordered so that every packet is a tight bundle
+    std::vector<glm::vec3> m_RayOrigins;
+    std::vector<glm::vec3> m_RayDirections;
+
+    // What those rays hit
+    std::vector<unsigned int> m_PrimIDs;
+    std::vector<glm::vec3> m_BaryocentricCoords;
+    std::vector<float> m_ConeWidths;
+    std::vector<glm::vec3> m_HitDirections;
+
+    std::vector<glm::vec2> m_UVs;
+    std::vector<glm::vec3> m_Directions; // Uniform over the sphere
+    std::vector<glm::vec2> m_Samples; // Uniform over [0,1)^2
+
+private:
+    BenchmarkScene() : m_Renderer(g_TextureSize, g_TextureSize)
+    {
+        WriteNoiseTexture(g_BenchmarkTextureName, g_TextureSize, g_TextureSize);
+        WriteNoiseTexture(g_BenchmarkPanoramaName, 2 * g_TextureSize, g_TextureSize);
+        WritePlyGrid(g_BenchmarkPlyName, g_PlyGridSize);
+
+        CreateMaterialDescriptor MaterialDescriptor = {};
+        MaterialDescriptor.m_TextureName = g_BenchmarkTextureName;
+        MaterialDescriptor.m_NormalMapName = g_BenchmarkTextureName;
+        MaterialDescriptor.m_DiffuseColor = Vec3(1.0f, 1.0f, 1.0f);
+        MaterialDescriptor.m_Reflectivity = 0.5f;
+        MaterialDescriptor.m_Roughness = 0.3f;
+        m_pMaterial = m_Renderer.CreateMaterial(&MaterialDescriptor);
+
+        std::vector<Vertex> Vertices;
+        for (UINT Stack = 0; Stack <= g_SphereStacks; Stack++)
+        {
+            const float Theta = (float)M_PI * Stack / g_SphereStacks;
+            for (UINT Slice = 0; Slice <= g_SphereSlices; Slice++)
+            {
+                const float Phi = 2.0f * (float)M_PI * Slice / g_SphereSlices;
+                const Vec3 Normal(sinf(Theta) * cosf(Phi), cosf(Theta), sinf(Theta) * sinf(Phi));
+
+                Vertex SphereVertex;
+                SphereVertex.m_Position = Normal;
+                SphereVertex.m_Normal = Normal;
+                SphereVertex.m_Tangent = Vec3(-sinf(Phi), 0.0f, cosf(Phi));
+                SphereVertex.m_Tex = Vec2((float)Slice / g_SphereSlices, (float)Stack / g_SphereStacks);
+                Vertices.push_back(SphereVertex);
+            }
+        }
+
+        std::vector<unsigned int> Indices;
+        for (UINT Stack = 0; Stack < g_SphereStacks; Stack++)
+        {
+            for (UINT Slice = 0; Slice < g_SphereSlices; Slice++)
+            {
+                const UINT Corner = Stack * (g_SphereSlices + 1) + Slice;
+                const UINT Quad[] = { Corner, Corner + 1, Corner + g_SphereSlices + 1, Corner + 1, Corner + g_SphereSlices + 2, Corner + g_SphereSlices + 1 };
+                Indices.insert(Indices.end(), Quad, Quad + ARRAYSIZE(Quad));
+            }
+        }
+
+        CreateGeometryDescriptor GeometryDescriptor = {};
+        GeometryDescriptor.m_pVertices = Vertices.data();
+        GeometryDescriptor.m_NumVertices = (UINT)Vertices.size();
+        GeometryDescriptor.m_pIndices = Indices.data();
+        GeometryDescriptor.m_NumIndices = (UINT)Indices.size();
+        GeometryDescriptor.m_pMaterial = m_pMaterial;
+        m_pSphere = RT_RENDERER_CAST<RTGeometry *>(m_Renderer.CreateGeometry(&GeometryDescriptor));
+
+        m_pScene = RT_RENDERER_CAST<RTScene *>(m_Renderer.CreateScene(nullptr, false));
+        m_pScene->AddGeometry(m_pSphere);
+        m_pScene->PreDraw();
+
+        // 4x4 blocks of pixels across the sphere's silhouette so a 16 wide packet is one block
+        const UINT RaysPerSide = 64;
+        const glm::vec3 CameraPosition(0.0f, 0.0f, -3.0f);
+        for (UINT BlockY = 0; BlockY < RaysPerSide; BlockY += 4)
+        {
+            for (UINT BlockX = 0; BlockX < RaysPerSide; BlockX += 4)
+            {
+                for (UINT y = BlockY; y < BlockY + 4; y++)
+                {
+                    for (UINT x = BlockX; x < BlockX + 4; x++)
+                    {
+                        const glm::vec3 Target(2.0f * x / RaysPerSide - 1.0f, 2.0f * y / RaysPerSide - 1.0f, 0.0f);
+                        m_RayOrigins.push_back(CameraPosition);
+                        m_RayDirections.push_back(glm::normalize(Target - CameraPosition));
+                    }
+                }
+            }
+        }
+
+        for (UINT FirstRay = 0; FirstRay < m_RayOrigins.size(); FirstRay += 16)
+        {
+            RayBatch Batch(m_pScene->GetRTCScene(), &m_RayOrigins[FirstRay], &m_RayDirections[FirstRay], 16);
+            for (UINT RayIndex = 0; RayIndex < 16; RayIndex++)
+            {
+                if (Batch.GetGeometryID(RayIndex) == RTC_INVALID_GEOMETRY_ID) continue;
+
+                m_PrimIDs.push_back(Batch.GetPrimID(RayIndex));
+                m_BaryocentricCoords.push_back(Batch.GetBaryocentricCoordinate(RayIndex));
+                m_ConeWidths.push_back(0.001f * Batch.GetHitDistance(RayIndex));
+                m_HitDirections.push_back(m_RayDirections[FirstRay + RayIndex]);
+            }
+        }
+
+        std::mt19937 Generator(0);
+        std::uniform_real_distribution<float> Uniform(0.0f, 1.0f);
+        for (UINT i = 0; i < g_NumSamples; i++)
+        {
+            m_Samples.push_back(glm::vec2(Uniform(Generator), Uniform(Generator)));
+            m_UVs.push_back(glm::vec2(Uniform(Generator), Uniform(Generator)));
+
+            const float z = 2.0f * Uniform(Generator) - 1.0f;
+            const float Phi = 2.0f * (float)M_PI * Uniform(Generator);
+            const float r = sqrtf(max(0.0f, 1.0f - z * z));
+            m_Directions.push_back(glm::vec3(r * cosf(Phi), r * sinf(Phi), z));
+        }
+    }
+};
+
+void RayBatchIntersect(BenchmarkState &State, UINT PacketWidth)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    const UINT NumRays = (UINT)Scene.m_RayOrigins.size();
+    UINT FirstRay = 0;
+    while (State.KeepRunning())
+    {
+        RayBatch Batch(Scene.m_pScene->GetRTCScene(), &Scene.m_RayOrigins[FirstRay], &Scene.m_RayDirections[FirstRay], PacketWidth);
+        DoNotOptimize(Batch.GetHitDistance(0));
+        FirstRay = (FirstRay + PacketWidth) % NumRays;
+    }
+    State.SetItemsPerIteration(PacketWidth);
+}
+BENCHMARK_WITH_ARG(RayBatchIntersect, 1);
+BENCHMARK_WITH_ARG(RayBatchIntersect, 4);
+BENCHMARK_WITH_ARG(RayBatchIntersect, 8);
+BENCHMARK_WITH_ARG(RayBatchIntersect, 16);
+
+void RayBatchOcclude(BenchmarkState &State, UINT PacketWidth)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    const UINT NumRays = (UINT)Scene.m_RayOrigins.size();
+    UINT FirstRay = 0;
+    while (State.KeepRunning())
+    {
+        RayBatch Batch(Scene.m_pScene->GetRTCScene(), &Scene.m_RayOrigins[FirstRay], &Scene.m_RayDirections[FirstRay], PacketWidth, true);
+        DoNotOptimize(Batch.IsOccluded(0));
+        FirstRay = (FirstRay + PacketWidth) % NumRays;
+    }
+    State.SetItemsPerIteration(PacketWidth);
+}
+BENCHMARK_WITH_ARG(RayBatchOcclude, 1);
+BENCHMARK_WITH_ARG(RayBatchOcclude, 4);
+BENCHMARK_WITH_ARG(RayBatchOcclude, 8);
+BENCHMARK_WITH_ARG(RayBatchOcclude, 16);
+
+// RTImage::Sample without a footprint reads the nearest texel of the top level
+void ImageSamplePoint(BenchmarkState &State)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    std::shared_ptr<const RTImage> pImage = RTImageCache::GetImage(g_BenchmarkTextureName, true, RT_IMAGE_FORMAT_RGB16F);
+    UINT SampleIndex = 0;
+    while (State.KeepRunning())
+    {
+        DoNotOptimize(pImage->Sample(Scene.m_UVs[SampleIndex]));
+        SampleIndex = (SampleIndex + 1) % g_NumSamples;
+    }
+}
+BENCHMARK(ImageSamplePoint);
+
+void ImageSampleTrilinear(BenchmarkState &State, int Footprint)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    std::shared_ptr<const RTImage> pImage = RTImageCache::GetImage(g_BenchmarkTextureName, true, RT_IMAGE_FORMAT_RGB16F);
+    UINT SampleIndex = 0;
+    while (State.KeepRunning())
+    {
+        DoNotOptimize(pImage->Sample(Scene.m_UVs[SampleIndex], (float)Footprint - 0.5f));
+        SampleIndex = (SampleIndex + 1) % g_NumSamples;
+    }
+}
+// Footprints of a texel at the top level and a few levels down the mip chain
+BENCHMARK_WITH_ARG(ImageSampleTrilinear, -10);
+BENCHMARK_WITH_ARG(ImageSampleTrilinear, -6);
+
+void TextureCubeSample(BenchmarkState &State)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    char *FaceNames[TEXTURES_PER_CUBE];
+    for (UINT Face = 0; Face < TEXTURES_PER_CUBE; Face++)
+    {
+        FaceNames[Face] = (char *)g_BenchmarkTextureName;
+    }
+    RTTextureCube Cube(FaceNames, true);
+
+    UINT SampleIndex = 0;
+    while (State.KeepRunning())
+    {
+        DoNotOptimize(Cube.Sample(Scene.m_Directions[SampleIndex]));
+        SampleIndex = (SampleIndex + 1) % g_NumSamples;
+    }
+}
+BENCHMARK(TextureCubeSample);
+
+void TexturePanoramaSample(BenchmarkState &State)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    RTTexturePanorama Panorama((char *)g_BenchmarkPanoramaName, true);
+
+    UINT SampleIndex = 0;
+    while (State.KeepRunning())
+    {
+        DoNotOptimize(Panorama.Sample(Scene.m_Directions[SampleIndex]));
+        SampleIndex = (SampleIndex + 1) % g_NumSamples;
+    }
+}
+BENCHMARK(TexturePanoramaSample);
+
+void TexturePanoramaSampleDirection(BenchmarkState &State)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    RTTexturePanorama Panorama((char *)g_BenchmarkPanoramaName, true);
+
+    UINT SampleIndex = 0;
+    while (State.KeepRunning())
+    {
+        float PDF;
+        DoNotOptimize(Panorama.SampleDirection(Scene.m_Samples[SampleIndex], PDF));
+        SampleIndex = (SampleIndex + 1) % g_NumSamples;
+    }
+}
+BENCHMARK(TexturePanoramaSampleDirection);
+
+void CookTorranceEvaluate(BenchmarkState &State)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    CookTorrance BRDF;
+    const glm::vec3 Normal(0.0f, 1.0f, 0.0f);
+    const glm::vec3 ViewVector = glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f));
+
+    UINT SampleIndex = 0;
+    while (State.KeepRunning())
+    {
+        // Flip directions below the surface up so every evaluation does the full computation
+        glm::vec3 LightVector = Scene.m_Directions[SampleIndex];
+        LightVector.y = fabsf(LightVector.y);
+
+        float Fresnel;
+        DoNotOptimize(BRDF.BRDF(ViewVector, Normal, LightVector, 0.3f, 0.5f, Fresnel));
+        DoNotOptimize(Fresnel);
+        SampleIndex = (SampleIndex + 1) % g_NumSamples;
+    }
+}
+BENCHMARK(CookTorranceEvaluate);
+
+void CookTorranceEvaluateBatch(BenchmarkState &State, UINT NumRays)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    CookTorrance BRDF;
+    const glm::vec3 Normal(0.0f, 1.0f, 0.0f);
+    const glm::vec3 ViewVector = glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f));
+
+    std::vector<float> IncomingX(g_NumSamples), IncomingY(g_NumSamples), IncomingZ(g_NumSamples);
+    for (UINT i = 0; i < g_NumSamples; i++)
+    {
+        IncomingX[i] = Scene.m_Directions[i].x;
+        IncomingY[i] = fabsf(Scene.m_Directions[i].y);
+        IncomingZ[i] = Scene.m_Directions[i].z;
+    }
+    std::vector<float> Results(NumRays), Fresnel(NumRays);
+
+    UINT FirstSample = 0;
+    while (State.KeepRunning())
+    {
+        BRDF.BRDFBatch(ViewVector, Normal, &IncomingX[FirstSample], &IncomingY[FirstSample], &IncomingZ[FirstSample], 0.3f, 0.5f, Results.data(), Fresnel.data(), NumRays);
+        EscapePointer(Results.data());
+        EscapePointer(Fresnel.data());
+        ClobberMemory();
+        FirstSample = (FirstSample + NumRays) % (g_NumSamples - NumRays);
+    }
+    State.SetItemsPerIteration(NumRays);
+}
+BENCHMARK_WITH_ARG(CookTorranceEvaluateBatch, 16);
+
+void CosineWeightedGenerateRay(BenchmarkState &State)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    RTCosineWeightedRayGenerator RayGenerator(glm::normalize(glm::vec3(0.2f, 1.0f, -0.4f)));
+
+    UINT SampleIndex = 0;
+    while (State.KeepRunning())
+    {
+        DoNotOptimize(RayGenerator.GenerateRay(Scene.m_Samples[SampleIndex]));
+        SampleIndex = (SampleIndex + 1) % g_NumSamples;
+    }
+}
+BENCHMARK(CosineWeightedGenerateRay);
+
+void GeometryInterpolate(BenchmarkState &State, UINT NumHits)
+{
+    BenchmarkScene &Scene = BenchmarkScene::Get();
+    const UINT NumRecordedHits = (UINT)Scene.m_PrimIDs.size();
+    std::vector<RTHitAttributes> Attributes(NumHits);
+
+    UINT FirstHit = 0;
+    while (State.KeepRunning())
+    {
+        Scene.m_pSphere->Interpolate(
+            &Scene.m_PrimIDs[FirstHit],
+            &Scene.m_BaryocentricCoords[FirstHit],
+            &Scene.m_ConeWidths[FirstHit],
+            &Scene.m_HitDirections[FirstHit],
+            Attributes.data(),
+            NumHits);
+        EscapePointer(Attributes.data());
+        ClobberMemory();
+        FirstHit = (FirstHit + NumHits) % (NumRecordedHits - NumHits);
+    }
+    State.SetItemsPerIteration(NumHits);
+}
+BENCHMARK_WITH_ARG(GeometryInterpolate, 1);
+BENCHMARK_WITH_ARG(GeometryInterpolate, 64);
+
+void PlyParse(BenchmarkState &State)
+{
+    // Make sure the synthetic grid has been written
+    BenchmarkScene::Get();
+
+    while (State.KeepRunning())
+    {
+        SceneParser::Mesh Mesh;
+        PlyParser::PlyParser().Parse(g_BenchmarkPlyName, Mesh);
+        DoNotOptimize(Mesh.m_IndexBuffer.size());
+    }
+    State.SetItemsPerIteration(g_PlyGridSize * g_PlyGridSize);
+}
+BENCHMARK(PlyParse);
@@ -14,6 +14,7 @@ public:
     virtual Geometry *GetGeometryAtPixel(Camera *pCamera, Scene *pScene, Vec2 PixelCoord){ assert(false); }
 
     virtual Geometry *CreateGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor){ assert(false); }
+    virtual Geometry *CreateGeometryInstance(_In_ Geometry *pPrototype){ assert(false); }
     virtual void DestroyGeometry(_In_ Geometry *pGeometry){ assert(false); }
 
     virtual Light *CreateLight(_In_ CreateLightDescriptor *pCreateLightDescriptor){ assert(false); }
@@ -28,7 +29,7 @@ public:
     virtual EnvironmentMap *CreateEnvironmentMap(CreateEnvironmentMapDescriptor *pCreateEnvironmnetMapDescriptor){ assert(false); }
     virtual void DestroyEnviromentMap(EnvironmentMap *pEnvironmentMap){ assert(false); }
 
-    virtual Scene *CreateScene(EnvironmentMap *pEnvironmentMap){ assert(false); }
+    virtual Scene *CreateScene(EnvironmentMap *pEnvironmentMap, bool bDynamic){ assert(false); }
     virtual void DestroyScene(Scene *pScene){ assert(false); }
 private:
     CComPtr<ID3D12Device> m_pDevice;
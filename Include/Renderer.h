@@ -33,6 +33,9 @@ class Canvas : public ExtendableClass
 {
 public:
     virtual void WritePixel(unsigned int x, unsigned int y, Vec3 Color) = 0;
+
+    // pColors holds Width * Height colors row by row, the rectangle is written with a single call
+    virtual void WriteTile(unsigned int x, unsigned int y, unsigned int Width, unsigned int Height, _In_reads_(Width * Height) const Vec3 *pColors) = 0;
 };
 
 struct Vertex
@@ -191,12 +194,20 @@ public:
     virtual void AddLight(_In_ Light *pLight) = 0;
 };
 
+enum SamplerType
+{
+    RANDOM_SAMPLER,
+    HALTON_SAMPLER,
+    SOBOL_SAMPLER
+};
+
 struct RenderSettings
 {
-    RenderSettings(bool GammaCorrection) : m_GammaCorrection(GammaCorrection) {}
-    bool operator==(const RenderSettings &RenderFlags) { return m_GammaCorrection == RenderFlags.m_GammaCorrection; }
+    RenderSettings(bool GammaCorrection, SamplerType Sampler = SOBOL_SAMPLER) : m_GammaCorrection(GammaCorrection), m_SamplerType(Sampler) {}
+    bool operator==(const RenderSettings &RenderFlags) { return m_GammaCorrection == RenderFlags.m_GammaCorrection && m_SamplerType == RenderFlags.m_SamplerType; }
 
     bool m_GammaCorrection;
+    SamplerType m_SamplerType;
 };
 
 const RenderSettings DefaultRenderSettings(true);
@@ -210,6 +221,8 @@ public:
     virtual Geometry *GetGeometryAtPixel(Camera *pCamera, Scene *pScene, Vec2 PixelCoord) = 0;
 
     virtual Geometry *CreateGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor) = 0;
+    // Shares pPrototype's mesh and material, position it with Translate/Rotate. Released with DestroyGeometry
+    virtual Geometry *CreateGeometryInstance(_In_ Geometry *pPrototype) = 0;
     virtual void DestroyGeometry(_In_ Geometry *pGeometry) = 0;
 
     virtual Light *CreateLight(_In_ CreateLightDescriptor *pCreateLightDescriptor) = 0;
@@ -224,7 +237,9 @@ public:
     virtual EnvironmentMap *CreateEnvironmentMap(CreateEnvironmentMapDescriptor *pCreateEnvironmnetMapDescriptor) = 0;
     virtual void DestroyEnviromentMap(EnvironmentMap *pEnvironmentMap) = 0;
 
-    virtual Scene *CreateScene(EnvironmentMap *pEnvironmentMap) = 0;
+    // Geometry in a dynamic scene can be moved after the scene is first drawn. Renderers may build
+    // faster structures for static scenes, which then miss moves and geometry added after the first draw
+    virtual Scene *CreateScene(EnvironmentMap *pEnvironmentMap, bool bDynamic) = 0;
     virtual void DestroyScene(Scene *pScene) = 0;
 };
 
@@ -55,6 +55,10 @@ namespace PBRTParser
             {
                 ParseCamera(m_fileStream, outputScene);
             }
+            else if (!lastParsedWord.compare("Sampler"))
+            {
+                ParseSampler(m_fileStream, outputScene);
+            }
             else if (!lastParsedWord.compare("Transform"))
             {
                 ParseTransform();
@@ -164,6 +168,26 @@ namespace PBRTParser
         outputScene.m_Film.m_Filename = correctedFileName;
     }
 
+    void PBRTParser::ParseSampler(std::ifstream &fileStream, SceneParser::Scene &outputScene)
+    {
+        // "sobol" "integer pixelsamples" [ 64 ]
+        auto &lineStream = GetLineStream();
+        lineStream >> lastParsedWord;
+        outputScene.m_Sampler.m_SamplerName = CorrectNameString(lastParsedWord);
+
+        while (lineStream >> lastParsedWord)
+        {
+            if (!lastParsedWord.compare("\"integer"))
+            {
+                lineStream >> lastParsedWord;
+                if (!lastParsedWord.compare("pixelsamples\""))
+                {
+                    outputScene.m_Sampler.m_PixelSamples = (UINT)ParseFloat1(lineStream);
+                }
+            }
+        }
+    }
+
     void PBRTParser::ParseBracketedVector3(std::istream is, float &x, float &y, float &z)
     {
         is >> lastParsedWord;
@@ -78,6 +78,7 @@ class PBRTParser : public SceneParser::SceneParserClass
     private:
         void ParseFilm(std::ifstream &fileStream, SceneParser::Scene &outputScene);
         void ParseCamera(std::ifstream &fileStream, SceneParser::Scene &outputScene);
+        void ParseSampler(std::ifstream &fileStream, SceneParser::Scene &outputScene);
         void ParseWorld(std::ifstream &fileStream, SceneParser::Scene &outputScene);
         void ParseMaterial(std::ifstream &fileStream, SceneParser::Scene &outputScene);
         void ParseMesh(std::ifstream &fileStream, SceneParser::Scene &outputScene);
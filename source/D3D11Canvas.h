@@ -81,10 +81,23 @@ public:
         assert(m_pMappedData != nullptr);
 
         byte *pPixel = ((byte *)m_pMappedData) + m_RowPitch * y + x * sizeof(byte)* 4;
-        pPixel[0] = Color.x * 255.0f;
-        pPixel[1] = Color.y * 255.0f;
-        pPixel[2] = Color.z * 255.0f;
-        pPixel[3] = 0;
+        ConvertPixel(Color, pPixel);
+        PixelsWritten = true;
+    }
+
+    void WriteTile(unsigned int x, unsigned int y, unsigned int Width, unsigned int Height, _In_reads_(Width * Height) const Vec3 *pColors)
+    {
+        assert(m_pMappedData != nullptr);
+
+        for (unsigned int Row = 0; Row < Height; Row++)
+        {
+            byte *pPixel = ((byte *)m_pMappedData) + m_RowPitch * (y + Row) + x * sizeof(byte)* 4;
+            for (unsigned int Column = 0; Column < Width; Column++)
+            {
+                ConvertPixel(pColors[Row * Width + Column], pPixel);
+                pPixel += 4;
+            }
+        }
         PixelsWritten = true;
     }
 
@@ -97,6 +110,14 @@ public:
     }
 
 private:
+    static void ConvertPixel(const Vec3 &Color, byte *pPixel)
+    {
+        pPixel[0] = Color.x * 255.0f;
+        pPixel[1] = Color.y * 255.0f;
+        pPixel[2] = Color.z * 255.0f;
+        pPixel[3] = 0;
+    }
+
     void Map()
     {
         D3D11_MAPPED_SUBRESOURCE MappedResource;
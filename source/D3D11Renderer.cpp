@@ -422,6 +422,13 @@ Geometry* D3D11Renderer::CreateGeometry(_In_ CreateGeometryDescriptor *pCreateGe
     return pGeometry;
 }
 
+Geometry* D3D11Renderer::CreateGeometryInstance(_In_ Geometry *pPrototype)
+{
+    D3D11Geometry* pGeometry = new D3D11Geometry(m_pDevice, m_pImmediateContext, *(D3D11Geometry*)pPrototype);
+    MEM_CHK(pGeometry);
+    return pGeometry;
+}
+
 void D3D11Renderer::DestroyGeometry(_In_ Geometry *pGeometry)
 {
     delete pGeometry;
@@ -811,7 +818,7 @@ void D3D11Renderer::DestroyEnviromentMap(EnvironmentMap *pEnvironmentMap)
     delete pEnvironmentMap;
 }
 
-Scene *D3D11Renderer::CreateScene(EnvironmentMap *pEnvironmentMap)
+Scene *D3D11Renderer::CreateScene(EnvironmentMap *pEnvironmentMap, bool bDynamic)
 {
     D3D11EnvironmentMap *pD3D11EnvironmentMap = (D3D11EnvironmentMap *)pEnvironmentMap;
     FAIL_CHK(pEnvironmentMap == nullptr, "Null environment passed into CreateScene");
@@ -1162,6 +1169,19 @@ D3D11Geometry::D3D11Geometry(_In_ ID3D11Device *pDevice, _In_ ID3D11DeviceContex
     m_MinDimensions = XMVectorSet(MinX, MinY, MinZ, 0.0f);
 }
 
+D3D11Geometry::D3D11Geometry(_In_ ID3D11Device *pDevice, _In_ ID3D11DeviceContext *pImmediateContext, _In_ const D3D11Geometry &Prototype) :
+    D3D11Transformable(pDevice, pImmediateContext),
+    m_UsesIndexBuffer(Prototype.m_UsesIndexBuffer),
+    m_VertexCount(Prototype.m_VertexCount),
+    m_IndexCount(Prototype.m_IndexCount),
+    m_pVertexBuffer(Prototype.m_pVertexBuffer),
+    m_pIndexBuffer(Prototype.m_pIndexBuffer),
+    m_pMaterial(Prototype.m_pMaterial),
+    m_MaxDimensions(Prototype.m_MaxDimensions),
+    m_MinDimensions(Prototype.m_MinDimensions)
+{
+}
+
 D3D11Geometry::~D3D11Geometry()
 {
 }
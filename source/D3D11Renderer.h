@@ -127,6 +127,9 @@ class D3D11Geometry : public D3D11Transformable, public Geometry
 {
 public:
     D3D11Geometry(_In_ ID3D11Device *pDevice, _In_ ID3D11DeviceContext *pImmediateContext, _In_ CreateGeometryDescriptor *pCreateGeometryDescriptor);
+
+    // Instance of pPrototype, the vertex and index buffers are shared and only the world transform is new
+    D3D11Geometry(_In_ ID3D11Device *pDevice, _In_ ID3D11DeviceContext *pImmediateContext, _In_ const D3D11Geometry &Prototype);
     ~D3D11Geometry();
 
     ID3D11Buffer *GetVertexBuffer() const { return m_pVertexBuffer; }
@@ -438,6 +441,7 @@ public:
     void SetCanvas(Canvas* pCanvas);
 
     Geometry *CreateGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor);
+    Geometry *CreateGeometryInstance(_In_ Geometry *pPrototype);
     void DestroyGeometry(_In_ Geometry *pGeometry);
     
     Light *CreateLight(_In_ CreateLightDescriptor *pCreateLightDescriptor);
@@ -452,7 +456,7 @@ public:
     EnvironmentMap *CreateEnvironmentMap(CreateEnvironmentMapDescriptor *pCreateEnvironmnetMapDescriptor);
     void DestroyEnviromentMap(EnvironmentMap *pEnvironmentMap);
 
-    Scene *CreateScene(EnvironmentMap *pEnvironmentMap);
+    Scene *CreateScene(EnvironmentMap *pEnvironmentMap, bool bDynamic);
     void DestroyScene(Scene *pScene);
 
     void DrawScene(Camera *pCamera, Scene *pScene, const RenderSettings &RenderFlags);
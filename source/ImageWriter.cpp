@@ -0,0 +1,236 @@
+#include "ImageWriter.h"
+#include "RendererException.h"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+    void AppendBigEndian(std::vector<unsigned char> &Data, unsigned int Value)
+    {
+        Data.push_back((unsigned char)(Value >> 24));
+        Data.push_back((unsigned char)(Value >> 16));
+        Data.push_back((unsigned char)(Value >> 8));
+        Data.push_back((unsigned char)Value);
+    }
+
+    template<class T>
+    void AppendLittleEndian(std::vector<unsigned char> &Data, T Value)
+    {
+        const unsigned char *pBytes = (const unsigned char *)&Value;
+        Data.insert(Data.end(), pBytes, pBytes + sizeof(T));
+    }
+
+    void AppendString(std::vector<unsigned char> &Data, const char *String)
+    {
+        // Includes the null terminator
+        Data.insert(Data.end(), String, String + strlen(String) + 1);
+    }
+
+    unsigned int Crc32(const unsigned char *pData, size_t Size, unsigned int Crc = 0)
+    {
+        static unsigned int Table[256] = {};
+        if (Table[1] == 0)
+        {
+            for (unsigned int i = 0; i < 256; i++)
+            {
+                unsigned int Value = i;
+                for (int Bit = 0; Bit < 8; Bit++)
+                {
+                    Value = (Value & 1) ? 0xEDB88320 ^ (Value >> 1) : Value >> 1;
+                }
+                Table[i] = Value;
+            }
+        }
+
+        Crc = ~Crc;
+        for (size_t i = 0; i < Size; i++)
+        {
+            Crc = Table[(Crc ^ pData[i]) & 0xFF] ^ (Crc >> 8);
+        }
+        return ~Crc;
+    }
+
+    void AppendPNGChunk(std::vector<unsigned char> &File, const char *Type, const std::vector<unsigned char> &Data)
+    {
+        AppendBigEndian(File, (unsigned int)Data.size());
+        const size_t TypeOffset = File.size();
+        File.insert(File.end(), Type, Type + 4);
+        File.insert(File.end(), Data.begin(), Data.end());
+        AppendBigEndian(File, Crc32(&File[TypeOffset], File.size() - TypeOffset));
+    }
+
+    void WriteFile(const std::string &FileName, const std::vector<unsigned char> &Data)
+    {
+        std::ofstream File(FileName, std::ios::binary);
+        FAIL_CHK(!File.is_open(), "Failed to open " + FileName + " for writing");
+        File.write((const char *)Data.data(), Data.size());
+        FAIL_CHK(!File.good(), "Failed writing " + FileName);
+    }
+}
+
+void WritePNG(const std::string &FileName, _In_reads_(Width * Height) const RGBA8Pixel *pPixels, unsigned int Width, unsigned int Height)
+{
+    // Every row starts with a filter type byte, 0 leaves the row as is
+    const size_t RowSize = 1 + Width * sizeof(RGBA8Pixel);
+    std::vector<unsigned char> Scanlines(RowSize * Height);
+    for (unsigned int y = 0; y < Height; y++)
+    {
+        Scanlines[y * RowSize] = 0;
+        memcpy(&Scanlines[y * RowSize + 1], &pPixels[y * Width], Width * sizeof(RGBA8Pixel));
+    }
+
+    // zlib stream made of stored deflate blocks, a block holds at most 65535 bytes
+    std::vector<unsigned char> Deflated;
+    Deflated.push_back(0x78);
+    Deflated.push_back(0x01);
+    size_t Offset = 0;
+    do
+    {
+        const unsigned short BlockSize = (unsigned short)(std::min)(Scanlines.size() - Offset, (size_t)0xFFFF);
+        const bool bFinalBlock = Offset + BlockSize == Scanlines.size();
+        Deflated.push_back(bFinalBlock ? 1 : 0);
+        AppendLittleEndian(Deflated, BlockSize);
+        AppendLittleEndian(Deflated, (unsigned short)~BlockSize);
+        Deflated.insert(Deflated.end(), Scanlines.begin() + Offset, Scanlines.begin() + Offset + BlockSize);
+        Offset += BlockSize;
+    } while (Offset < Scanlines.size());
+
+    unsigned int AdlerA = 1, AdlerB = 0;
+    for (unsigned char Byte : Scanlines)
+    {
+        AdlerA = (AdlerA + Byte) % 65521;
+        AdlerB = (AdlerB + AdlerA) % 65521;
+    }
+    AppendBigEndian(Deflated, (AdlerB << 16) | AdlerA);
+
+    std::vector<unsigned char> Header;
+    AppendBigEndian(Header, Width);
+    AppendBigEndian(Header, Height);
+    const unsigned char HeaderFields[] = { 8, 6, 0, 0, 0 }; // 8 bits per channel, RGBA, no interlacing
+    Header.insert(Header.end(), HeaderFields, HeaderFields + sizeof(HeaderFields));
+
+    const unsigned char Signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::vector<unsigned char> File(Signature, Signature + sizeof(Signature));
+    AppendPNGChunk(File, "IHDR", Header);
+    AppendPNGChunk(File, "IDAT", Deflated);
+    AppendPNGChunk(File, "IEND", std::vector<unsigned char>());
+    WriteFile(FileName, File);
+}
+
+void WriteEXR(const std::string &FileName, _In_reads_(Width * Height) const Vec3 *pPixels, unsigned int Width, unsigned int Height)
+{
+    const int PixelTypeFloat = 2;
+    const char *ChannelNames[] = { "B", "G", "R" }; // Channels have to be listed alphabetically
+
+    std::vector<unsigned char> File;
+    AppendLittleEndian(File, 20000630); // Magic number
+    AppendLittleEndian(File, 2); // Version 2, single part scanline image
+
+    AppendString(File, "channels");
+    AppendString(File, "chlist");
+    AppendLittleEndian(File, (int)(3 * (2 + 16) + 1));
+    for (const char *ChannelName : ChannelNames)
+    {
+        AppendString(File, ChannelName);
+        AppendLittleEndian(File, PixelTypeFloat);
+        AppendLittleEndian(File, 0); // pLinear and reserved bytes
+        AppendLittleEndian(File, 1); // x sampling
+        AppendLittleEndian(File, 1); // y sampling
+    }
+    File.push_back(0);
+
+    AppendString(File, "compression");
+    AppendString(File, "compression");
+    AppendLittleEndian(File, 1);
+    File.push_back(0); // None
+
+    for (const char *WindowName : { "dataWindow", "displayWindow" })
+    {
+        AppendString(File, WindowName);
+        AppendString(File, "box2i");
+        AppendLittleEndian(File, 16);
+        AppendLittleEndian(File, 0);
+        AppendLittleEndian(File, 0);
+        AppendLittleEndian(File, (int)Width - 1);
+        AppendLittleEndian(File, (int)Height - 1);
+    }
+
+    AppendString(File, "lineOrder");
+    AppendString(File, "lineOrder");
+    AppendLittleEndian(File, 1);
+    File.push_back(0); // Increasing y
+
+    AppendString(File, "pixelAspectRatio");
+    AppendString(File, "float");
+    AppendLittleEndian(File, 4);
+    AppendLittleEndian(File, 1.0f);
+
+    AppendString(File, "screenWindowCenter");
+    AppendString(File, "v2f");
+    AppendLittleEndian(File, 8);
+    AppendLittleEndian(File, 0.0f);
+    AppendLittleEndian(File, 0.0f);
+
+    AppendString(File, "screenWindowWidth");
+    AppendString(File, "float");
+    AppendLittleEndian(File, 4);
+    AppendLittleEndian(File, 1.0f);
+    File.push_back(0); // End of header
+
+    // Uncompressed files store one scanline per chunk, the offset table points at each of them
+    const unsigned int ScanlineDataSize = Width * 3 * sizeof(float);
+    const unsigned long long FirstScanlineOffset = File.size() + Height * sizeof(unsigned long long);
+    for (unsigned int y = 0; y < Height; y++)
+    {
+        AppendLittleEndian(File, FirstScanlineOffset + (unsigned long long)y * (2 * sizeof(int) + ScanlineDataSize));
+    }
+
+    for (unsigned int y = 0; y < Height; y++)
+    {
+        AppendLittleEndian(File, (int)y);
+        AppendLittleEndian(File, (int)ScanlineDataSize);
+
+        // Channels are stored one after another within the scanline
+        const Vec3 *pRow = &pPixels[y * Width];
+        for (unsigned int x = 0; x < Width; x++) AppendLittleEndian(File, pRow[x].z);
+        for (unsigned int x = 0; x < Width; x++) AppendLittleEndian(File, pRow[x].y);
+        for (unsigned int x = 0; x < Width; x++) AppendLittleEndian(File, pRow[x].x);
+    }
+    WriteFile(FileName, File);
+}
+
+void WritePFM(const std::string &FileName, _In_reads_(Width * Height) const Vec3 *pPixels, unsigned int Width, unsigned int Height)
+{
+    // A negative scale marks the data as little endian, rows are stored bottom to top
+    const std::string Header = "PF\n" + std::to_string(Width) + " " + std::to_string(Height) + "\n-1.0\n";
+    std::vector<unsigned char> File(Header.begin(), Header.end());
+    for (unsigned int Row = 0; Row < Height; Row++)
+    {
+        const Vec3 *pRow = &pPixels[(Height - 1 - Row) * Width];
+        for (unsigned int x = 0; x < Width; x++)
+        {
+            AppendLittleEndian(File, pRow[x].x);
+            AppendLittleEndian(File, pRow[x].y);
+            AppendLittleEndian(File, pRow[x].z);
+        }
+    }
+    WriteFile(FileName, File);
+}
+
+std::string GetImageFileExtension(const std::string &FileName)
+{
+    const size_t ExtensionStart = FileName.find_last_of('.');
+    if (ExtensionStart == std::string::npos) return std::string();
+
+    std::string Extension = FileName.substr(ExtensionStart + 1);
+    std::transform(Extension.begin(), Extension.end(), Extension.begin(), ::tolower);
+    return Extension;
+}
+
+bool IsHDRImageFile(const std::string &FileName)
+{
+    const std::string Extension = GetImageFileExtension(FileName);
+    return Extension == "exr" || Extension == "pfm";
+}
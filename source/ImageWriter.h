@@ -0,0 +1,21 @@
+#pragma once
+#include "Renderer.h"
+#include "MemoryCanvas.h"
+
+#include <string>
+
+// Minimal writers for the images the batch renderer produces, none of them depend on a
+// GPU or an imaging library. Pixels are passed row by row starting at the top of the image
+
+// 8-bit RGBA, written with uncompressed deflate blocks
+void WritePNG(const std::string &FileName, _In_reads_(Width * Height) const RGBA8Pixel *pPixels, unsigned int Width, unsigned int Height);
+
+// 32-bit float RGB, uncompressed scanlines
+void WriteEXR(const std::string &FileName, _In_reads_(Width * Height) const Vec3 *pPixels, unsigned int Width, unsigned int Height);
+void WritePFM(const std::string &FileName, _In_reads_(Width * Height) const Vec3 *pPixels, unsigned int Width, unsigned int Height);
+
+// Lower case, without the dot. Empty if the name has no extension
+std::string GetImageFileExtension(const std::string &FileName);
+
+// True for the formats above that keep floating point colors
+bool IsHDRImageFile(const std::string &FileName);
@@ -20,6 +20,7 @@
 #include <list>
 #include "Strsafe.h"
 #include "PBRTParser.h"
+#include "SceneLoader.h"
 
 using namespace DirectX;
 
@@ -71,6 +72,7 @@ D3D11Canvas *g_pCanvas;
 
 SceneParser::Scene g_outputScene;
 std::string g_referenceImageFilePath;
+std::string g_renderStatsFilePath;
 
 bool g_MouseInitialized = false;
 int g_MouseX;
@@ -98,8 +100,6 @@ ID3D11Texture2D* g_pGoldenImage = nullptr;
 //--------------------------------------------------------------------------------------
 // Forward declarations
 //--------------------------------------------------------------------------------------
-void InitSceneAndCamera(_In_ Renderer *, _In_ EnvironmentMap *pEnvMap, _In_ const SceneParser::Scene &fileScene, std::unordered_map<std::string, Material *> &materialList, _Out_ Scene **, _Out_ Camera **);
-void InitEnvironmentMap(_In_ Renderer *pRenderer, const char *CubeMapName, const char *irradMapName, _Out_ EnvironmentMap **ppEnviromentMap);
 HRESULT InitWindow( HINSTANCE hInstance, int nCmdShow );
 LRESULT CALLBACK    WndProc( HWND, UINT, WPARAM, LPARAM );
 void UpdateCamera();
@@ -170,6 +170,11 @@ int WINAPI wWinMain( _In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         {
             sceneFilePath = parsedArgs[++argIndex];
         }
+
+        if (arg.compare("-stats") == 0 && argIndex < parsedArgs.size() - 1)
+        {
+            g_renderStatsFilePath = parsedArgs[++argIndex];
+        }
     }
 
     if(sceneFilePath.substr(sceneFilePath.size() - 4, 4).compare("pbrt") == 0)
@@ -188,6 +193,8 @@ int WINAPI wWinMain( _In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         g_Height = g_outputScene.m_Film.m_ResolutionY;
     }
 
+    g_RenderSettings.m_SamplerType = GetSamplerType(g_outputScene, g_RenderSettings.m_SamplerType);
+
     // DXUT will create and use the best device
     // that is available on the system depending on which D3D callbacks are set below
 
@@ -303,8 +310,15 @@ HRESULT CALLBACK OnDeviceCreated(_In_ ID3D11Device* pd3dDevice, _In_ const DXGI_
             g_pRenderer[i] = new D3D11Renderer(g_hWnd, g_Width, g_Height);
             break;
         case RENDERER_TYPE::RAYTRACER:
-            g_pRenderer[i] = new RTRenderer(g_Width, g_Height);
+        {
+            RTRenderer *pRTRenderer = new RTRenderer(g_Width, g_Height);
+            if (g_renderStatsFilePath.size())
+            {
+                pRTRenderer->EnableRenderStats(g_renderStatsFilePath.c_str());
+            }
+            g_pRenderer[i] = pRTRenderer;
             break;
+        }
         default:
             break;
         }
@@ -312,146 +326,13 @@ HRESULT CALLBACK OnDeviceCreated(_In_ ID3D11Device* pd3dDevice, _In_ const DXGI_
         g_pRenderer[i]->SetCanvas(g_pCanvas);
         InitEnvironmentMap(g_pRenderer[i], g_outputScene.m_EnvironmentMap.m_FileName.c_str(), "Assets\\EnvironmentMap\\Uffizi\\irrad", &g_pEnvironmentMap[i]);
         
-        InitSceneAndCamera(g_pRenderer[i], g_pEnvironmentMap[i], g_outputScene, g_MaterialList[i], &g_pScene[i], &g_pCamera[i]);
+        // Dynamic so geometry can be moved after the scene is built, picking traces the same scene
+        InitSceneAndCamera(g_pRenderer[i], g_pEnvironmentMap[i], g_outputScene, true, g_MaterialList[i], &g_pScene[i], &g_pCamera[i]);
     }
 
     return	S_OK;
 }
 
-Vec3 ConvertVec3(const SceneParser::Vector3 &vec)
-{
-    return Vec3(vec.x, vec.y, vec.z);
-}
-
-Vec2 ConvertVec2(const SceneParser::Vector2 &vec)
-{
-    return Vec2(vec.x, vec.y);
-}
-
-
-void InitEnvironmentMap(_In_ Renderer *pRenderer, const char *CubeMapName, const char* irradMapName, _Out_ EnvironmentMap **ppEnviromentMap)
-{
-    CreateEnvironmentMapDescriptor EnvMapDescriptor;
-    char textureCubFileNames[TEXTURES_PER_CUBE][MAX_ALLOWED_STR_LENGTH];
-    char irradTextureCubFileNames[TEXTURES_PER_CUBE][MAX_ALLOWED_STR_LENGTH];
-    EnvMapDescriptor.m_EnvironmentType = CreateEnvironmentMapDescriptor::EnvironmentType::TEXTURE_CUBE;
-    CreateEnvironmentTextureCube &TexCubeDescriptor = EnvMapDescriptor.m_TextureCube;
-    for (UINT i = 0; i < TEXTURES_PER_CUBE; i++)
-    {
-        sprintf_s(textureCubFileNames[i], "%s", CubeMapName);
-        TexCubeDescriptor.m_TextureNames[i] = textureCubFileNames[i];
-    }
-
-    *ppEnviromentMap = pRenderer->CreateEnvironmentMap(&EnvMapDescriptor);
-}
-
-void InitSceneAndCamera(_In_ Renderer *pRenderer, _In_ EnvironmentMap *pEnvMap, _In_ const SceneParser::Scene &fileScene, _Out_ std::unordered_map<std::string, Material*> &MaterialList, _Out_ Scene **ppScene, _Out_ Camera **ppCamera)
-{
-    *ppScene = pRenderer->CreateScene(pEnvMap);
-    Scene *pScene = *ppScene;
-
-    const UINT materialCount = g_outputScene.m_Materials.size();
-    MaterialList.reserve(materialCount);
-    for (auto &materialKeyValuePair : g_outputScene.m_Materials)
-    {
-        SceneParser::Material &material = materialKeyValuePair.second;
-
-        CreateMaterialDescriptor CreateMaterialDescriptor = {};
-        CreateMaterialDescriptor.m_TextureName = material.m_DiffuseTextureFilename.c_str();
-
-        CreateMaterialDescriptor.m_DiffuseColor.x = material.m_Diffuse.r;
-        CreateMaterialDescriptor.m_DiffuseColor.y = material.m_Diffuse.g;
-        CreateMaterialDescriptor.m_DiffuseColor.z = material.m_Diffuse.b;
-
-        // TODO: Need to add these
-        const float shininess = 0.5f;
-        CreateMaterialDescriptor.m_Reflectivity = 0.5f;
-        CreateMaterialDescriptor.m_Roughness = sqrt(2.0 / (shininess + 2.0f));
-
-        MaterialList[materialKeyValuePair.first] = pRenderer->CreateMaterial(&CreateMaterialDescriptor);
-    }
-
-    {
-        std::vector<Vertex> vertexList;
-        std::vector<unsigned int> indexList;
-        for (const SceneParser::Mesh &mesh : fileScene.m_Meshes)
-        {
-            UINT numVerts = mesh.m_VertexBuffer.size();
-            UINT numIndices = mesh.m_IndexBuffer.size();
-
-            vertexList.resize(numVerts);
-            indexList.resize(numIndices);
-            for (UINT vertIdx = 0; vertIdx < numVerts; vertIdx++)
-            {
-                const SceneParser::Vertex &inputVertex = mesh.m_VertexBuffer[vertIdx];
-                Vertex &vertex = vertexList[vertIdx];
-                vertex.m_Position = ConvertVec3(inputVertex.Position);
-                vertex.m_Normal = ConvertVec3(inputVertex.Normal);
-                vertex.m_Tex = ConvertVec2(inputVertex.UV);
-                vertex.m_Tangent = ConvertVec3(inputVertex.Tangents);
-            }
-            
-            for (UINT ibIdx = 0; ibIdx < mesh.m_IndexBuffer.size(); ibIdx++)
-            {
-                assert(mesh.m_IndexBuffer[ibIdx] >= 0);
-                indexList[ibIdx] = (UINT)mesh.m_IndexBuffer[ibIdx];
-            }
-
-            CreateGeometryDescriptor geometryDescriptor;
-            geometryDescriptor.m_pVertices = vertexList.data();
-            geometryDescriptor.m_NumVertices = numVerts;
-            geometryDescriptor.m_pIndices = indexList.data();
-            geometryDescriptor.m_NumIndices = numIndices;
-            geometryDescriptor.m_pMaterial = MaterialList[mesh.m_pMaterial->m_MaterialName];
-            assert(geometryDescriptor.m_pMaterial);
-
-            Geometry *pGeometry = pRenderer->CreateGeometry(&geometryDescriptor);
-            pScene->AddGeometry(pGeometry);
-        }
-    }
-
-    {
-        CreateLightDescriptor CreateLight;
-        CreateDirectionalLight CreateDirectional;
-        CreateDirectional.m_EmissionDirection = Vec3(1.0f, -1.0, -1.0);
-        CreateLight.m_Color = Vec3(1.0f, 1.0f, 1.0f);
-        CreateLight.m_LightType = CreateLightDescriptor::DIRECTIONAL_LIGHT;
-        CreateLight.m_pCreateDirectionalLight = &CreateDirectional;
-
-        Light *pLight = pRenderer->CreateLight(&CreateLight);
-        pScene->AddLight(pLight);
-    }
-
-    const float LensHeight = 2.0f;
-    const float AspectRatio = (float)fileScene.m_Film.m_ResolutionX / fileScene.m_Film.m_ResolutionY;
-    const float LensWidth = LensHeight * AspectRatio;
-
-    const float fovInRadians = fileScene.m_Camera.m_FieldOfView * M_PI / 180.0f;
-
-    float VerticalFov;
-    if (fileScene.m_Film.m_ResolutionY > fileScene.m_Film.m_ResolutionX)
-    {
-        const float FocalLength = LensWidth / (2.0f* tan(fovInRadians / 2.0f));
-        VerticalFov = 2 * atan(LensHeight / (2.0f * FocalLength));
-    }
-    else
-    {
-        VerticalFov = fovInRadians;
-    }
-
-    CreateCameraDescriptor CameraDescriptor = {};
-    CameraDescriptor.m_Height = fileScene.m_Film.m_ResolutionY;
-    CameraDescriptor.m_Width = fileScene.m_Film.m_ResolutionX;
-    CameraDescriptor.m_FocalPoint = ConvertVec3(fileScene.m_Camera.m_Position);
-    CameraDescriptor.m_LookAt = ConvertVec3(fileScene.m_Camera.m_LookAt);
-    CameraDescriptor.m_Up = ConvertVec3(fileScene.m_Camera.m_Up);
-    CameraDescriptor.m_NearClip = fileScene.m_Camera.m_NearPlane;
-    CameraDescriptor.m_FarClip = fileScene.m_Camera.m_FarPlane;
-    CameraDescriptor.m_VerticalFieldOfView = VerticalFov;
-
-    *ppCamera = pRenderer->CreateCamera(&CameraDescriptor);
-}
-
 void RenderText(float fps)
 {
     g_pTextWriter->Begin();
@@ -0,0 +1,92 @@
+#pragma once
+#include "Renderer.h"
+
+#include <assert.h>
+#include <string>
+#include <vector>
+
+static const char *FloatCanvasKey = "FloatCanvas";
+static const char *RGBA8CanvasKey = "RGBA8Canvas";
+
+struct RGBA8Pixel
+{
+    unsigned char r, g, b, a;
+};
+
+inline void ConvertCanvasPixel(const Vec3 &Color, Vec3 &Pixel)
+{
+    Pixel = Color;
+}
+
+inline unsigned char ConvertCanvasChannel(float Value)
+{
+    return Value <= 0.0f ? 0 : Value >= 1.0f ? 255 : (unsigned char)(Value * 255.0f + 0.5f);
+}
+
+inline void ConvertCanvasPixel(const Vec3 &Color, RGBA8Pixel &Pixel)
+{
+    Pixel.r = ConvertCanvasChannel(Color.x);
+    Pixel.g = ConvertCanvasChannel(Color.y);
+    Pixel.b = ConvertCanvasChannel(Color.z);
+    Pixel.a = 255;
+}
+
+// Canvas kept in system memory so the ray tracer can run without a window or a GPU.
+// Pixels are stored row by row with no padding
+template<class PixelType>
+class MemoryCanvas : public Canvas
+{
+public:
+    MemoryCanvas(unsigned int Width, unsigned int Height, const char *InterfaceKey) :
+        m_Width(Width), m_Height(Height), m_Pixels(Width * Height), m_InterfaceKey(InterfaceKey) {}
+
+    void WritePixel(unsigned int x, unsigned int y, Vec3 Color)
+    {
+        assert(x < m_Width && y < m_Height);
+        ConvertCanvasPixel(Color, m_Pixels[y * m_Width + x]);
+    }
+
+    void WriteTile(unsigned int x, unsigned int y, unsigned int Width, unsigned int Height, _In_reads_(Width * Height) const Vec3 *pColors)
+    {
+        assert(x + Width <= m_Width && y + Height <= m_Height);
+        for (unsigned int Row = 0; Row < Height; Row++)
+        {
+            PixelType *pPixels = &m_Pixels[(y + Row) * m_Width + x];
+            const Vec3 *pRowColors = &pColors[Row * Width];
+            for (unsigned int Column = 0; Column < Width; Column++)
+            {
+                ConvertCanvasPixel(pRowColors[Column], pPixels[Column]);
+            }
+        }
+    }
+
+    void GetInterface(const char *InterfaceName, void **ppInterface)
+    {
+        if (std::string(InterfaceName) == std::string(m_InterfaceKey))
+        {
+            *ppInterface = this;
+        }
+    }
+
+    unsigned int GetWidth() const { return m_Width; }
+    unsigned int GetHeight() const { return m_Height; }
+    const PixelType *GetPixels() const { return m_Pixels.data(); }
+
+private:
+    unsigned int m_Width, m_Height;
+    std::vector<PixelType> m_Pixels;
+    const char *m_InterfaceKey;
+};
+
+// Keeps the renderer's output unclamped, for writing out HDR images
+class FloatCanvas : public MemoryCanvas<Vec3>
+{
+public:
+    FloatCanvas(unsigned int Width, unsigned int Height) : MemoryCanvas(Width, Height, FloatCanvasKey) {}
+};
+
+class RGBA8Canvas : public MemoryCanvas<RGBA8Pixel>
+{
+public:
+    RGBA8Canvas(unsigned int Width, unsigned int Height) : MemoryCanvas(Width, Height, RGBA8CanvasKey) {}
+};
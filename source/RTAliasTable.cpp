@@ -0,0 +1,114 @@
+#include "RTAliasTable.h"
+
+#include <minmax.h>
+
+RTAliasTable::RTAliasTable(_In_reads_(NumWeights) const float *pWeights, UINT NumWeights) :
+    m_Buckets(NumWeights),
+    m_Weights(pWeights, pWeights + NumWeights),
+    m_TotalWeight(0.0f)
+{
+    double TotalWeight = 0.0;
+    for (UINT i = 0; i < NumWeights; i++)
+    {
+        TotalWeight += pWeights[i];
+    }
+    m_TotalWeight = (float)TotalWeight;
+    if (TotalWeight <= 0.0) return;
+
+    // Scale so the average bucket holds exactly 1, then fill every underfull
+    // bucket with the excess of an overfull one
+    std::vector<double> ScaledWeights(NumWeights);
+    std::vector<UINT> Small, Large;
+    for (UINT i = 0; i < NumWeights; i++)
+    {
+        ScaledWeights[i] = pWeights[i] * NumWeights / TotalWeight;
+        if (ScaledWeights[i] < 1.0)
+        {
+            Small.push_back(i);
+        }
+        else
+        {
+            Large.push_back(i);
+        }
+    }
+
+    while (!Small.empty() && !Large.empty())
+    {
+        const UINT SmallIndex = Small.back();
+        const UINT LargeIndex = Large.back();
+        Small.pop_back();
+
+        m_Buckets[SmallIndex].m_Threshold = (float)ScaledWeights[SmallIndex];
+        m_Buckets[SmallIndex].m_Alias = LargeIndex;
+
+        ScaledWeights[LargeIndex] -= 1.0 - ScaledWeights[SmallIndex];
+        if (ScaledWeights[LargeIndex] < 1.0)
+        {
+            Large.pop_back();
+            Small.push_back(LargeIndex);
+        }
+    }
+
+    // Whatever is left over is only off from 1 by rounding error
+    for (UINT i : Small)
+    {
+        m_Buckets[i].m_Threshold = 1.0f;
+        m_Buckets[i].m_Alias = i;
+    }
+    for (UINT i : Large)
+    {
+        m_Buckets[i].m_Threshold = 1.0f;
+        m_Buckets[i].m_Alias = i;
+    }
+}
+
+UINT RTAliasTable::Sample(float u, float &Remapped) const
+{
+    const UINT NumBuckets = GetSize();
+    const float Scaled = u * NumBuckets;
+    const UINT BucketIndex = min((UINT)Scaled, NumBuckets - 1);
+    const float Offset = min(Scaled - BucketIndex, 0.99999994f);
+
+    const Bucket &Entry = m_Buckets[BucketIndex];
+    if (Offset < Entry.m_Threshold)
+    {
+        Remapped = min(Offset / Entry.m_Threshold, 0.99999994f);
+        return BucketIndex;
+    }
+    else
+    {
+        Remapped = min((Offset - Entry.m_Threshold) / (1.0f - Entry.m_Threshold), 0.99999994f);
+        return Entry.m_Alias;
+    }
+}
+
+RTDistribution2D::RTDistribution2D(_In_reads_(Width * Height) const float *pWeights, UINT Width, UINT Height) :
+    m_Width(Width),
+    m_Height(Height)
+{
+    std::vector<float> RowWeights(Height);
+    m_Conditionals.reserve(Height);
+    for (UINT y = 0; y < Height; y++)
+    {
+        m_Conditionals.push_back(RTAliasTable(&pWeights[y * Width], Width));
+        RowWeights[y] = m_Conditionals[y].GetTotalWeight();
+    }
+    m_Marginal = RTAliasTable(RowWeights.data(), Height);
+}
+
+glm::vec2 RTDistribution2D::Sample(const glm::vec2 &u, float &PDF) const
+{
+    float RemappedX, RemappedY;
+    const UINT y = m_Marginal.Sample(u.y, RemappedY);
+    const UINT x = m_Conditionals[y].Sample(u.x, RemappedX);
+
+    PDF = m_Marginal.GetProbability(y) * m_Conditionals[y].GetProbability(x) * m_Width * m_Height;
+    return glm::vec2((x + RemappedX) / m_Width, (y + RemappedY) / m_Height);
+}
+
+float RTDistribution2D::PDF(const glm::vec2 &uv) const
+{
+    const UINT x = min((UINT)max(uv.x * m_Width, 0.0f), m_Width - 1);
+    const UINT y = min((UINT)max(uv.y * m_Height, 0.0f), m_Height - 1);
+    return m_Marginal.GetProbability(y) * m_Conditionals[y].GetProbability(x) * m_Width * m_Height;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "glm/vec2.hpp"
+
+#include <vector>
+#include <windows.h>
+
+// Walker/Vose alias table, picks an index proportional to its weight in constant time
+class RTAliasTable
+{
+public:
+    RTAliasTable() : m_TotalWeight(0.0f) {}
+    RTAliasTable(_In_reads_(NumWeights) const float *pWeights, UINT NumWeights);
+
+    // Remapped receives what is left of u after picking the index, uniformly distributed in [0, 1)
+    UINT Sample(float u, float &Remapped) const;
+
+    float GetProbability(UINT Index) const { return m_TotalWeight > 0.0f ? m_Weights[Index] / m_TotalWeight : 0.0f; }
+    float GetTotalWeight() const { return m_TotalWeight; }
+    UINT GetSize() const { return (UINT)m_Weights.size(); }
+private:
+    struct Bucket
+    {
+        float m_Threshold;
+        UINT m_Alias;
+    };
+
+    std::vector<Bucket> m_Buckets;
+    std::vector<float> m_Weights;
+    float m_TotalWeight;
+};
+
+// Piecewise constant distribution over an image, one alias table picks the row and
+// another the texel within that row so the two sample dimensions stay independent
+class RTDistribution2D
+{
+public:
+    RTDistribution2D() : m_Width(0), m_Height(0) {}
+    RTDistribution2D(_In_reads_(Width * Height) const float *pWeights, UINT Width, UINT Height);
+
+    bool IsValid() const { return m_Marginal.GetTotalWeight() > 0.0f; }
+
+    // Returns a point in [0, 1)^2, PDF is with respect to that area
+    glm::vec2 Sample(const glm::vec2 &u, float &PDF) const;
+    float PDF(const glm::vec2 &uv) const;
+private:
+    UINT m_Width, m_Height;
+    std::vector<RTAliasTable> m_Conditionals;
+    RTAliasTable m_Marginal;
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "glm/vec3.hpp"
+#include "glm/glm.hpp"
+
+#include <immintrin.h>
+#include <math.h>
+#include <sal.h>
+
+// Widest vector unit the compiler was allowed to target. SSE2 is part of x64 so the 
+// projects' default settings get 4 lanes, scalar code is only left for 32 bit builds without it
+#if defined(__AVX512F__)
+#define RT_BRDF_SIMD_WIDTH 16
+#elif defined(__AVX2__)
+#define RT_BRDF_SIMD_WIDTH 8
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define RT_BRDF_SIMD_WIDTH 4
+#else
+#define RT_BRDF_SIMD_WIDTH 1
+#endif
+
+// The BRDF terms are written once as templates over a lane type. Plain floats
+// are the scalar lane type, the SIMD lane types below overload the same helpers
+inline float LaneMin(float a, float b) { return a < b ? a : b; }
+inline float LaneMax(float a, float b) { return a > b ? a : b; }
+inline float LaneSqrt(float a) { return sqrtf(a); }
+inline void LoadLanes(_In_ const float *pData, float &Lanes) { Lanes = *pData; }
+inline void StoreLanes(_Out_ float *pData, float Lanes) { *pData = Lanes; }
+
+#if RT_BRDF_SIMD_WIDTH == 4
+struct RTFloat4
+{
+    RTFloat4() {}
+    RTFloat4(float Value) : m_Value(_mm_set1_ps(Value)) {}
+    RTFloat4(__m128 Value) : m_Value(Value) {}
+
+    __m128 m_Value;
+};
+
+inline RTFloat4 operator+(RTFloat4 a, RTFloat4 b) { return _mm_add_ps(a.m_Value, b.m_Value); }
+inline RTFloat4 operator-(RTFloat4 a, RTFloat4 b) { return _mm_sub_ps(a.m_Value, b.m_Value); }
+inline RTFloat4 operator*(RTFloat4 a, RTFloat4 b) { return _mm_mul_ps(a.m_Value, b.m_Value); }
+inline RTFloat4 operator/(RTFloat4 a, RTFloat4 b) { return _mm_div_ps(a.m_Value, b.m_Value); }
+inline RTFloat4 LaneMin(RTFloat4 a, RTFloat4 b) { return _mm_min_ps(a.m_Value, b.m_Value); }
+inline RTFloat4 LaneMax(RTFloat4 a, RTFloat4 b) { return _mm_max_ps(a.m_Value, b.m_Value); }
+inline RTFloat4 LaneSqrt(RTFloat4 a) { return _mm_sqrt_ps(a.m_Value); }
+inline void LoadLanes(_In_reads_(4) const float *pData, RTFloat4 &Lanes) { Lanes.m_Value = _mm_loadu_ps(pData); }
+inline void StoreLanes(_Out_writes_(4) float *pData, RTFloat4 Lanes) { _mm_storeu_ps(pData, Lanes.m_Value); }
+
+typedef RTFloat4 RTFloatLanes;
+#elif RT_BRDF_SIMD_WIDTH == 8
+struct RTFloat8
+{
+    RTFloat8() {}
+    RTFloat8(float Value) : m_Value(_mm256_set1_ps(Value)) {}
+    RTFloat8(__m256 Value) : m_Value(Value) {}
+
+    __m256 m_Value;
+};
+
+inline RTFloat8 operator+(RTFloat8 a, RTFloat8 b) { return _mm256_add_ps(a.m_Value, b.m_Value); }
+inline RTFloat8 operator-(RTFloat8 a, RTFloat8 b) { return _mm256_sub_ps(a.m_Value, b.m_Value); }
+inline RTFloat8 operator*(RTFloat8 a, RTFloat8 b) { return _mm256_mul_ps(a.m_Value, b.m_Value); }
+inline RTFloat8 operator/(RTFloat8 a, RTFloat8 b) { return _mm256_div_ps(a.m_Value, b.m_Value); }
+inline RTFloat8 LaneMin(RTFloat8 a, RTFloat8 b) { return _mm256_min_ps(a.m_Value, b.m_Value); }
+inline RTFloat8 LaneMax(RTFloat8 a, RTFloat8 b) { return _mm256_max_ps(a.m_Value, b.m_Value); }
+inline RTFloat8 LaneSqrt(RTFloat8 a) { return _mm256_sqrt_ps(a.m_Value); }
+inline void LoadLanes(_In_reads_(8) const float *pData, RTFloat8 &Lanes) { Lanes.m_Value = _mm256_loadu_ps(pData); }
+inline void StoreLanes(_Out_writes_(8) float *pData, RTFloat8 Lanes) { _mm256_storeu_ps(pData, Lanes.m_Value); }
+
+typedef RTFloat8 RTFloatLanes;
+#elif RT_BRDF_SIMD_WIDTH == 16
+struct RTFloat16
+{
+    RTFloat16() {}
+    RTFloat16(float Value) : m_Value(_mm512_set1_ps(Value)) {}
+    RTFloat16(__m512 Value) : m_Value(Value) {}
+
+    __m512 m_Value;
+};
+
+inline RTFloat16 operator+(RTFloat16 a, RTFloat16 b) { return _mm512_add_ps(a.m_Value, b.m_Value); }
+inline RTFloat16 operator-(RTFloat16 a, RTFloat16 b) { return _mm512_sub_ps(a.m_Value, b.m_Value); }
+inline RTFloat16 operator*(RTFloat16 a, RTFloat16 b) { return _mm512_mul_ps(a.m_Value, b.m_Value); }
+inline RTFloat16 operator/(RTFloat16 a, RTFloat16 b) { return _mm512_div_ps(a.m_Value, b.m_Value); }
+inline RTFloat16 LaneMin(RTFloat16 a, RTFloat16 b) { return _mm512_min_ps(a.m_Value, b.m_Value); }
+inline RTFloat16 LaneMax(RTFloat16 a, RTFloat16 b) { return _mm512_max_ps(a.m_Value, b.m_Value); }
+inline RTFloat16 LaneSqrt(RTFloat16 a) { return _mm512_sqrt_ps(a.m_Value); }
+inline void LoadLanes(_In_reads_(16) const float *pData, RTFloat16 &Lanes) { Lanes.m_Value = _mm512_loadu_ps(pData); }
+inline void StoreLanes(_Out_writes_(16) float *pData, RTFloat16 Lanes) { _mm512_storeu_ps(pData, Lanes.m_Value); }
+
+typedef RTFloat16 RTFloatLanes;
+#else
+typedef float RTFloatLanes;
+#endif
+
+template<class T>
+T Saturate(T n)
+{
+    return LaneMin(T(1.0f), LaneMax(n, T(0.0f)));
+}
+
+// Cosines needed by the microfacet terms, all clamped to [0, 1]
+template<class T>
+struct BRDFCosines
+{
+    T m_NDotL;
+    T m_NDotV;
+    T m_NDotH;
+};
+
+const float cBRDFPi = 3.14159265f;
+
+struct Fresnel_ShlicksApproximation
+{
+    template<class T>
+    static T Evaluate(const BRDFCosines<T> &Cosines, float BaseReflectivity)
+    {
+        const T OneMinusCos = T(1.0f) - Cosines.m_NDotH;
+        const T OneMinusCosSquared = OneMinusCos * OneMinusCos;
+        return T(BaseReflectivity) + T(1.0f - BaseReflectivity) * OneMinusCosSquared * OneMinusCosSquared * OneMinusCos;
+    }
+};
+
+struct Distribution_GGX
+{
+    template<class T>
+    static T Evaluate(const BRDFCosines<T> &Cosines, float Roughness)
+    {
+        const float RoughnessSquared = Roughness * Roughness;
+        const T Quotient = Cosines.m_NDotH * Cosines.m_NDotH * T(RoughnessSquared - 1.0f) + T(1.0f);
+        return T(RoughnessSquared) / (T(cBRDFPi) * Quotient * Quotient);
+    }
+};
+
+struct GeometricAttenuation_Schlick
+{
+    template<class T>
+    static T Evaluate(const BRDFCosines<T> &Cosines, float Roughness)
+    {
+        // sqrt(2 / pi)
+        const float k = Roughness * 0.797884561f;
+        return Partial(Cosines.m_NDotV, k) * Partial(Cosines.m_NDotL, k);
+    }
+
+private:
+    template<class T>
+    static T Partial(T NDotX, float k)
+    {
+        return NDotX / (NDotX * T(1.0f - k) + T(k));
+    }
+};
+
+class BRDFShader
+{
+public:
+    virtual float BRDF(_In_ const glm::vec3 &ViewVector, _In_ const glm::vec3 &Normal, _In_ const glm::vec3 &IncomingRadianceVector, _In_ float roughness, _In_ float baseReflectivity, _Out_ float &FresnelFactor) = 0;
+};
+
+// Cook-Torrance microfacet BRDF, the model terms are picked at compile time
+template<class FresnelTerm, class DistributionTerm, class GeometryTerm>
+class CookTorranceBRDF : public BRDFShader
+{
+public:
+    float BRDF(_In_ const glm::vec3 &ViewVector, _In_ const glm::vec3 &Normal, _In_ const glm::vec3 &IncomingRadianceVector, _In_ float Roughness, _In_ float BaseReflectivity, _Out_ float &FresnelFactor)
+    {
+        const glm::vec3 HalfwayVector = glm::normalize(ViewVector + IncomingRadianceVector);
+
+        BRDFCosines<float> Cosines;
+        Cosines.m_NDotL = Saturate(glm::dot(Normal, IncomingRadianceVector));
+        Cosines.m_NDotV = Saturate(glm::dot(Normal, ViewVector));
+        Cosines.m_NDotH = Saturate(glm::dot(Normal, HalfwayVector));
+        return Evaluate(Cosines, Roughness, BaseReflectivity, FresnelFactor);
+    }
+
+    // Evaluates NumRays incoming directions that share a view vector and normal, the
+    // directions are passed as structure-of-arrays so they can be processed a vector at a time
+    void BRDFBatch(
+        _In_ const glm::vec3 &ViewVector,
+        _In_ const glm::vec3 &Normal,
+        _In_reads_(NumRays) const float *pIncomingX,
+        _In_reads_(NumRays) const float *pIncomingY,
+        _In_reads_(NumRays) const float *pIncomingZ,
+        _In_ float Roughness,
+        _In_ float BaseReflectivity,
+        _Out_writes_(NumRays) float *pBRDF,
+        _Out_writes_(NumRays) float *pFresnelFactor,
+        unsigned int NumRays)
+    {
+        unsigned int RayIndex = 0;
+        for (; RayIndex + RT_BRDF_SIMD_WIDTH <= NumRays; RayIndex += RT_BRDF_SIMD_WIDTH)
+        {
+            EvaluateLanes<RTFloatLanes>(ViewVector, Normal, pIncomingX + RayIndex, pIncomingY + RayIndex, pIncomingZ + RayIndex, Roughness, BaseReflectivity, pBRDF + RayIndex, pFresnelFactor + RayIndex);
+        }
+
+        for (; RayIndex < NumRays; RayIndex++)
+        {
+            EvaluateLanes<float>(ViewVector, Normal, pIncomingX + RayIndex, pIncomingY + RayIndex, pIncomingZ + RayIndex, Roughness, BaseReflectivity, pBRDF + RayIndex, pFresnelFactor + RayIndex);
+        }
+    }
+
+private:
+    template<class T>
+    static T Evaluate(const BRDFCosines<T> &Cosines, float Roughness, float BaseReflectivity, T &FresnelFactor)
+    {
+        FresnelFactor = FresnelTerm::Evaluate(Cosines, BaseReflectivity);
+        const T Distribution = DistributionTerm::Evaluate(Cosines, Roughness);
+        const T GeometricAttenuation = GeometryTerm::Evaluate(Cosines, Roughness);
+
+        // G carries a factor of NDotL * NDotV, the clamp only matters for grazing angles where both are 0
+        return FresnelFactor * Distribution * GeometricAttenuation / LaneMax(T(4.0f) * Cosines.m_NDotL * Cosines.m_NDotV, T(1e-7f));
+    }
+
+    template<class T>
+    static void EvaluateLanes(
+        const glm::vec3 &ViewVector,
+        const glm::vec3 &Normal,
+        const float *pIncomingX,
+        const float *pIncomingY,
+        const float *pIncomingZ,
+        float Roughness,
+        float BaseReflectivity,
+        float *pBRDF,
+        float *pFresnelFactor)
+    {
+        T Lx, Ly, Lz;
+        LoadLanes(pIncomingX, Lx);
+        LoadLanes(pIncomingY, Ly);
+        LoadLanes(pIncomingZ, Lz);
+
+        const T Hx = Lx + T(ViewVector.x);
+        const T Hy = Ly + T(ViewVector.y);
+        const T Hz = Lz + T(ViewVector.z);
+        const T HLength = LaneSqrt(Hx * Hx + Hy * Hy + Hz * Hz);
+
+        BRDFCosines<T> Cosines;
+        Cosines.m_NDotL = Saturate(Lx * T(Normal.x) + Ly * T(Normal.y) + Lz * T(Normal.z));
+        Cosines.m_NDotV = T(Saturate(glm::dot(Normal, ViewVector)));
+        Cosines.m_NDotH = Saturate((Hx * T(Normal.x) + Hy * T(Normal.y) + Hz * T(Normal.z)) / HLength);
+
+        T FresnelFactor;
+        const T BRDFValue = Evaluate(Cosines, Roughness, BaseReflectivity, FresnelFactor);
+        StoreLanes(pBRDF, BRDFValue);
+        StoreLanes(pFresnelFactor, FresnelFactor);
+    }
+};
+
+typedef CookTorranceBRDF<Fresnel_ShlicksApproximation, Distribution_GGX, GeometricAttenuation_Schlick> CookTorrance;
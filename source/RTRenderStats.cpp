@@ -0,0 +1,112 @@
+#include "RTRenderStats.h"
+
+thread_local RTRayCounters *g_pThreadRayCounters = nullptr;
+
+void RTRayCounters::Clear()
+{
+    for (unsigned int i = 0; i < RT_NUM_RAY_TYPES; i++)
+    {
+        m_NumRays[i] = 0;
+    }
+    for (unsigned int i = 0; i < RT_NUM_PACKET_WIDTHS; i++)
+    {
+        m_NumPackets[i] = 0;
+        m_NumPacketRays[i] = 0;
+    }
+    m_TraversalMilliseconds = 0.0;
+}
+
+void RTRayCounters::Add(const RTRayCounters &Counters)
+{
+    for (unsigned int i = 0; i < RT_NUM_RAY_TYPES; i++)
+    {
+        m_NumRays[i] += Counters.m_NumRays[i];
+    }
+    for (unsigned int i = 0; i < RT_NUM_PACKET_WIDTHS; i++)
+    {
+        m_NumPackets[i] += Counters.m_NumPackets[i];
+        m_NumPacketRays[i] += Counters.m_NumPacketRays[i];
+    }
+    m_TraversalMilliseconds += Counters.m_TraversalMilliseconds;
+}
+
+void RTRenderStats::BeginFrame()
+{
+    m_FrameIndex++;
+    m_FrameMilliseconds = 0.0;
+    m_SceneCommitMilliseconds = 0.0;
+    m_RayCounters.Clear();
+    m_WorkerTimings.clear();
+    m_TileTimings.clear();
+}
+
+void RTRenderStats::AddRayCounters(const RTRayCounters &Counters)
+{
+    std::lock_guard<std::mutex> Lock(m_RayCountersLock);
+    m_RayCounters.Add(Counters);
+}
+
+void RTRenderStats::EndFrame(double FrameMilliseconds, const RTTileScheduler &Scheduler)
+{
+    m_FrameMilliseconds = FrameMilliseconds;
+    for (unsigned int WorkerIndex = 0; WorkerIndex < Scheduler.GetNumWorkers(); WorkerIndex++)
+    {
+        m_WorkerTimings.push_back(Scheduler.GetWorkerTiming(WorkerIndex));
+
+        const std::vector<RTTileScheduler::TileTiming> &TileTimings = Scheduler.GetTileTimings(WorkerIndex);
+        m_TileTimings.insert(m_TileTimings.end(), TileTimings.begin(), TileTimings.end());
+    }
+}
+
+void RTRenderStats::WriteJSON(std::ostream &Stream) const
+{
+    const char *RayTypeNames[RT_NUM_RAY_TYPES] = { "primary", "reflection", "shadow" };
+
+    Stream << "{\"frame\":" << m_FrameIndex
+        << ",\"frameMs\":" << m_FrameMilliseconds
+        << ",\"sceneCommitMs\":" << m_SceneCommitMilliseconds
+        << ",\"traversalMs\":" << m_RayCounters.m_TraversalMilliseconds;
+
+    Stream << ",\"rays\":{";
+    for (unsigned int i = 0; i < RT_NUM_RAY_TYPES; i++)
+    {
+        Stream << (i ? "," : "") << "\"" << RayTypeNames[i] << "\":" << m_RayCounters.m_NumRays[i];
+    }
+    Stream << "}";
+
+    Stream << ",\"packets\":[";
+    for (unsigned int i = 0; i < RT_NUM_PACKET_WIDTHS; i++)
+    {
+        const unsigned long long NumLanes = m_RayCounters.m_NumPackets[i] * RTPacketWidths[i];
+        Stream << (i ? "," : "")
+            << "{\"width\":" << RTPacketWidths[i]
+            << ",\"count\":" << m_RayCounters.m_NumPackets[i]
+            << ",\"fillRate\":" << (NumLanes ? (double)m_RayCounters.m_NumPacketRays[i] / NumLanes : 0.0) << "}";
+    }
+    Stream << "]";
+
+    Stream << ",\"threads\":[";
+    for (size_t i = 0; i < m_WorkerTimings.size(); i++)
+    {
+        const RTTileScheduler::WorkerTiming &Timing = m_WorkerTimings[i];
+        Stream << (i ? "," : "")
+            << "{\"busyMs\":" << Timing.m_BusyMilliseconds
+            << ",\"idleMs\":" << Timing.m_IdleMilliseconds
+            << ",\"tiles\":" << Timing.m_NumTiles << "}";
+    }
+    Stream << "]";
+
+    Stream << ",\"tiles\":[";
+    for (size_t i = 0; i < m_TileTimings.size(); i++)
+    {
+        const RTTileScheduler::TileTiming &Timing = m_TileTimings[i];
+        Stream << (i ? "," : "")
+            << "{\"x\":" << Timing.m_Tile.m_X
+            << ",\"y\":" << Timing.m_Tile.m_Y
+            << ",\"width\":" << Timing.m_Tile.m_Width
+            << ",\"height\":" << Timing.m_Tile.m_Height
+            << ",\"thread\":" << Timing.m_WorkerIndex
+            << ",\"ms\":" << Timing.m_Milliseconds << "}";
+    }
+    Stream << "]}\n";
+}
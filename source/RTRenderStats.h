@@ -0,0 +1,79 @@
+#pragma once
+#include "RTTileScheduler.h"
+
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+enum RTRayType
+{
+    RT_PRIMARY_RAY,
+    RT_REFLECTION_RAY,
+    RT_SHADOW_RAY, // Also covers the visibility rays cast towards environment samples
+    RT_NUM_RAY_TYPES
+};
+
+// Packet sizes RayBatch picks between, a packet is traced at the smallest width that fits its rays
+const unsigned int RTPacketWidths[] = { 1, 4, 8, 16 };
+const unsigned int RT_NUM_PACKET_WIDTHS = sizeof(RTPacketWidths) / sizeof(RTPacketWidths[0]);
+
+// Counters for the rays traced while rendering a tile. Each thread fills in its own
+// and they're merged into RTRenderStats once per tile so tracing never takes a lock
+struct RTRayCounters
+{
+    RTRayCounters() { Clear(); }
+
+    void Clear();
+    void Add(const RTRayCounters &Counters);
+
+    unsigned long long m_NumRays[RT_NUM_RAY_TYPES];
+    unsigned long long m_NumPackets[RT_NUM_PACKET_WIDTHS];
+    unsigned long long m_NumPacketRays[RT_NUM_PACKET_WIDTHS]; // Active lanes, m_NumPackets * width if every packet was full
+    double m_TraversalMilliseconds; // Time spent inside Embree, summed over all threads
+};
+
+// Counters for the tile the calling thread is rendering, null while stats aren't collected
+extern thread_local RTRayCounters *g_pThreadRayCounters;
+
+inline void CountRays(RTRayType Type, unsigned int NumRays)
+{
+    if (g_pThreadRayCounters)
+    {
+        g_pThreadRayCounters->m_NumRays[Type] += NumRays;
+    }
+}
+
+// Everything measured over one RTRenderer::DrawScene call. Frames are written out as a
+// single line of JSON so a run can be appended to one file and read back line by line
+class RTRenderStats
+{
+public:
+    RTRenderStats() : m_FrameIndex(0), m_FrameMilliseconds(0.0), m_SceneCommitMilliseconds(0.0) {}
+
+    void BeginFrame();
+    // Thread safe, called by every worker as it finishes a tile
+    void AddRayCounters(const RTRayCounters &Counters);
+    void SetSceneCommitTime(double Milliseconds) { m_SceneCommitMilliseconds = Milliseconds; }
+    // Scheduler is the one that rendered the frame, it needs to have had timings enabled
+    void EndFrame(double FrameMilliseconds, const RTTileScheduler &Scheduler);
+
+    void WriteJSON(std::ostream &Stream) const;
+
+    unsigned int GetFrameIndex() const { return m_FrameIndex; }
+    double GetFrameTime() const { return m_FrameMilliseconds; }
+    double GetSceneCommitTime() const { return m_SceneCommitMilliseconds; }
+    const RTRayCounters &GetRayCounters() const { return m_RayCounters; }
+    const std::vector<RTTileScheduler::WorkerTiming> &GetWorkerTimings() const { return m_WorkerTimings; }
+    const std::vector<RTTileScheduler::TileTiming> &GetTileTimings() const { return m_TileTimings; }
+
+private:
+    unsigned int m_FrameIndex;
+    double m_FrameMilliseconds;
+    double m_SceneCommitMilliseconds;
+
+    std::mutex m_RayCountersLock;
+    RTRayCounters m_RayCounters;
+
+    std::vector<RTTileScheduler::WorkerTiming> m_WorkerTimings;
+    std::vector<RTTileScheduler::TileTiming> m_TileTimings;
+};
@@ -3,10 +3,14 @@
 
 #include <atlbase.h>
 #include <queue>
+#include <fstream>
+#include <chrono>
+#include <intrin.h>
 
 #include "glm/vec3.hpp"
 #include "glm/gtx/transform.hpp"
 #include "glm/gtx/fast_square_root.inl"
+#include "glm/gtc/packing.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image/stb_image.h"
@@ -15,6 +19,37 @@ const RTCGeometryFlags cGeometryFlag = RTC_GEOMETRY_STATIC;
 const RTCSceneFlags cSceneFlags = RTC_SCENE_STATIC;
 
 const bool g_bGammaCorrectTextures = true;
+const bool g_bFilterTextures = true;
+const bool g_bTileTextures = true;
+const bool g_bCompressVertexAttributes = true;
+
+// Decoded textures (mip chain included) are written out to this directory next to the executable
+// and reused by later runs, keyed by a hash of the source file and every setting that changes the decoded texels
+const bool g_bCacheDecodedTextures = true;
+const char *g_TextureCacheDirectory = "TextureCache";
+const UINT g_TextureCacheVersion = 1;
+
+// Cached textures at least this large are paged in a tile run at a time instead of being
+// read up front, see RTTexturePageCache for the memory budget
+const bool g_bPageTextures = true;
+const UINT64 g_MinPagedTextureBytes = 4 * 1024 * 1024;
+
+std::atomic<UINT> g_NumImagesCreated(0);
+std::atomic<UINT> g_NumTextureCacheWrites(0);
+
+// Anchored to the executable rather than the working directory so every run shares one cache
+const std::string &GetTextureCacheDirectory()
+{
+    static const std::string Directory = []()
+    {
+        char ExecutablePath[MAX_PATH];
+        const DWORD PathLength = GetModuleFileNameA(nullptr, ExecutablePath, MAX_PATH);
+        const std::string Path(ExecutablePath, PathLength > 0 && PathLength < MAX_PATH ? PathLength : 0);
+        const size_t DirectoryEnd = Path.find_last_of("\\/");
+        return (DirectoryEnd == std::string::npos ? std::string() : Path.substr(0, DirectoryEnd + 1)) + g_TextureCacheDirectory;
+    }();
+    return Directory;
+}
 
 void error_handler(const RTCError code, const char* str)
 {
@@ -37,27 +72,6 @@ void error_handler(const RTCError code, const char* str)
     exit(1);
 }
 
-void FailWithLastError()     
-{
-    DWORD retSize;
-    LPTSTR pTemp = NULL;
-
-    retSize = FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER |
-        FORMAT_MESSAGE_FROM_SYSTEM |
-        FORMAT_MESSAGE_ARGUMENT_ARRAY,
-        NULL,
-        GetLastError(),
-        LANG_NEUTRAL,
-        (LPTSTR)&pTemp,
-        0,
-        NULL);
-
-    char ErrorBuffer[1024];
-    sprintf(ErrorBuffer, "%0.*s (0x%x)", sizeof(ErrorBuffer), pTemp, GetLastError());
-
-    FAIL_CHK(true, std::string(ErrorBuffer));
-}
-
 FORCEINLINE glm::vec3 RealArrayToGlmVec3(_In_ Vec3 Vector)
 {
     return glm::vec3(Vector.x, Vector.y, Vector.z);
@@ -71,9 +85,48 @@ FORCEINLINE Vec3 GlmVec3ToRealArray(_In_ glm::vec3 Vector)
 float ConvertCharToFloat(unsigned char CharColor) { return (float)CharColor / 255.0f; }
 unsigned char ConvertFloatToChar(float floatColor) { return (unsigned char)(floatColor * 255.0f); }
 
-float FltRand()
+// Maps every 8-bit value to float so decoding a texel is a table lookup instead of a divide and a pow
+struct RTByteDecodeTable
+{
+    RTByteDecodeTable(float Gamma)
+    {
+        for (UINT i = 0; i < 256; i++)
+        {
+            m_Values[i] = pow(ConvertCharToFloat((unsigned char)i), Gamma);
+        }
+    }
+
+    float m_Values[256];
+};
+
+const RTByteDecodeTable g_LinearDecodeTable(1.0f);
+const RTByteDecodeTable g_GammaDecodeTable(2.2f);
+
+// 64-bit FNV-1a, Hash can be passed back in to continue hashing more data
+UINT64 HashBytes(_In_reads_(NumBytes) const void *pData, size_t NumBytes, UINT64 Hash = 14695981039346656037ull)
+{
+    const unsigned char *pBytes = (const unsigned char *)pData;
+    for (size_t i = 0; i < NumBytes; i++)
+    {
+        Hash ^= pBytes[i];
+        Hash *= 1099511628211ull;
+    }
+    return Hash;
+}
+
+float Luminance(const glm::vec3 &Color)
+{
+    return glm::dot(Color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+glm::vec3 UniformSampleSphere(const glm::vec2 &Sample, float &PDF)
 {
-    return rand() / (float)RAND_MAX;
+    const float z = 1.0f - 2.0f * Sample.x;
+    const float r = sqrtf(max(0.0f, 1.0f - z * z));
+    const float phi = 2.0f * (float)M_PI * Sample.y;
+
+    PDF = 1.0f / (4.0f * (float)M_PI);
+    return glm::vec3(r * cosf(phi), r * sinf(phi), z);
 }
 
 inline float fast_acos(float x)
@@ -113,10 +166,10 @@ inline float fast_cos(float x)
         return 1.27323954 * x - 0.405284735 * x * x;
 }
 
-glm::vec3 RTCosineWeightedRayGenerator::GenerateRay()
+glm::vec3 RTCosineWeightedRayGenerator::GenerateRay(const glm::vec2 &Sample)
 {
-    float rand1 = FltRand();
-    float rand2 = FltRand();
+    float rand1 = Sample.x;
+    float rand2 = Sample.y;
     float theta = fast_acos(sqrt(rand2));
     float phi = M_PI * 2.0f * rand1;
 
@@ -145,207 +198,852 @@ float RTCosineWeightedRayGenerator::PDF(const glm::vec3 &vector)
     return glm::dot(vector, m_normal) / M_PI;
 }
 
-RTImage::RTImage() : m_pImage(nullptr) {}
+RTGGXRayGenerator::RTGGXRayGenerator(const glm::vec3 &ViewVector, const glm::vec3 &Normal, float Roughness) :
+    m_ViewVector(ViewVector),
+    m_Normal(Normal),
+    m_Alpha(Roughness)
+{
+    glm::vec3 h(m_Normal);
+    if (abs(h.x) <= abs(h.y) && abs(h.x) <= abs(h.z)) h.x = 1.0f;
+    else if (abs(h.y) <= abs(h.x) && abs(h.y) <= abs(h.z)) h.y = 1.0f;
+    else h.z = 1.0f;
+
+    m_Tangent = glm::normalize(glm::cross(h, m_Normal));
+    m_Bitangent = glm::cross(m_Normal, m_Tangent);
+}
+
+glm::vec3 RTGGXRayGenerator::GenerateRay(const glm::vec2 &Sample)
+{
+    // Stretch the view vector into the hemisphere configuration where the visible normals are uniform
+    const glm::vec3 LocalView(glm::dot(m_ViewVector, m_Tangent), glm::dot(m_ViewVector, m_Bitangent), glm::dot(m_ViewVector, m_Normal));
+    const glm::vec3 StretchedView = glm::normalize(glm::vec3(m_Alpha * LocalView.x, m_Alpha * LocalView.y, LocalView.z));
+
+    const float LengthSquared = StretchedView.x * StretchedView.x + StretchedView.y * StretchedView.y;
+    const glm::vec3 T1 = LengthSquared > 0.0f ? glm::vec3(-StretchedView.y, StretchedView.x, 0.0f) / sqrtf(LengthSquared) : glm::vec3(1.0f, 0.0f, 0.0f);
+    const glm::vec3 T2 = glm::cross(StretchedView, T1);
+
+    // Sample the projected disk, warped so that the part hidden from the view vector is skipped
+    const float r = sqrtf(Sample.x);
+    const float phi = 2.0f * (float)M_PI * Sample.y;
+    const float t1 = r * cosf(phi);
+    const float s = 0.5f * (1.0f + StretchedView.z);
+    const float t2 = (1.0f - s) * sqrtf(max(0.0f, 1.0f - t1 * t1)) + s * r * sinf(phi);
+
+    const glm::vec3 StretchedHalfway = t1 * T1 + t2 * T2 + sqrtf(max(0.0f, 1.0f - t1 * t1 - t2 * t2)) * StretchedView;
+    const glm::vec3 LocalHalfway = glm::normalize(glm::vec3(m_Alpha * StretchedHalfway.x, m_Alpha * StretchedHalfway.y, max(0.0f, StretchedHalfway.z)));
+    const glm::vec3 HalfwayVector = LocalHalfway.x * m_Tangent + LocalHalfway.y * m_Bitangent + LocalHalfway.z * m_Normal;
+
+    return glm::reflect(-m_ViewVector, HalfwayVector);
+}
+
+float RTGGXRayGenerator::PDF(const glm::vec3 &vector)
+{
+    const float nDotV = glm::dot(m_Normal, m_ViewVector);
+    if (nDotV <= 0.0f) return 0.0f;
+
+    BRDFCosines<float> Cosines;
+    Cosines.m_NDotH = Saturate(glm::dot(m_Normal, glm::normalize(m_ViewVector + vector)));
+    const float Distribution = Distribution_GGX::Evaluate(Cosines, m_Alpha);
+
+    // Smith masking of the view vector, the fraction of microfacets that are visible
+    const float AlphaSquared = m_Alpha * m_Alpha;
+    const float Masking = 2.0f * nDotV / (nDotV + sqrtf(AlphaSquared + (1.0f - AlphaSquared) * nDotV * nDotV));
+
+    // The visible normal density is G1 * D * dot(V, H) / dot(N, V), reflecting around H adds 1 / (4 * dot(V, H))
+    return Masking * Distribution / (4.0f * nDotV);
+}
+
+// Veach's power heuristic (beta = 2) for one sample from each of two strategies
+inline float PowerHeuristic(float PDF, float OtherPDF)
+{
+    const float PDFSquared = PDF * PDF;
+    const float Sum = PDFSquared + OtherPDF * OtherPDF;
+    return Sum > 0.0f ? PDFSquared / Sum : 0.0f;
+}
+
+UINT GetImageFormatComponentSize(RTImageFormat Format)
+{
+    switch (Format)
+    {
+    case RT_IMAGE_FORMAT_RGB16F:
+        return sizeof(glm::uint16);
+    case RT_IMAGE_FORMAT_RGB32F:
+        return sizeof(float);
+    case RT_IMAGE_FORMAT_RGB8:
+    default:
+        return sizeof(unsigned char);
+    }
+}
+
+RTImage::RTImage() : m_Width(0), m_Height(0), m_Format(RT_IMAGE_FORMAT_RGB8), m_BytesPerTexel(0), m_TexelStride(0), m_ImageID(0), m_PageSize(0) {}
 
-RTImage::RTImage(const char *TextureName, bool IsSRGBTexture) : m_pImage(nullptr)
+RTImage::RTImage(const char *TextureName, bool IsSRGBTexture, RTImageFormat Format) : 
+    m_Width(0), 
+    m_Height(0), 
+    m_Format(Format), 
+    m_BytesPerTexel(m_ComponentCount * GetImageFormatComponentSize(Format)), 
+    m_TexelStride(m_BytesPerTexel),
+    m_ImageID(++g_NumImagesCreated),
+    m_PageSize(0)
 {
     const bool ValidTextureString = (TextureName != nullptr && strlen(TextureName) > 0);
     if (ValidTextureString)
     {
+        std::vector<unsigned char> FileContents;
+        {
+            std::ifstream File(TextureName, std::ios::binary | std::ios::ate);
+            FAIL_CHK(!File, "Failed to open a texture");
+            FileContents.resize((size_t)File.tellg());
+            File.seekg(0);
+            File.read((char *)FileContents.data(), FileContents.size());
+            FAIL_CHK(!File, "Failed to read a texture");
+        }
+
+        const bool bGammaCorrect = g_bGammaCorrectTextures && IsSRGBTexture;
+        std::string CachePath;
+        UINT64 CacheKey = 0;
+        if (g_bCacheDecodedTextures)
+        {
+            const int Settings[] = { (int)g_TextureCacheVersion, (int)m_Format, bGammaCorrect, g_bFilterTextures, g_bTileTextures, cTileSize };
+            CacheKey = HashBytes(Settings, sizeof(Settings), HashBytes(FileContents.data(), FileContents.size()));
+
+            char CacheFileName[32];
+            sprintf_s(CacheFileName, "%016llx.rtimage", CacheKey);
+            CachePath = GetTextureCacheDirectory() + "\\" + CacheFileName;
+            if (LoadFromCache(CachePath, CacheKey, g_bPageTextures))
+            {
+                return;
+            }
+        }
+
         int ComponentCount;
-        m_pImage = stbi_load(TextureName, &m_Width, &m_Height, &ComponentCount, STBI_rgb);
-        if (g_bGammaCorrectTextures && IsSRGBTexture)
+        MipLevel BaseLevel;
+        BaseLevel.m_TilesPerRow = 0;
+
+        // Float formats read .hdr files without stb_image clamping and tone mapping them to 8 bits.
+        // Everything is converted to the storage format here so sampling never has to
+        if (m_Format != RT_IMAGE_FORMAT_RGB8 && stbi_is_hdr_from_memory(FileContents.data(), (int)FileContents.size()))
         {
-            static float gamma = 2.2f;
-            for (UINT x = 0; x < m_Width * m_Height; x++)
+            float *pImage = stbi_loadf_from_memory(FileContents.data(), (int)FileContents.size(), &m_Width, &m_Height, &ComponentCount, STBI_rgb);
+            FAIL_CHK(pImage == nullptr, "Stb_Image failed to load a texture");
+
+            BaseLevel.m_Texels.resize(m_Width * m_Height * m_BytesPerTexel);
+            for (int x = 0; x < m_Width * m_Height; x++)
             {
-                unsigned char *pPixel = &m_pImage[x * m_ComponentCount];
-                for (UINT component = 0; component < m_ComponentCount; component++)
-                {
-                    float color = ConvertCharToFloat(pPixel[component]);
-                    float gammaCorrectedColor = pow(color, gamma);
-                    pPixel[component] = ConvertFloatToChar(gammaCorrectedColor);
-                }
+                const float *pPixel = &pImage[x * m_ComponentCount];
+                EncodeTexel(glm::vec3(pPixel[0], pPixel[1], pPixel[2]), &BaseLevel.m_Texels[x * m_BytesPerTexel]);
             }
+            stbi_image_free(pImage);
+        }
+        else
+        {
+            unsigned char *pImage = stbi_load_from_memory(FileContents.data(), (int)FileContents.size(), &m_Width, &m_Height, &ComponentCount, STBI_rgb);
+            FAIL_CHK(pImage == nullptr, "Stb_Image failed to load a texture");
+
+            // Decoded straight to float, so with a float format the darks don't get requantized to 8 bits
+            const float *pDecodeTable = bGammaCorrect ? g_GammaDecodeTable.m_Values : g_LinearDecodeTable.m_Values;
+            BaseLevel.m_Texels.resize(m_Width * m_Height * m_BytesPerTexel);
+            for (int x = 0; x < m_Width * m_Height; x++)
+            {
+                const unsigned char *pPixel = &pImage[x * m_ComponentCount];
+                const glm::vec3 Color(pDecodeTable[pPixel[0]], pDecodeTable[pPixel[1]], pDecodeTable[pPixel[2]]);
+                EncodeTexel(Color, &BaseLevel.m_Texels[x * m_BytesPerTexel]);
+            }
+            stbi_image_free(pImage);
         }
 
+        BaseLevel.m_Width = m_Width;
+        BaseLevel.m_Height = m_Height;
+        m_MipLevels.push_back(std::move(BaseLevel));
 
         FAIL_CHK(ComponentCount != 3 && ComponentCount != 4, "Stb_Image returned an unexpected component count");
+
+        if (g_bFilterTextures)
+        {
+            GenerateMipChain();
+        }
+
+        if (g_bTileTextures)
+        {
+            TileMipLevels();
+        }
+
+        if (g_bCacheDecodedTextures)
+        {
+            SaveToCache(CachePath, CacheKey);
+
+            // Swap the decoded texels for pages of the file that was just written
+            if (g_bPageTextures && g_bTileTextures && (UINT64)m_Width * m_Height * m_TexelStride >= g_MinPagedTextureBytes)
+            {
+                LoadFromCache(CachePath, CacheKey, true);
+            }
+        }
     }
 }
 
+struct RTImage::PageFile
+{
+    // Pages are read with a seek and a read, the lock keeps those pairs together
+    std::mutex m_Lock;
+    std::ifstream m_File;
+};
 
-glm::vec3 RTImage::Sample(glm::vec2 uv)
+RTImage::~RTImage()
 {
-    assert(m_pImage);
-    glm::tvec2<int> coord = glm::vec2(uv.x * m_Width, uv.y * m_Height);
-    unsigned char *pPixel = &m_pImage[(coord.x + coord.y * m_Width) * cSizeofComponent * m_ComponentCount];
-    return glm::vec3(
-        ConvertCharToFloat(pPixel[0]),
-        ConvertCharToFloat(pPixel[1]),
-        ConvertCharToFloat(pPixel[2]));
+    if (m_pPageFile)
+    {
+        RTTexturePageCache::GetInstance().EvictImage(m_ImageID);
+    }
 }
 
-RTTexturePanorama::RTTexturePanorama() {}
-RTTexturePanorama::RTTexturePanorama(char *TextureName, bool IsSRGBTextureCube)
+// Cache files are the header followed by each level's header and texels, all in the in-memory layout
+struct RTImageCacheHeader
 {
-    m_pImage = RTImage(TextureName, IsSRGBTextureCube);
-}
+    UINT64 m_Key;
+    int m_Width, m_Height;
+    int m_TexelStride;
+    UINT m_NumLevels;
+};
 
+struct RTImageCacheLevelHeader
+{
+    int m_Width, m_Height;
+    int m_TilesPerRow;
+    UINT m_TexelBytes;
+};
 
-glm::vec3 RTTexturePanorama::Sample(glm::vec3 dir)
+bool RTImage::LoadFromCache(const std::string &CachePath, UINT64 CacheKey, bool bAllowPaging)
 {
-    dir = glm::normalize(dir);
-    glm::vec2 uv;
-    uv.y = acos(dir.y) / M_PI;
+    std::ifstream File(CachePath, std::ios::binary);
+    if (!File) return false;
+
+    RTImageCacheHeader Header;
+    File.read((char *)&Header, sizeof(Header));
+    if (!File || Header.m_Key != CacheKey) return false;
+
+    // Pages are runs of tiles, row-major levels can't be paged
+    const bool bPageTexels = bAllowPaging && g_bTileTextures &&
+        (UINT64)Header.m_Width * Header.m_Height * Header.m_TexelStride >= g_MinPagedTextureBytes;
+
+    std::vector<MipLevel> MipLevels(Header.m_NumLevels);
+    for (MipLevel &Level : MipLevels)
     {
-        float p = atan2(dir.z, dir.x);
-        p = p > 0.0f ? p : p - M_PI * 2;
-        uv.x = p / (2 * M_PI);
+        RTImageCacheLevelHeader LevelHeader;
+        File.read((char *)&LevelHeader, sizeof(LevelHeader));
+        if (!File) return false;
+
+        Level.m_Width = LevelHeader.m_Width;
+        Level.m_Height = LevelHeader.m_Height;
+        Level.m_TilesPerRow = LevelHeader.m_TilesPerRow;
+        Level.m_FileOffset = (UINT64)File.tellg();
+        Level.m_NumTexelBytes = LevelHeader.m_TexelBytes;
+        if (bPageTexels)
+        {
+            File.seekg(LevelHeader.m_TexelBytes, std::ios::cur);
+        }
+        else
+        {
+            Level.m_Texels.resize(LevelHeader.m_TexelBytes);
+            File.read((char *)Level.m_Texels.data(), Level.m_Texels.size());
+            if (!File) return false;
+        }
     }
 
-    assert(uv.x >= -EPSILON && uv.x <= 1.0f + EPSILON);
-    assert(uv.y >= -EPSILON && uv.y <= 1.0f + EPSILON);
-    return m_pImage.Sample(uv);
-}
-
-RTTextureCube::RTTextureCube() {}
-RTTextureCube::RTTextureCube(char **TextureNames, bool IsSRGBTextureCube)
-{
-    for (UINT i = 0; i < TEXTURES_PER_CUBE; i++)
+    std::unique_ptr<PageFile> pPageFile;
+    if (bPageTexels)
     {
-        m_pImages[i] = RTImage(TextureNames[i], IsSRGBTextureCube);
+        // Seeking past the end doesn't fail, check the texels are all there before relying on them
+        const std::streamoff ExpectedSize = File.tellg();
+        File.seekg(0, std::ios::end);
+        if (!File || File.tellg() < ExpectedSize) return false;
+
+        pPageFile.reset(new PageFile());
+        pPageFile->m_File.open(CachePath, std::ios::binary);
+        if (!pPageFile->m_File) return false;
     }
+
+    // Only commit once the whole file has been read, a truncated cache file just gets rebuilt
+    m_Width = Header.m_Width;
+    m_Height = Header.m_Height;
+    m_TexelStride = Header.m_TexelStride;
+    m_MipLevels = std::move(MipLevels);
+    m_pPageFile = std::move(pPageFile);
+    m_PageSize = cTilesPerPage * cTileSize * cTileSize * m_TexelStride;
+    return !m_MipLevels.empty();
 }
 
-TextureFace RTTextureCube::GetTextureFace(glm::vec3 dir)
+void RTImage::SaveToCache(const std::string &CachePath, UINT64 CacheKey)
 {
-    const float absZ = fabsf(dir.z);
-    const float absY = fabsf(dir.y);
-    const float absX = fabsf(dir.x);
-    if (absZ > absX && absZ > absY)
-    {
-        return dir.z > 0.0 ? POS_Z : NEG_Z;
-    }
-    else if (absY > absX)
+    // Written to a temporary file first so another run never picks up a half written cache file. The
+    // name is unique to this process and write so concurrent writers of the same key can't clobber it.
+    // Failing to write the cache is harmless, the texture just gets decoded again next time
+    CreateDirectoryA(GetTextureCacheDirectory().c_str(), nullptr);
+    const std::string TempPath = CachePath + "." + std::to_string(GetCurrentProcessId()) + "." + std::to_string(++g_NumTextureCacheWrites) + ".tmp";
     {
-        return dir.y > 0.0f ? POS_Y : NEG_Y;
+        std::ofstream File(TempPath, std::ios::binary | std::ios::trunc);
+        if (!File) return;
+
+        RTImageCacheHeader Header;
+        Header.m_Key = CacheKey;
+        Header.m_Width = m_Width;
+        Header.m_Height = m_Height;
+        Header.m_TexelStride = m_TexelStride;
+        Header.m_NumLevels = (UINT)m_MipLevels.size();
+        File.write((const char *)&Header, sizeof(Header));
+
+        for (const MipLevel &Level : m_MipLevels)
+        {
+            RTImageCacheLevelHeader LevelHeader;
+            LevelHeader.m_Width = Level.m_Width;
+            LevelHeader.m_Height = Level.m_Height;
+            LevelHeader.m_TilesPerRow = Level.m_TilesPerRow;
+            LevelHeader.m_TexelBytes = (UINT)Level.m_Texels.size();
+            File.write((const char *)&LevelHeader, sizeof(LevelHeader));
+            File.write((const char *)Level.m_Texels.data(), Level.m_Texels.size());
+        }
+
+        if (!File)
+        {
+            File.close();
+            DeleteFileA(TempPath.c_str());
+            return;
+        }
     }
-    else
+
+    // Fails if another run has the existing file open for paging, that copy is just as good
+    if (!MoveFileExA(TempPath.c_str(), CachePath.c_str(), MOVEFILE_REPLACE_EXISTING))
     {
-        assert(absX >= absZ && absX >= absY);
-        return dir.x > 0.0f ? POS_X : NEG_X;
+        DeleteFileA(TempPath.c_str());
     }
 }
 
-glm::vec3 RTTextureCube::Sample(glm::vec3 dir)
+void RTImage::EncodeTexel(const glm::vec3 &Color, _Out_ unsigned char *pTexel)
 {
-    const TextureFace Face = GetTextureFace(dir);
-    glm::vec2 uv;
-    switch (Face)
+    switch (m_Format)
     {
-    case POS_X:
-        uv = glm::vec2(1.0f - (dir.z / dir.x + 1.0f) * 0.5,
-            1.0f - (dir.y / dir.x + 1.0f) * 0.5);
-        break;
-    case NEG_X:
-        uv = glm::vec2(1.0f - (dir.z / dir.x + 1.0f) * 0.5,
-            (dir.y / dir.x + 1.0f) * 0.5);
-        break;
-    case POS_Y:
-        uv = glm::vec2((dir.x / dir.y + 1.0f) * 0.5,
-            (dir.z / dir.y + 1.0f) * 0.5);
-        break;
-    case NEG_Y:
-        uv = glm::vec2(1.0f - (dir.x / dir.y + 1.0f) * 0.5,
-            (dir.z / dir.y + 1.0f) * 0.5);
+    case RT_IMAGE_FORMAT_RGB16F:
+    {
+        const glm::uint16 HalfColor[3] = { glm::packHalf1x16(Color.r), glm::packHalf1x16(Color.g), glm::packHalf1x16(Color.b) };
+        memcpy(pTexel, HalfColor, sizeof(HalfColor));
         break;
-    case POS_Z:
-        uv = glm::vec2((dir.x / dir.z + 1.0f) * 0.5,
-            1.0f - (dir.y / dir.z + 1.0f) * 0.5);
+    }
+    case RT_IMAGE_FORMAT_RGB32F:
+        memcpy(pTexel, &Color, sizeof(Color));
         break;
-    case NEG_Z:
-        uv = glm::vec2((dir.x / dir.z + 1.0f) * 0.5,
-            (dir.y / dir.z + 1.0f) * 0.5);
+    case RT_IMAGE_FORMAT_RGB8:
+    default:
+        // Rounded rather than truncated so repeated mip downsampling doesn't darken the texture
+        for (UINT component = 0; component < 3; component++)
+        {
+            pTexel[component] = (unsigned char)(glm::clamp(Color[component], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
         break;
+    }
+}
+
+glm::vec3 RTImage::DecodeTexel(_In_ const unsigned char *pTexel) const
+{
+    switch (m_Format)
+    {
+    case RT_IMAGE_FORMAT_RGB16F:
+    {
+        glm::uint16 HalfColor[3];
+        memcpy(HalfColor, pTexel, sizeof(HalfColor));
+        return glm::vec3(glm::unpackHalf1x16(HalfColor[0]), glm::unpackHalf1x16(HalfColor[1]), glm::unpackHalf1x16(HalfColor[2]));
+    }
+    case RT_IMAGE_FORMAT_RGB32F:
+    {
+        glm::vec3 Color;
+        memcpy(&Color, pTexel, sizeof(Color));
+        return Color;
+    }
+    case RT_IMAGE_FORMAT_RGB8:
     default:
-        assert(false);
+        return glm::vec3(
+            ConvertCharToFloat(pTexel[0]),
+            ConvertCharToFloat(pTexel[1]),
+            ConvertCharToFloat(pTexel[2]));
     }
-    assert(uv.x >= -EPSILON && uv.x <= 1.0f + EPSILON);
-    assert(uv.y >= -EPSILON && uv.y <= 1.0f + EPSILON);
-    return m_pImages[Face].Sample(uv);
 }
 
-FORCEINLINE RTCVertex RendererVertexToRTCVertex(Vertex &Vertex)
+void RTImage::GenerateMipChain()
 {
-    Vec3 &Pos = Vertex.m_Position;
-    return RTCVertex(Pos.x, Pos.y, Pos.z);
+    // Box filter each level down to 1x1, odd dimensions fold their last row/column into the previous one
+    while (m_MipLevels.back().m_Width > 1 || m_MipLevels.back().m_Height > 1)
+    {
+        const MipLevel &Source = m_MipLevels.back();
+        MipLevel Level;
+        Level.m_Width = max(Source.m_Width / 2, 1);
+        Level.m_Height = max(Source.m_Height / 2, 1);
+        Level.m_TilesPerRow = 0;
+        Level.m_Texels.resize(Level.m_Width * Level.m_Height * m_BytesPerTexel);
+        for (int y = 0; y < Level.m_Height; y++)
+        {
+            const int y0 = min(y * 2, Source.m_Height - 1);
+            const int y1 = min(y * 2 + 1, Source.m_Height - 1);
+            for (int x = 0; x < Level.m_Width; x++)
+            {
+                const int x0 = min(x * 2, Source.m_Width - 1);
+                const int x1 = min(x * 2 + 1, Source.m_Width - 1);
+                const glm::vec3 Sum =
+                    DecodeTexel(&Source.m_Texels[GetTexelOffset(Source, x0, y0)]) +
+                    DecodeTexel(&Source.m_Texels[GetTexelOffset(Source, x1, y0)]) +
+                    DecodeTexel(&Source.m_Texels[GetTexelOffset(Source, x0, y1)]) +
+                    DecodeTexel(&Source.m_Texels[GetTexelOffset(Source, x1, y1)]);
+                EncodeTexel(Sum * 0.25f, &Level.m_Texels[GetTexelOffset(Level, x, y)]);
+            }
+        }
+        m_MipLevels.push_back(std::move(Level));
+    }
 }
 
-FORCEINLINE glm::vec2 RealArrayToGlmVec2(_In_ Vec2 Vector)
+std::mutex RTImageCache::s_Lock;
+std::unordered_map<std::string, RTImageCache::CachedImage> RTImageCache::s_Images;
+
+std::shared_ptr<const RTImage> RTImageCache::GetImage(const char *TextureName, bool IsSRGBFormat, RTImageFormat Format)
 {
-    return glm::vec2(Vector.x, Vector.y);
+    const std::string Key = std::string(TextureName ? TextureName : "") + "|" + std::to_string(IsSRGBFormat) + "|" + std::to_string((int)Format);
+
+    // The lock only covers the lookup, decoding happens outside it so different textures load in parallel. 
+    // The first request for a texture leaves a pending entry behind and later requests wait on that
+    std::promise<std::shared_ptr<const RTImage>> ImagePromise;
+    PendingImage Pending;
+    {
+        std::lock_guard<std::mutex> Lock(s_Lock);
+        auto CachedEntry = s_Images.find(Key);
+        if (CachedEntry != s_Images.end())
+        {
+            std::shared_ptr<const RTImage> pImage = CachedEntry->second.m_pImage.lock();
+            if (pImage)
+            {
+                return pImage;
+            }
+            Pending = CachedEntry->second.m_PendingImage;
+        }
+
+        if (!Pending.valid())
+        {
+            // Drop entries whose images have all been released so the map doesn't grow with every texture ever loaded
+            for (auto Entry = s_Images.begin(); Entry != s_Images.end();)
+            {
+                Entry = Entry->second.m_pImage.expired() && !Entry->second.m_PendingImage.valid() ? s_Images.erase(Entry) : std::next(Entry);
+            }
+            s_Images[Key].m_PendingImage = ImagePromise.get_future().share();
+        }
+    }
+
+    if (Pending.valid())
+    {
+        // Rethrows if the other request failed to decode the texture
+        return Pending.get();
+    }
+
+    std::shared_ptr<const RTImage> pImage;
+    try
+    {
+        pImage = std::make_shared<const RTImage>(TextureName, IsSRGBFormat, Format);
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> Lock(s_Lock);
+            s_Images.erase(Key);
+        }
+        ImagePromise.set_exception(std::current_exception());
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> Lock(s_Lock);
+        CachedImage &Entry = s_Images[Key];
+        Entry.m_pImage = pImage;
+        Entry.m_PendingImage = PendingImage();
+    }
+    ImagePromise.set_value(pImage);
+    return pImage;
 }
 
-FORCEINLINE RTVertexData RendererVertexToRTVertex(Vertex &Vertex)
+// Spreads the low cTileSizeLog2 bits of n out to every other bit
+inline UINT SpreadMortonBits(UINT n)
 {
-    return RTVertexData(RealArrayToGlmVec2(Vertex.m_Tex), RealArrayToGlmVec3(Vertex.m_Normal), RealArrayToGlmVec3(Vertex.m_Tangent));
+    return (n & 1) | ((n & 2) << 1) | ((n & 4) << 2);
 }
 
-FORCEINLINE glm::vec3 RTCVertexToRendererVertex(RTCVertex Vertex)
+void RTImage::TileMipLevels()
 {
-    return glm::vec3(Vertex.m_x, Vertex.m_y, Vertex.m_z);
+    // Edge tiles are padded out to a full tile, the padding is never addressed.
+    // Row-major levels are addressed by m_BytesPerTexel so the stride can change up front
+    m_TexelStride = 1;
+    while (m_TexelStride < m_BytesPerTexel)
+    {
+        m_TexelStride <<= 1;
+    }
+    for (MipLevel &Level : m_MipLevels)
+    {
+        assert(Level.m_TilesPerRow == 0);
+        MipLevel TiledLevel;
+        TiledLevel.m_Width = Level.m_Width;
+        TiledLevel.m_Height = Level.m_Height;
+        TiledLevel.m_TilesPerRow = (Level.m_Width + cTileSize - 1) >> cTileSizeLog2;
+        const int TilesPerColumn = (Level.m_Height + cTileSize - 1) >> cTileSizeLog2;
+        TiledLevel.m_Texels.resize(TiledLevel.m_TilesPerRow * TilesPerColumn * cTileSize * cTileSize * m_TexelStride, 255);
+
+        for (int y = 0; y < Level.m_Height; y++)
+        {
+            for (int x = 0; x < Level.m_Width; x++)
+            {
+                memcpy(&TiledLevel.m_Texels[GetTexelOffset(TiledLevel, x, y)], &Level.m_Texels[GetTexelOffset(Level, x, y)], m_BytesPerTexel);
+            }
+        }
+        Level = std::move(TiledLevel);
+    }
 }
 
-RTMaterial::RTMaterial(CreateMaterialDescriptor *pCreateMaterialDescriptor) :
-    m_Image(pCreateMaterialDescriptor->m_TextureName, true),
-    m_NormalMap(pCreateMaterialDescriptor->m_NormalMapName, false)
+UINT RTImage::GetTexelOffset(const MipLevel &Mip, int x, int y) const
 {
-    m_Diffuse = RealArrayToGlmVec3(pCreateMaterialDescriptor->m_DiffuseColor);
-    m_Reflectivity = pCreateMaterialDescriptor->m_Reflectivity;
-    m_Roughness = pCreateMaterialDescriptor->m_Roughness;
+    if (Mip.m_TilesPerRow == 0)
+    {
+        return (x + y * Mip.m_Width) * m_BytesPerTexel;
+    }
+
+    const UINT TileIndex = (y >> cTileSizeLog2) * Mip.m_TilesPerRow + (x >> cTileSizeLog2);
+    const UINT TexelIndex = TileIndex * cTileSize * cTileSize + SpreadMortonBits(x & (cTileSize - 1)) + (SpreadMortonBits(y & (cTileSize - 1)) << 1);
+    return TexelIndex * m_TexelStride;
 }
 
-glm::vec3 RTMaterial::GetColor(glm::vec2 uv)
+const unsigned char *RTImage::GetTexelData(UINT Level, UINT Offset) const
 {
-    if (m_Image.HasValidTexture())
+    if (!m_pPageFile)
     {
-        return m_Image.Sample(uv);
+        return &m_MipLevels[Level].m_Texels[Offset];
     }
-    else
+
+    // Consecutive lookups from a thread mostly land in the same page, remembering it skips the
+    // shared cache's lock. Image IDs start at 1 so a key of 0 never matches a real page. The
+    // remembered page stays alive after the cache evicts it, see RTTexturePageCache's budget
+    thread_local UINT64 LastPageKey = 0;
+    thread_local RTTexturePage pLastPage;
+
+    const UINT PageIndex = Offset / m_PageSize;
+    const UINT64 PageKey = RTTexturePageCache::GetPageKey(m_ImageID, Level, PageIndex);
+    if (PageKey != LastPageKey)
     {
-        return m_Diffuse;
+        RTTexturePageCache &PageCache = RTTexturePageCache::GetInstance();
+        RTTexturePage pPage = PageCache.FindPage(PageKey);
+        if (!pPage)
+        {
+            pPage = PageCache.AddPage(PageKey, LoadPage(Level, PageIndex));
+        }
+        pLastPage = pPage;
+        LastPageKey = PageKey;
     }
+    return &(*pLastPage)[Offset - PageIndex * m_PageSize];
 }
 
-glm::vec3 RTMaterial::GetNormal(glm::vec2 uv)
+RTTexturePage RTImage::LoadPage(UINT Level, UINT PageIndex) const
 {
-    assert(m_NormalMap.HasValidTexture());
-    glm::vec3 bumpMapResult = m_NormalMap.Sample(uv);
-    glm::vec2 bump2d = BUMP_FACTOR * (2.0f * glm::vec2(bumpMapResult.x, bumpMapResult.y) - glm::vec2(1.0f));
-    assert(glm::dot(bump2d, bump2d) <= 1.0f);
-    return glm::vec3(bump2d.x, bump2d.y, sqrt(1.0f - glm::dot(bump2d, bump2d)));
-}
+    const MipLevel &Mip = m_MipLevels[Level];
+    const UINT PageOffset = PageIndex * m_PageSize;
+    std::shared_ptr<std::vector<unsigned char>> pPage = std::make_shared<std::vector<unsigned char>>(min(m_PageSize, Mip.m_NumTexelBytes - PageOffset));
 
+    // Called from the tile workers, RTTileScheduler::Run rethrows the failure on the thread drawing the frame
+    std::lock_guard<std::mutex> Lock(m_pPageFile->m_Lock);
+    m_pPageFile->m_File.seekg(Mip.m_FileOffset + PageOffset);
+    m_pPageFile->m_File.read((char *)pPage->data(), pPage->size());
+    const bool bReadFailed = !m_pPageFile->m_File;
 
-Material *RTRenderer::CreateMaterial(_In_ CreateMaterialDescriptor *pCreateMaterialDescriptor)
-{
-    Material *pMaterial = new RTMaterial(pCreateMaterialDescriptor);
-    MEM_CHK(pMaterial);
-    return pMaterial;
+    // Leave the stream usable for other pages of the same image
+    m_pPageFile->m_File.clear();
+    FAIL_CHK(bReadFailed, "Failed to page in a texture tile");
+    return pPage;
 }
 
-void RTRenderer::DestroyMaterial(Material* pMaterial)
+glm::vec3 RTImage::Sample(glm::vec2 uv) const
 {
-    delete pMaterial;
+    glm::tvec2<int> coord = glm::vec2(uv.x * m_Width, uv.y * m_Height);
+    return GetTexel(glm::clamp(coord.x, 0, m_Width - 1), glm::clamp(coord.y, 0, m_Height - 1));
 }
 
-EnvironmentMap *RTRenderer::CreateEnvironmentMap(CreateEnvironmentMapDescriptor *pCreateEnvironnentMapDescriptor)
+glm::vec3 RTImage::Sample(glm::vec2 uv, float Footprint) const
 {
-    EnvironmentMap *pEnvironmentMap;
-    switch (pCreateEnvironnentMapDescriptor->m_EnvironmentType)
+    if (m_MipLevels.size() <= 1)
     {
-    case CreateEnvironmentMapDescriptor::SOLID_COLOR:
+        return Sample(uv);
+    }
+
+    // Footprint doesn't know the texture resolution, scale it to texels of the base level
+    const float LevelOfDetail = Footprint + 0.5f * log2f((float)(m_Width * m_Height));
+    const UINT MaxLevel = (UINT)m_MipLevels.size() - 1;
+    if (!(LevelOfDetail > 0.0f))
+    {
+        return SampleBilinear(0, uv);
+    }
+    else if (LevelOfDetail >= MaxLevel)
+    {
+        return SampleBilinear(MaxLevel, uv);
+    }
+
+    // Only blend in the next level when it makes a visible difference
+    const UINT Level = (UINT)LevelOfDetail;
+    const float LevelBlend = LevelOfDetail - Level;
+    const float cMinimumLevelBlend = 1.0f / 32.0f;
+    if (LevelBlend < cMinimumLevelBlend)
+    {
+        return SampleBilinear(Level, uv);
+    }
+    else if (LevelBlend > 1.0f - cMinimumLevelBlend)
+    {
+        return SampleBilinear(Level + 1, uv);
+    }
+    return glm::mix(SampleBilinear(Level, uv), SampleBilinear(Level + 1, uv), LevelBlend);
+}
+
+glm::vec3 RTImage::SampleBilinear(UINT Level, glm::vec2 uv) const
+{
+    const MipLevel &Mip = m_MipLevels[Level];
+    const float x = glm::clamp(uv.x * Mip.m_Width - 0.5f, 0.0f, (float)(Mip.m_Width - 1));
+    const float y = glm::clamp(uv.y * Mip.m_Height - 0.5f, 0.0f, (float)(Mip.m_Height - 1));
+    const int x0 = (int)x;
+    const int y0 = (int)y;
+    const int x1 = min(x0 + 1, Mip.m_Width - 1);
+    const int y1 = min(y0 + 1, Mip.m_Height - 1);
+    const float fx = x - x0;
+    const float fy = y - y0;
+
+    const glm::vec3 Top = glm::mix(GetTexel(x0, y0, Level), GetTexel(x1, y0, Level), fx);
+    const glm::vec3 Bottom = glm::mix(GetTexel(x0, y1, Level), GetTexel(x1, y1, Level), fx);
+    return glm::mix(Top, Bottom, fy);
+}
+
+glm::vec3 RTImage::GetTexel(int x, int y, UINT Level) const
+{
+    assert(Level < m_MipLevels.size());
+    const MipLevel &Mip = m_MipLevels[Level];
+    return DecodeTexel(GetTexelData(Level, GetTexelOffset(Mip, x, y)));
+}
+
+RTTexturePanorama::RTTexturePanorama() {}
+RTTexturePanorama::RTTexturePanorama(char *TextureName, bool IsSRGBTextureCube, RTImageFormat Format)
+{
+    m_pImage = RTImageCache::GetImage(TextureName, IsSRGBTextureCube, Format);
+    if (m_pImage->HasValidTexture())
+    {
+        // Rows near the poles cover less of the sphere, weight by sin(theta) 
+        // so the distribution follows solid angle rather than texel count
+        const int Width = m_pImage->GetWidth();
+        const int Height = m_pImage->GetHeight();
+        std::vector<float> Weights(Width * Height);
+        for (int y = 0; y < Height; y++)
+        {
+            const float SinTheta = sinf((float)M_PI * (y + 0.5f) / Height);
+            for (int x = 0; x < Width; x++)
+            {
+                Weights[x + y * Width] = Luminance(m_pImage->GetTexel(x, y)) * SinTheta;
+            }
+        }
+        m_LuminanceDistribution = RTDistribution2D(Weights.data(), Width, Height);
+    }
+}
+
+glm::vec2 RTTexturePanorama::DirectionToUV(const glm::vec3 &Direction)
+{
+    const glm::vec3 dir = glm::normalize(Direction);
+    glm::vec2 uv;
+    uv.y = acosf(glm::clamp(dir.y, -1.0f, 1.0f)) / (float)M_PI;
+    {
+        float p = atan2f(dir.z, dir.x);
+        p = p >= 0.0f ? p : p + (float)M_PI * 2.0f;
+        uv.x = p / (2.0f * (float)M_PI);
+    }
+    return uv;
+}
+
+glm::vec3 RTTexturePanorama::Sample(glm::vec3 dir)
+{
+    const glm::vec2 uv = DirectionToUV(dir);
+
+    assert(uv.x >= -EPSILON && uv.x <= 1.0f + EPSILON);
+    assert(uv.y >= -EPSILON && uv.y <= 1.0f + EPSILON);
+    return m_pImage->Sample(uv);
+}
+
+glm::vec3 RTTexturePanorama::SampleDirection(const glm::vec2 &Sample, float &PDF)
+{
+    if (!m_LuminanceDistribution.IsValid())
+    {
+        return SphereciallySamplableTexture::SampleDirection(Sample, PDF);
+    }
+
+    float UVPDF;
+    const glm::vec2 uv = m_LuminanceDistribution.Sample(Sample, UVPDF);
+    const float Theta = (float)M_PI * uv.y;
+    const float Phi = 2.0f * (float)M_PI * uv.x;
+    const float SinTheta = sinf(Theta);
+
+    // The lat-long mapping stretches texels by 2 * pi^2 * sin(theta) when going from uv to solid angle
+    PDF = SinTheta > 0.0f ? UVPDF / (2.0f * (float)M_PI * (float)M_PI * SinTheta) : 0.0f;
+    return glm::vec3(SinTheta * cosf(Phi), cosf(Theta), SinTheta * sinf(Phi));
+}
+
+float RTTexturePanorama::DirectionPDF(const glm::vec3 &Direction)
+{
+    if (!m_LuminanceDistribution.IsValid())
+    {
+        return SphereciallySamplableTexture::DirectionPDF(Direction);
+    }
+
+    const glm::vec2 uv = DirectionToUV(Direction);
+    const float SinTheta = sinf((float)M_PI * uv.y);
+    return SinTheta > 0.0f ? m_LuminanceDistribution.PDF(uv) / (2.0f * (float)M_PI * (float)M_PI * SinTheta) : 0.0f;
+}
+
+glm::vec3 SphereciallySamplableTexture::SampleDirection(const glm::vec2 &Sample, float &PDF)
+{
+    return UniformSampleSphere(Sample, PDF);
+}
+
+float SphereciallySamplableTexture::DirectionPDF(const glm::vec3 &Direction)
+{
+    return 1.0f / (4.0f * (float)M_PI);
+}
+
+RTTextureCube::RTTextureCube() {}
+RTTextureCube::RTTextureCube(char **TextureNames, bool IsSRGBTextureCube)
+{
+    for (UINT i = 0; i < TEXTURES_PER_CUBE; i++)
+    {
+        m_pImages[i] = RTImageCache::GetImage(TextureNames[i], IsSRGBTextureCube);
+    }
+}
+
+TextureFace RTTextureCube::GetTextureFace(glm::vec3 dir)
+{
+    const float absZ = fabsf(dir.z);
+    const float absY = fabsf(dir.y);
+    const float absX = fabsf(dir.x);
+    if (absZ > absX && absZ > absY)
+    {
+        return dir.z > 0.0 ? POS_Z : NEG_Z;
+    }
+    else if (absY > absX)
+    {
+        return dir.y > 0.0f ? POS_Y : NEG_Y;
+    }
+    else
+    {
+        assert(absX >= absZ && absX >= absY);
+        return dir.x > 0.0f ? POS_X : NEG_X;
+    }
+}
+
+glm::vec3 RTTextureCube::Sample(glm::vec3 dir)
+{
+    const TextureFace Face = GetTextureFace(dir);
+    glm::vec2 uv;
+    switch (Face)
+    {
+    case POS_X:
+        uv = glm::vec2(1.0f - (dir.z / dir.x + 1.0f) * 0.5,
+            1.0f - (dir.y / dir.x + 1.0f) * 0.5);
+        break;
+    case NEG_X:
+        uv = glm::vec2(1.0f - (dir.z / dir.x + 1.0f) * 0.5,
+            (dir.y / dir.x + 1.0f) * 0.5);
+        break;
+    case POS_Y:
+        uv = glm::vec2((dir.x / dir.y + 1.0f) * 0.5,
+            (dir.z / dir.y + 1.0f) * 0.5);
+        break;
+    case NEG_Y:
+        uv = glm::vec2(1.0f - (dir.x / dir.y + 1.0f) * 0.5,
+            (dir.z / dir.y + 1.0f) * 0.5);
+        break;
+    case POS_Z:
+        uv = glm::vec2((dir.x / dir.z + 1.0f) * 0.5,
+            1.0f - (dir.y / dir.z + 1.0f) * 0.5);
+        break;
+    case NEG_Z:
+        uv = glm::vec2((dir.x / dir.z + 1.0f) * 0.5,
+            (dir.y / dir.z + 1.0f) * 0.5);
+        break;
+    default:
+        assert(false);
+    }
+    assert(uv.x >= -EPSILON && uv.x <= 1.0f + EPSILON);
+    assert(uv.y >= -EPSILON && uv.y <= 1.0f + EPSILON);
+    return m_pImages[Face]->Sample(uv);
+}
+
+FORCEINLINE RTCVertex RendererVertexToRTCVertex(Vertex &Vertex)
+{
+    Vec3 &Pos = Vertex.m_Position;
+    return RTCVertex(Pos.x, Pos.y, Pos.z);
+}
+
+FORCEINLINE glm::vec2 RealArrayToGlmVec2(_In_ Vec2 Vector)
+{
+    return glm::vec2(Vector.x, Vector.y);
+}
+
+FORCEINLINE RTVertexData RendererVertexToRTVertex(Vertex &Vertex)
+{
+    return RTVertexData(RealArrayToGlmVec2(Vertex.m_Tex), RealArrayToGlmVec3(Vertex.m_Normal), RealArrayToGlmVec3(Vertex.m_Tangent));
+}
+
+FORCEINLINE glm::vec3 RTCVertexToRendererVertex(RTCVertex Vertex)
+{
+    return glm::vec3(Vertex.m_x, Vertex.m_y, Vertex.m_z);
+}
+
+RTMaterial::RTMaterial(CreateMaterialDescriptor *pCreateMaterialDescriptor) :
+    m_pImage(RTImageCache::GetImage(pCreateMaterialDescriptor->m_TextureName, true, RT_IMAGE_FORMAT_RGB16F)),
+    m_pNormalMap(RTImageCache::GetImage(pCreateMaterialDescriptor->m_NormalMapName, false))
+{
+    m_Diffuse = RealArrayToGlmVec3(pCreateMaterialDescriptor->m_DiffuseColor);
+    m_Reflectivity = pCreateMaterialDescriptor->m_Reflectivity;
+    m_Roughness = pCreateMaterialDescriptor->m_Roughness;
+}
+
+glm::vec3 RTMaterial::GetColor(glm::vec2 uv, float Footprint)
+{
+    if (m_pImage->HasValidTexture())
+    {
+        return g_bFilterTextures ? m_pImage->Sample(uv, Footprint) : m_pImage->Sample(uv);
+    }
+    else
+    {
+        return m_Diffuse;
+    }
+}
+
+glm::vec3 RTMaterial::GetNormal(glm::vec2 uv)
+{
+    assert(m_pNormalMap->HasValidTexture());
+    glm::vec3 bumpMapResult = m_pNormalMap->Sample(uv);
+    glm::vec2 bump2d = BUMP_FACTOR * (2.0f * glm::vec2(bumpMapResult.x, bumpMapResult.y) - glm::vec2(1.0f));
+    assert(glm::dot(bump2d, bump2d) <= 1.0f);
+    return glm::vec3(bump2d.x, bump2d.y, sqrt(1.0f - glm::dot(bump2d, bump2d)));
+}
+
+
+Material *RTRenderer::CreateMaterial(_In_ CreateMaterialDescriptor *pCreateMaterialDescriptor)
+{
+    Material *pMaterial = new RTMaterial(pCreateMaterialDescriptor);
+    MEM_CHK(pMaterial);
+    return pMaterial;
+}
+
+void RTRenderer::DestroyMaterial(Material* pMaterial)
+{
+    delete pMaterial;
+}
+
+EnvironmentMap *RTRenderer::CreateEnvironmentMap(CreateEnvironmentMapDescriptor *pCreateEnvironnentMapDescriptor)
+{
+    EnvironmentMap *pEnvironmentMap;
+    switch (pCreateEnvironnentMapDescriptor->m_EnvironmentType)
+    {
+    case CreateEnvironmentMapDescriptor::SOLID_COLOR:
         pEnvironmentMap = new RTEnvironmentColor(&pCreateEnvironnentMapDescriptor->m_SolidColor);
         break;
     case CreateEnvironmentMapDescriptor::TEXTURE_CUBE:
@@ -362,37 +1060,109 @@ void RTRenderer::DestroyEnviromentMap(EnvironmentMap *pEnvironmentMap)
 }
 
 RTRenderer::RTRenderer(unsigned int width, unsigned int height) :
-    m_LastRenderSettings(DefaultRenderSettings)
+#if RT_MULTITHREAD
+    m_TileScheduler(std::thread::hardware_concurrency()),
+#else
+    m_TileScheduler(1),
+#endif
+    m_LastRenderSettings(DefaultRenderSettings),
+    m_pLastCamera(nullptr),
+    m_pLastScene(nullptr),
+    m_NumGlossyRaysPerHit(RAY_EMISSION_COUNT),
+    m_bForceMirrorRay(true),
+    m_bJitterPrimaryRays(false),
+    m_bAccumulateSamples(false),
+    m_SamplesPerActivePixel(1),
+    m_ConeSpreadAngle(0.0f),
+    m_AccumulatedFrameCount(0),
+    m_bCollectRenderStats(false),
+    m_bRecordPixelCosts(false),
+    m_PixelCostWidth(0),
+    m_PixelCostHeight(0)
 {
     m_device = rtcNewDevice();
     rtcDeviceSetErrorFunction(m_device, error_handler);
+}
+
+void RTRenderer::EnableRenderStats(_In_opt_ const char *JSONFileName)
+{
+    if (m_RenderStatsFile.is_open())
+    {
+        m_RenderStatsFile.close();
+    }
+
+    m_bCollectRenderStats = JSONFileName != nullptr;
+    if (m_bCollectRenderStats)
+    {
+        m_RenderStatsFile.open(JSONFileName);
+        FAIL_CHK(!m_RenderStatsFile.is_open(), std::string("Failed to open ") + JSONFileName + " for writing render stats");
+    }
+    m_TileScheduler.EnableTimings(m_bCollectRenderStats);
+}
 
-    SYSTEM_INFO sysinfo;
-    GetSystemInfo(&sysinfo);
-    const UINT numWorkerThreads = sysinfo.dwNumberOfProcessors;
-    m_ThreadPool = CreateThreadpool(nullptr);
-    if (!m_ThreadPool) FailWithLastError();
+void RTRenderer::EnableCostHeatmap(bool bEnable)
+{
+    m_bRecordPixelCosts = bEnable;
+    m_PixelCosts.clear();
+    m_PixelCostWidth = m_PixelCostHeight = 0;
+}
+
+void RTRenderer::RecordTileCost(const PixelRange &Tile, UINT64 Cycles, const RTRayCounters &RayCounters)
+{
+    UINT64 NumRays = 0;
+    for (UINT RayType = 0; RayType < RT_NUM_RAY_TYPES; RayType++)
+    {
+        NumRays += RayCounters.m_NumRays[RayType];
+    }
 
-    m_ThreadPoolCleanupGroup = CreateThreadpoolCleanupGroup();
-    if (!m_ThreadPoolCleanupGroup) FailWithLastError();
-    
-    TP_CALLBACK_ENVIRON PoolEnvironment;
-    InitializeThreadpoolEnvironment(&PoolEnvironment);
-    SetThreadpoolCallbackCleanupGroup(&PoolEnvironment, m_ThreadPoolCleanupGroup, nullptr);
+    // Tiles never overlap so no lock is needed
+    const double NumPixels = (double)(Tile.m_Width * Tile.m_Height);
+    const double CyclesPerPixel = (double)Cycles / NumPixels;
+    const double RaysPerPixel = (double)NumRays / NumPixels;
+    for (UINT y = Tile.m_Y; y < Tile.m_Y + Tile.m_Height; y++)
+    {
+        for (UINT x = Tile.m_X; x < Tile.m_X + Tile.m_Width; x++)
+        {
+            PixelCost &Cost = m_PixelCosts[y * m_PixelCostWidth + x];
+            Cost.m_Cycles += CyclesPerPixel;
+            Cost.m_NumRays += RaysPerPixel;
+        }
+    }
+}
 
-    SetThreadpoolThreadMaximum(m_ThreadPool, numWorkerThreads * 3);
-    SetThreadpoolThreadMinimum(m_ThreadPool, 1);
+glm::vec3 CostToFalseColor(float NormalizedCost)
+{
+    // Blue, cyan, green, yellow, red
+    const glm::vec3 Ramp[] = { glm::vec3(0, 0, 1), glm::vec3(0, 1, 1), glm::vec3(0, 1, 0), glm::vec3(1, 1, 0), glm::vec3(1, 0, 0) };
+    const UINT NumSegments = ARRAYSIZE(Ramp) - 1;
 
-    m_TracingFinishedEvent = CreateEvent(nullptr, true, false, nullptr);
-    m_pLastScene = nullptr;
-    m_pLastCamera = nullptr;
+    const float RampPosition = glm::clamp(NormalizedCost, 0.0f, 1.0f) * NumSegments;
+    const UINT Segment = min((UINT)RampPosition, NumSegments - 1);
+    return glm::mix(Ramp[Segment], Ramp[Segment + 1], RampPosition - Segment);
+}
+
+void RTRenderer::DrawCostHeatmap(_In_ Canvas *pCanvas, RTCostMetric Metric)
+{
+    if (m_PixelCosts.empty()) return;
+
+    double MaxCost = 0.0;
+    for (const PixelCost &Cost : m_PixelCosts)
+    {
+        MaxCost = max(MaxCost, Metric == RT_COST_CYCLES ? Cost.m_Cycles : Cost.m_NumRays);
+    }
+
+    std::vector<Vec3> Colors(m_PixelCosts.size());
+    for (size_t PixelIndex = 0; PixelIndex < m_PixelCosts.size(); PixelIndex++)
+    {
+        const double Cost = Metric == RT_COST_CYCLES ? m_PixelCosts[PixelIndex].m_Cycles : m_PixelCosts[PixelIndex].m_NumRays;
+        Colors[PixelIndex] = GlmVec3ToRealArray(CostToFalseColor(MaxCost > 0.0 ? (float)(Cost / MaxCost) : 0.0f));
+    }
+    pCanvas->WriteTile(0, 0, m_PixelCostWidth, m_PixelCostHeight, Colors.data());
 }
 
 RTRenderer::~RTRenderer()
 {
     rtcDeleteDevice(m_device);
-    CloseThreadpool(m_ThreadPool);
-    CloseThreadpoolCleanupGroup(m_ThreadPoolCleanupGroup);
 }
 
 
@@ -403,6 +1173,13 @@ Geometry* RTRenderer::CreateGeometry(_In_ CreateGeometryDescriptor *pCreateGeome
     return pGeometry;
 }
 
+Geometry *RTRenderer::CreateGeometryInstance(_In_ Geometry *pPrototype)
+{
+    RTGeometry *pInstance = new RTGeometry(RT_RENDERER_CAST<RTGeometry *>(pPrototype));
+    MEM_CHK(pInstance);
+    return pInstance;
+}
+
 void RTRenderer::DestroyGeometry(_In_ Geometry *pGeometry)
 {
     delete pGeometry;
@@ -441,10 +1218,10 @@ void RTRenderer::DestroyCamera(Camera *pCamera)
     delete pCamera;
 }
 
-Scene *RTRenderer::CreateScene(EnvironmentMap *pEnvironmentMap)
+Scene *RTRenderer::CreateScene(EnvironmentMap *pEnvironmentMap, bool bDynamic)
 {
     RTEnvironmentMap *pRTEnvironmentMap = (RTEnvironmentMap *)pEnvironmentMap;
-    Scene *pScene = new RTScene(m_device, pRTEnvironmentMap);
+    Scene *pScene = new RTScene(m_device, pRTEnvironmentMap, bDynamic);
     MEM_CHK(pScene);
     return pScene;
 }
@@ -454,9 +1231,16 @@ void RTRenderer::DestroyScene(Scene* pScene)
     delete pScene;
 }
 
-RayBatch::RayBatch(RTCScene Scene, _In_reads_(NumRays) const glm::vec3 *RayOrigins, _In_reads_(NumRays) const glm::vec3 *RayDirections, unsigned int NumRays) :
+RayBatch::RayBatch(RTCScene Scene, _In_reads_(NumRays) const glm::vec3 *RayOrigins, _In_reads_(NumRays) const glm::vec3 *RayDirections, unsigned int NumRays, bool bOcclusionOnly) :
 m_NumRays(NumRays)
 {
+    RTRayCounters *pCounters = g_pThreadRayCounters;
+    std::chrono::steady_clock::time_point TraceStartTime;
+    if (pCounters)
+    {
+        TraceStartTime = std::chrono::steady_clock::now();
+    }
+
     if (NumRays == 1)
     {
         Ray = {};
@@ -464,27 +1248,85 @@ m_NumRays(NumRays)
         Ray.tfar = FLT_MAX;
         Ray.geomID = RTC_INVALID_GEOMETRY_ID;
         Ray.primID = RTC_INVALID_GEOMETRY_ID;
+        Ray.instID = RTC_INVALID_GEOMETRY_ID;
         Ray.mask = -1;
         Ray.time = 0;
         memcpy(Ray.org, RayOrigins, sizeof(*RayOrigins));
         memcpy(Ray.dir, RayDirections, sizeof(*RayDirections));
 
-        rtcIntersect(Scene, Ray);
+        if (bOcclusionOnly)
+        {
+            rtcOccluded(Scene, Ray);
+        }
+        else
+        {
+            rtcIntersect(Scene, Ray);
+        }
     }
     else if (NumRays <= 4)
     {
         InitRayStruct(Ray4, RayOrigins, RayDirections, NumRays);
-        rtcIntersect4(&ValidMask, Scene, Ray4);
+        if (bOcclusionOnly)
+        {
+            rtcOccluded4(&ValidMask, Scene, Ray4);
+        }
+        else
+        {
+            rtcIntersect4(&ValidMask, Scene, Ray4);
+        }
     }
     else if (NumRays <= 8)
     {
         InitRayStruct(Ray8, RayOrigins, RayDirections, NumRays);
-        rtcIntersect8(&ValidMask, Scene, Ray8);
+        if (bOcclusionOnly)
+        {
+            rtcOccluded8(&ValidMask, Scene, Ray8);
+        }
+        else
+        {
+            rtcIntersect8(&ValidMask, Scene, Ray8);
+        }
     }
     else
     {
         InitRayStruct(Ray16, RayOrigins, RayDirections, NumRays);
-        rtcIntersect16(&ValidMask, Scene, Ray16);
+        if (bOcclusionOnly)
+        {
+            rtcOccluded16(&ValidMask, Scene, Ray16);
+        }
+        else
+        {
+            rtcIntersect16(&ValidMask, Scene, Ray16);
+        }
+    }
+
+    if (pCounters)
+    {
+        const UINT WidthIndex = NumRays == 1 ? 0 : NumRays <= 4 ? 1 : NumRays <= 8 ? 2 : 3;
+        pCounters->m_NumPackets[WidthIndex]++;
+        pCounters->m_NumPacketRays[WidthIndex] += NumRays;
+        pCounters->m_TraversalMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - TraceStartTime).count();
+    }
+}
+
+unsigned int RayBatch::GetInstanceID(unsigned int RayIndex)
+{
+    assert(RayIndex < m_NumRays);
+    if (m_NumRays == 1)
+    {
+        return Ray.instID;
+    }
+    else if (m_NumRays <= 4)
+    {
+        return GetInstanceIDInternal(Ray4, RayIndex);
+    }
+    else if (m_NumRays <= 8)
+    {
+        return GetInstanceIDInternal(Ray8, RayIndex);
+    }
+    else
+    {
+        return GetInstanceIDInternal(Ray16, RayIndex);
     }
 }
 
@@ -509,24 +1351,45 @@ unsigned int RayBatch::GetGeometryID(unsigned int RayIndex)
     }
 }
 
-unsigned int RayBatch::GetPrimID(unsigned int RayIndex)
+unsigned int RayBatch::GetPrimID(unsigned int RayIndex)
+{
+    assert(RayIndex < m_NumRays);
+    if (m_NumRays == 1)
+    {
+        return Ray.primID;
+    }
+    else if (m_NumRays <= 4)
+    {
+        return GetPrimIDInternal(Ray4, RayIndex);
+    }
+    else if (m_NumRays <= 8)
+    {
+        return GetPrimIDInternal(Ray8, RayIndex);
+    }
+    else
+    {
+        return GetPrimIDInternal(Ray16, RayIndex);
+    }
+}
+
+float RayBatch::GetHitDistance(unsigned int RayIndex)
 {
     assert(RayIndex < m_NumRays);
     if (m_NumRays == 1)
     {
-        return Ray.primID;
+        return Ray.tfar;
     }
     else if (m_NumRays <= 4)
     {
-        return GetPrimIDInternal(Ray4, RayIndex);
+        return GetHitDistanceInternal(Ray4, RayIndex);
     }
     else if (m_NumRays <= 8)
     {
-        return GetPrimIDInternal(Ray8, RayIndex);
+        return GetHitDistanceInternal(Ray8, RayIndex);
     }
     else
     {
-        return GetPrimIDInternal(Ray16, RayIndex);
+        return GetHitDistanceInternal(Ray16, RayIndex);
     }
 }
 
@@ -560,6 +1423,68 @@ void GammaCorrect(glm::vec3 &Color)
     Color = glm::pow(Color, glm::vec3(gammaCurve, gammaCurve, gammaCurve));
 }
 
+glm::vec2 RTRenderer::GetPrimaryRayJitter(const RTSampleID &SampleID)
+{
+    return m_bJitterPrimaryRays ? m_Sampler.Get2D(SampleID, RT_SAMPLE_DIMENSION_PIXEL) : glm::vec2(0.5f);
+}
+
+UINT RTRenderer::GetFirstPixelSampleIndex(UINT x, UINT y, UINT Width)
+{
+    // Continue the pixel's sequence from the samples already accumulated
+    return m_bAccumulateSamples ? m_AccumulationBuffer[y * Width + x].m_NumSamples : 0;
+}
+
+RTSampleID RTRenderer::GetPixelSampleID(UINT x, UINT y, UINT Width, UINT SampleIndex)
+{
+    return RTSampleID(y * Width + x, SampleIndex);
+}
+
+bool RTRenderer::IsPixelConverged(UINT x, UINT y, UINT Width)
+{
+    return m_bAccumulateSamples && m_AccumulationBuffer[y * Width + x].m_bConverged;
+}
+
+glm::vec3 RTRenderer::ResolvePixel(UINT x, UINT y, UINT Width, glm::vec3 Color)
+{
+    if (m_bAccumulateSamples)
+    {
+        // Each pixel belongs to exactly one tile so no synchronization is needed
+        AccumulatedPixel &Pixel = m_AccumulationBuffer[y * Width + x];
+        Pixel.m_NumSamples++;
+
+        // Welford's update, variance is only tracked for luminance
+        const float Delta = Luminance(Color) - Luminance(Pixel.m_Mean);
+        Pixel.m_Mean += (Color - Pixel.m_Mean) / (float)Pixel.m_NumSamples;
+        Pixel.m_LuminanceM2 += Delta * (Luminance(Color) - Luminance(Pixel.m_Mean));
+
+        if (m_bEnableAdaptiveSampling && Pixel.m_NumSamples >= RT_ADAPTIVE_MIN_SAMPLES)
+        {
+            // Stop sampling once the 95% confidence interval is within a fraction of the pixel's brightness
+            const float Variance = Pixel.m_LuminanceM2 / (float)(Pixel.m_NumSamples - 1);
+            const float ErrorBound = 1.96f * sqrt(Variance / (float)Pixel.m_NumSamples);
+            Pixel.m_bConverged = ErrorBound <= RT_ADAPTIVE_ERROR_THRESHOLD * max(Luminance(Pixel.m_Mean), MEDIUM_EPSILON);
+        }
+        Color = Pixel.m_Mean;
+    }
+    return Color;
+}
+
+void RTRenderer::WriteTile(const PixelRange &Range, _In_reads_(Range.m_Width * Range.m_Height) const glm::vec3 *pColors, const RenderSettings &RenderFlags)
+{
+    thread_local std::vector<Vec3> CanvasColors;
+    CanvasColors.resize(Range.m_Width * Range.m_Height);
+    for (UINT PixelIndex = 0; PixelIndex < CanvasColors.size(); PixelIndex++)
+    {
+        glm::vec3 Color = pColors[PixelIndex];
+        if (RenderFlags.m_GammaCorrection)
+        {
+            GammaCorrect(Color);
+        }
+        CanvasColors[PixelIndex] = GlmVec3ToRealArray(Color);
+    }
+    m_pCanvas->WriteTile(Range.m_X, Range.m_Y, Range.m_Width, Range.m_Height, CanvasColors.data());
+}
+
 void RTRenderer::RenderPixelRange(PixelRange *pRange, RTCamera *pCamera, RTScene *pScene, const RenderSettings &RenderFlags)
 {
     assert(pRange->m_Width > 0 && pRange->m_X + pRange->m_Width <= pCamera->GetWidth());
@@ -576,6 +1501,86 @@ void RTRenderer::RenderPixelRange(PixelRange *pRange, RTCamera *pCamera, RTScene
     const float PixelHeight = pCamera->GetLensHeight() / Height;
     const glm::vec3 right = pCamera->GetRight();
 
+    // Resolved colors for the range, handed to the canvas with one WriteTile call at the end. 
+    // Converged pixels aren't traced again but are still written with their accumulated mean,
+    // otherwise they'd come out undefined on canvases that discard their previous contents
+    thread_local std::vector<glm::vec3> TileColors;
+    TileColors.assign(pRange->m_Width * pRange->m_Height, glm::vec3(0.0f));
+    if (m_bAccumulateSamples)
+    {
+        for (UINT y = pRange->m_Y; y < pRange->m_Y + pRange->m_Height; y++)
+        {
+            for (UINT x = pRange->m_X; x < pRange->m_X + pRange->m_Width; x++)
+            {
+                TileColors[(y - pRange->m_Y) * pRange->m_Width + (x - pRange->m_X)] = m_AccumulationBuffer[y * Width + x].m_Mean;
+            }
+        }
+    }
+
+    if (m_bEnableWavefrontTracing)
+    {
+        // Trace the whole range as a single stream so that every bounce, not just the primary 
+        // rays, can be intersected in full packets. Rays are still ordered in 2x2 blocks to keep
+        // neighbouring primary rays in the same packet. Converged pixels are skipped
+        const UINT MaxRays = pRange->m_Width * pRange->m_Height * m_SamplesPerActivePixel;
+        std::vector<glm::vec3> LensPoints(MaxRays);
+        std::vector<glm::vec3> RayDirections(MaxRays);
+        std::vector<glm::vec3> Colors(MaxRays);
+        std::vector<glm::tvec2<UINT>> PixelCoords(MaxRays);
+        std::vector<RTSampleID> SampleIDs(MaxRays);
+
+        UINT rayIndex = 0;
+        for (UINT topLeftX = pRange->m_X; topLeftX < pRange->m_X + pRange->m_Width; topLeftX += INTERSECT_BLOCK_WIDTH)
+        {
+            for (UINT topLeftY = pRange->m_Y; topLeftY < pRange->m_Y + pRange->m_Height; topLeftY += INTERSECT_BLOCK_HEIGHT)
+            {
+                const UINT BlockWidth = min(INTERSECT_BLOCK_WIDTH, (pRange->m_X + pRange->m_Width) - topLeftX);
+                const UINT BlockHeight = min(INTERSECT_BLOCK_HEIGHT, (pRange->m_Y + pRange->m_Height) - topLeftY);
+                for (UINT xOffset = 0; xOffset < BlockWidth; xOffset++)
+                {
+                    for (UINT yOffset = 0; yOffset < BlockHeight; yOffset++)
+                    {
+                        UINT x = topLeftX + xOffset;
+                        UINT y = topLeftY + yOffset;
+                        if (IsPixelConverged(x, y, Width)) continue;
+
+                        const UINT FirstSampleIndex = GetFirstPixelSampleIndex(x, y, Width);
+                        for (UINT SampleIndex = 0; SampleIndex < m_SamplesPerActivePixel; SampleIndex++)
+                        {
+                            SampleIDs[rayIndex] = GetPixelSampleID(x, y, Width, FirstSampleIndex + SampleIndex);
+
+                            glm::vec3 coord(pCamera->GetLensWidth() * (float)x / (float)Width, pCamera->GetLensHeight() * (float)(Height - y) / (float)Height, 0.0f);
+                            coord -= glm::vec3(pCamera->GetLensWidth() / 2.0f, pCamera->GetLensHeight() / 2.0f, 0.0f);
+                            const glm::vec2 Jitter = GetPrimaryRayJitter(SampleIDs[rayIndex]);
+                            coord += glm::vec3(PixelWidth * Jitter.x, -PixelHeight * Jitter.y, 0.0f);
+
+                            LensPoints[rayIndex] = pCamera->GetLensPosition() + coord.y * pCamera->GetUp() + coord.x * right;
+                            RayDirections[rayIndex] = glm::normalize(LensPoints[rayIndex] - FocalPoint);
+                            PixelCoords[rayIndex] = glm::tvec2<UINT>(x, y);
+                            rayIndex++;
+                        }
+                    }
+                }
+            }
+        }
+        const UINT NumRays = rayIndex;
+
+        // A fully converged range still has to be written, canvases don't keep last frame's contents
+        if (NumRays > 0)
+        {
+            TraceWavefront(pScene, LensPoints.data(), RayDirections.data(), SampleIDs.data(), PixelHeight, Colors.data(), NumRays);
+
+            for (rayIndex = 0; rayIndex < NumRays; rayIndex++)
+            {
+                const UINT x = PixelCoords[rayIndex].x;
+                const UINT y = PixelCoords[rayIndex].y;
+                TileColors[(y - pRange->m_Y) * pRange->m_Width + (x - pRange->m_X)] = ResolvePixel(x, y, Width, Colors[rayIndex]);
+            }
+        }
+        WriteTile(*pRange, TileColors.data(), RenderFlags);
+        return;
+    }
+
     for (UINT topLeftX = pRange->m_X; topLeftX < pRange->m_X + pRange->m_Width; topLeftX += INTERSECT_BLOCK_WIDTH)
     {
         for (UINT topLeftY = pRange->m_Y; topLeftY < pRange->m_Y + pRange->m_Height; topLeftY += INTERSECT_BLOCK_HEIGHT)
@@ -583,8 +1588,12 @@ void RTRenderer::RenderPixelRange(PixelRange *pRange, RTCamera *pCamera, RTScene
             glm::vec3 LensPoints[RAYS_PER_BLOCK];
             glm::vec3 RayDirections[RAYS_PER_BLOCK];
             glm::vec3 Colors[RAYS_PER_BLOCK];
+            ShadePixelRecursionInfo RecursionInfo[RAYS_PER_BLOCK];
+            bool bActive[RAYS_PER_BLOCK];
+            UINT FirstSampleIndices[RAYS_PER_BLOCK];
 
             UINT rayIndex = 0;
+            UINT NumActivePixels = 0;
             const UINT BlockWidth = min(INTERSECT_BLOCK_WIDTH, (pRange->m_X + pRange->m_Width) - topLeftX);
             const UINT BlockHeight = min(INTERSECT_BLOCK_HEIGHT, (pRange->m_Y + pRange->m_Height) - topLeftY);
             const UINT BlockSize = BlockWidth * BlockHeight;
@@ -592,193 +1601,706 @@ void RTRenderer::RenderPixelRange(PixelRange *pRange, RTCamera *pCamera, RTScene
             {
                 for (UINT yOffset = 0; yOffset < BlockHeight; yOffset++)
                 {
-                    UINT x = topLeftX + xOffset;
-                    UINT y = topLeftY + yOffset;
-
-                    glm::vec3 coord(pCamera->GetLensWidth() * (float)x / (float)Width, pCamera->GetLensHeight() * (float)(Height - y) / (float)Height, 0.0f);
-                    coord -= glm::vec3(pCamera->GetLensWidth() / 2.0f, pCamera->GetLensHeight() / 2.0f, 0.0f);
-                    coord += glm::vec3(PixelWidth / 2.0f, -PixelHeight / 2.0f, 0.0f); // Make sure the ray is centered in the pixel
+                    bActive[rayIndex] = !IsPixelConverged(topLeftX + xOffset, topLeftY + yOffset, Width);
+                    NumActivePixels += bActive[rayIndex];
 
-                    LensPoints[rayIndex] = pCamera->GetLensPosition() + coord.y * pCamera->GetUp() + coord.x * right;
-                    RayDirections[rayIndex] = glm::normalize(LensPoints[rayIndex] - FocalPoint);
+                    // Read before the sample loop, ResolvePixel bumps the count after every sample
+                    FirstSampleIndices[rayIndex] = GetFirstPixelSampleIndex(topLeftX + xOffset, topLeftY + yOffset, Width);
                     rayIndex++;
                 }
             }
 
-            Trace(pScene, LensPoints, RayDirections, Colors, BlockSize, ShadePixelRecursionInfo());
+            // The block is traced as a whole to keep packets full, only unconverged pixels get the samples
+            if (NumActivePixels == 0) continue;
 
-            rayIndex = 0;
-            for (UINT xOffset = 0; xOffset < BlockWidth; xOffset++)
+            for (UINT SampleIndex = 0; SampleIndex < m_SamplesPerActivePixel; SampleIndex++)
             {
-                for (UINT yOffset = 0; yOffset < BlockHeight; yOffset++)
+                rayIndex = 0;
+                for (UINT xOffset = 0; xOffset < BlockWidth; xOffset++)
                 {
-                    UINT x = topLeftX + xOffset;
-                    UINT y = topLeftY + yOffset;
-                    if (RenderFlags.m_GammaCorrection)
+                    for (UINT yOffset = 0; yOffset < BlockHeight; yOffset++)
                     {
-                        GammaCorrect(Colors[rayIndex]);
+                        UINT x = topLeftX + xOffset;
+                        UINT y = topLeftY + yOffset;
+                        RecursionInfo[rayIndex].m_SampleID = GetPixelSampleID(x, y, Width, FirstSampleIndices[rayIndex] + SampleIndex);
+                        RecursionInfo[rayIndex].m_ConeWidth = PixelHeight;
+
+                        glm::vec3 coord(pCamera->GetLensWidth() * (float)x / (float)Width, pCamera->GetLensHeight() * (float)(Height - y) / (float)Height, 0.0f);
+                        coord -= glm::vec3(pCamera->GetLensWidth() / 2.0f, pCamera->GetLensHeight() / 2.0f, 0.0f);
+                        const glm::vec2 Jitter = GetPrimaryRayJitter(RecursionInfo[rayIndex].m_SampleID);
+                        coord += glm::vec3(PixelWidth * Jitter.x, -PixelHeight * Jitter.y, 0.0f);
+
+                        LensPoints[rayIndex] = pCamera->GetLensPosition() + coord.y * pCamera->GetUp() + coord.x * right;
+                        RayDirections[rayIndex] = glm::normalize(LensPoints[rayIndex] - FocalPoint);
+                        rayIndex++;
+                    }
+                }
+
+                Trace(pScene, LensPoints, RayDirections, Colors, BlockSize, RecursionInfo);
+
+                rayIndex = 0;
+                for (UINT xOffset = 0; xOffset < BlockWidth; xOffset++)
+                {
+                    for (UINT yOffset = 0; yOffset < BlockHeight; yOffset++)
+                    {
+                        UINT x = topLeftX + xOffset;
+                        UINT y = topLeftY + yOffset;
+                        if (bActive[rayIndex])
+                        {
+                            TileColors[(y - pRange->m_Y) * pRange->m_Width + (x - pRange->m_X)] = ResolvePixel(x, y, Width, Colors[rayIndex]);
+                        }
+                        rayIndex++;
                     }
-                    m_pCanvas->WritePixel(x, y, GlmVec3ToRealArray(Colors[rayIndex]));
-                    rayIndex++;
                 }
             }
         }
     }
+    WriteTile(*pRange, TileColors.data(), RenderFlags);
+}
+
+// Consecutive hits on the same geometry are handed to RTGeometry::Interpolate together, misses are skipped
+void InterpolateHitAttributes(
+    _In_reads_(NumHits) RTGeometry *const *ppGeometries,
+    _In_reads_(NumHits) const unsigned int *pPrimIDs,
+    _In_reads_(NumHits) const glm::vec3 *pBaryocentricCoords,
+    _In_reads_(NumHits) const float *pConeWidths,
+    _In_reads_(NumHits) const glm::vec3 *pRayDirections,
+    _Out_writes_(NumHits) RTHitAttributes *pAttributes,
+    UINT NumHits)
+{
+    UINT FirstHitIndex = 0;
+    while (FirstHitIndex < NumHits)
+    {
+        RTGeometry *pGeometry = ppGeometries[FirstHitIndex];
+        UINT RunLength = 1;
+        while (FirstHitIndex + RunLength < NumHits && ppGeometries[FirstHitIndex + RunLength] == pGeometry)
+        {
+            RunLength++;
+        }
+
+        if (pGeometry)
+        {
+            pGeometry->Interpolate(
+                &pPrimIDs[FirstHitIndex],
+                &pBaryocentricCoords[FirstHitIndex],
+                &pConeWidths[FirstHitIndex],
+                &pRayDirections[FirstHitIndex],
+                &pAttributes[FirstHitIndex],
+                RunLength);
+        }
+        FirstHitIndex += RunLength;
+    }
 }
 
-void RTRenderer::Trace(_In_ RTScene *pScene, _In_reads_(NumRays) const glm::vec3 *pRayOrigins, _In_reads_(NumRays) const glm::vec3 *pRayDirs, _Out_ glm::vec3 *pColors, UINT NumRays, ShadePixelRecursionInfo &RecursionInfo)
+void RTRenderer::Trace(_In_ RTScene *pScene, _In_reads_(NumRays) const glm::vec3 *pRayOrigins, _In_reads_(NumRays) const glm::vec3 *pRayDirs, _Out_ glm::vec3 *pColors, UINT NumRays, _In_reads_(NumRays) const ShadePixelRecursionInfo *pRecursionInfo)
 {
     const UINT NumBatches = (NumRays - 1)/ RAYS_PER_INTERSECT_BATCH + 1;
     for (UINT RayBatchIndex = 0; RayBatchIndex < NumBatches; RayBatchIndex++)
     {
         const UINT BatchSize = (RayBatchIndex < NumBatches - 1 || NumRays % RAYS_PER_INTERSECT_BATCH == 0) ? RAYS_PER_INTERSECT_BATCH : NumRays % RAYS_PER_INTERSECT_BATCH;
-        assert(IsIntersectCountEmbreeCompatible(BatchSize)); 
 
         RayBatch RayBatch(pScene->GetRTCScene(), &pRayOrigins[RayBatchIndex * RAYS_PER_INTERSECT_BATCH], &pRayDirs[RayBatchIndex * RAYS_PER_INTERSECT_BATCH], BatchSize);
+        CountRays(pRecursionInfo[RayBatchIndex * RAYS_PER_INTERSECT_BATCH].m_NumRecursions > 1 ? RT_REFLECTION_RAY : RT_PRIMARY_RAY, BatchSize);
+
+        // Width of each ray cone where it hit the surface, used to pick the texture LOD
+        RTGeometry *pGeometries[RAYS_PER_INTERSECT_BATCH];
+        unsigned int PrimIDs[RAYS_PER_INTERSECT_BATCH];
+        glm::vec3 BaryocentricCoords[RAYS_PER_INTERSECT_BATCH];
+        float ConeWidths[RAYS_PER_INTERSECT_BATCH];
+        for (UINT RayIndex = 0; RayIndex < BatchSize; RayIndex++)
+        {
+            pGeometries[RayIndex] = pScene->GetRTGeometry(RayBatch.GetInstanceID(RayIndex), RayBatch.GetGeometryID(RayIndex));
+            PrimIDs[RayIndex] = RayBatch.GetPrimID(RayIndex);
+            BaryocentricCoords[RayIndex] = RayBatch.GetBaryocentricCoordinate(RayIndex);
+            ConeWidths[RayIndex] = pRecursionInfo[RayBatchIndex * RAYS_PER_INTERSECT_BATCH + RayIndex].m_ConeWidth + m_ConeSpreadAngle * RayBatch.GetHitDistance(RayIndex);
+        }
+
+        RTHitAttributes HitAttributes[RAYS_PER_INTERSECT_BATCH];
+        InterpolateHitAttributes(pGeometries, PrimIDs, BaryocentricCoords, ConeWidths, &pRayDirs[RayBatchIndex * RAYS_PER_INTERSECT_BATCH], HitAttributes, BatchSize);
+
+        DirectLighting Lighting[RAYS_PER_INTERSECT_BATCH];
+        GatherDirectLighting(pScene, pGeometries, HitAttributes, &pRayDirs[RayBatchIndex * RAYS_PER_INTERSECT_BATCH], Lighting, BatchSize);
+
         for (UINT RayIndex = 0; RayIndex < BatchSize; RayIndex++)
         {
             pColors[RayIndex] = ShadePixel(
                 pScene,
-                RayBatch.GetPrimID(RayIndex),
-                pScene->GetRTGeometry(RayBatch.GetGeometryID(RayIndex)),
-                RayBatch.GetBaryocentricCoordinate(RayIndex),
+                pGeometries[RayIndex],
+                HitAttributes[RayIndex],
                 -pRayDirs[RayBatchIndex * RAYS_PER_INTERSECT_BATCH + RayIndex],
-                RecursionInfo);
+                ConeWidths[RayIndex],
+                Lighting[RayIndex],
+                pRecursionInfo[RayBatchIndex * RAYS_PER_INTERSECT_BATCH + RayIndex]);
         }
     }
 }
 
-glm::vec3 RTRenderer::ShadePixel(RTScene *pScene, unsigned int primID, RTGeometry *pGeometry, glm::vec3 baryocentricCoord, glm::vec3 ViewVector, ShadePixelRecursionInfo &RecursionInfo)
+void RTRenderer::GatherDirectLighting(_In_ RTScene *pScene, _In_reads_(NumRays) RTGeometry *const *ppGeometries, _In_reads_(NumRays) const RTHitAttributes *pHitAttributes, _In_reads_(NumRays) const glm::vec3 *pRayDirs, _Out_writes_(NumRays) DirectLighting *pLighting, UINT NumRays)
 {
-    if (pGeometry)
+    // Shadow rays for every light of every hit in the batch are traced together in
+    // occlusion packets. The queue is drained before Trace recurses so it can be shared
+    thread_local RTShadowRayQueue ShadowRays;
+    ShadowRays.Clear();
+
+    for (UINT RayIndex = 0; RayIndex < NumRays; RayIndex++)
     {
-        assert(pGeometry != nullptr);
+        RTGeometry *pGeometry = ppGeometries[RayIndex];
+        if (!pGeometry) continue;
 
-        glm::vec3 TotalDiffuse = glm::vec3(0.0f);
-        glm::vec3 TotalSpecular = glm::vec3(0.0f);
-        float TotalFresnel = 0.0f;
+        const glm::vec3 ViewVector = -pRayDirs[RayIndex];
 
-        glm::vec3 matColor = pGeometry->GetColor(primID, baryocentricCoord.x, baryocentricCoord.y);
+        glm::vec3 matColor = pHitAttributes[RayIndex].m_Color;
         float reflectivity = pGeometry->GetRTMaterial()->GetReflectivity();
         float Roughness = pGeometry->GetRTMaterial()->GetRoughness();
-        glm::vec3 Norm = pGeometry->GetNormal(primID, baryocentricCoord.x, baryocentricCoord.y);
-        glm::vec3 intersectPos = pGeometry->GetPosition(primID, baryocentricCoord.x, baryocentricCoord.y);
-        UINT NumSamplesTaken = 0;
+        glm::vec3 Norm = pHitAttributes[RayIndex].m_Normal;
+        glm::vec3 intersectPos = pHitAttributes[RayIndex].m_Position;
 
         for (RTLight *pLight : pScene->GetLightList())
         {
             glm::vec3 LightColor = pLight->GetLightColor(intersectPos);
             glm::vec3 LightDirection = pLight->GetLightDirection(intersectPos);
-            glm::vec3 HalfVector = glm::normalize(LightDirection + ViewVector);
 
             float nDotL = glm::dot(Norm, LightDirection);
             if (nDotL > 0.0f)
             {
-                glm::vec3 ShadowRayOrigin = intersectPos + LightDirection * .001f;
-                RTCRay ShadowRay{};
-                memcpy(ShadowRay.org, &ShadowRayOrigin, sizeof(ShadowRay.org));
-                memcpy(ShadowRay.dir, &LightDirection, sizeof(ShadowRay.dir));
-                ShadowRay.tnear = 0.0f;
-                ShadowRay.tfar = FLT_MAX;
-                ShadowRay.geomID = RTC_INVALID_GEOMETRY_ID;
-                ShadowRay.primID = RTC_INVALID_GEOMETRY_ID;
-                ShadowRay.mask = -1;
-                ShadowRay.time = 0;
-
-                rtcOccluded(pScene->GetRTCScene(), ShadowRay);
-                if (ShadowRay.geomID == RTC_INVALID_GEOMETRY_ID)
+                float fresnel;
+                glm::vec3 Specular = LightColor * CookTorrance().BRDF(ViewVector, Norm, LightDirection, Roughness, reflectivity, fresnel);
+                ShadowRays.Push(intersectPos + LightDirection * .001f, LightDirection, matColor * LightColor * nDotL, Specular, fresnel, RayIndex);
+                pLighting[RayIndex].m_NumSamplesTaken++;
+            }
+        }
+    }
+
+    OccludeShadowRayQueue(pScene, ShadowRays);
+
+    for (UINT ShadowRayIndex = 0; ShadowRayIndex < ShadowRays.Size(); ShadowRayIndex++)
+    {
+        if (ShadowRays.m_Visible[ShadowRayIndex])
+        {
+            DirectLighting &Lighting = pLighting[ShadowRays.m_HitIndices[ShadowRayIndex]];
+            Lighting.m_Diffuse += ShadowRays.m_Diffuse[ShadowRayIndex];
+            Lighting.m_Specular += ShadowRays.m_Specular[ShadowRayIndex];
+            Lighting.m_Fresnel += ShadowRays.m_Fresnel[ShadowRayIndex];
+        }
+    }
+}
+
+glm::vec3 RTRenderer::ShadePixel(RTScene *pScene, RTGeometry *pGeometry, const RTHitAttributes &HitAttributes, glm::vec3 ViewVector, float ConeWidth, const DirectLighting &Lighting, const ShadePixelRecursionInfo &RecursionInfo)
+{
+    if (pGeometry)
+    {
+        assert(pGeometry != nullptr);
+
+        glm::vec3 TotalDiffuse = Lighting.m_Diffuse;
+        glm::vec3 TotalSpecular = Lighting.m_Specular;
+        float TotalFresnel = Lighting.m_Fresnel;
+
+        float reflectivity = pGeometry->GetRTMaterial()->GetReflectivity();
+        float Roughness = pGeometry->GetRTMaterial()->GetRoughness();
+        glm::vec3 Norm = HitAttributes.m_Normal;
+        glm::vec3 intersectPos = HitAttributes.m_Position;
+        UINT NumSamplesTaken = Lighting.m_NumSamplesTaken;
+
+        glm::vec3 ReflectionColor = glm::vec3(0.0f);
+        bool bGetReflectionFromEnvironmentMap = RecursionInfo.m_NumRecursions >= MAX_RAY_RECURSION;
+        glm::vec3 ReflOrigin = intersectPos + Norm * LARGE_EPSILON; //Offset a small amount to avoid self-intersection
+        glm::vec3 ReflectionVector = glm::reflect(-ViewVector, Norm);
+
+        if (bGetReflectionFromEnvironmentMap)
+        {
+            float fresnel;
+            float BRDFValue = CookTorrance().BRDF(ViewVector, Norm, ReflectionVector, Roughness, reflectivity, fresnel);
+            ReflectionColor = pScene->GetEnvironmentMap()->GetColor(ReflectionVector);
+            ReflectionColor *= BRDFValue;
+            TotalFresnel += fresnel;
+            NumSamplesTaken++;
+        }
+        else
+        {
+            if (m_bEnableMultiRayEmission && RecursionInfo.m_NumRecursions < 2)
+            {
+                glm::vec3 Colors[RAYS_PER_INTERSECT_BATCH];
+                float ReflectionWeights[RAYS_PER_INTERSECT_BATCH];
+                glm::vec3 ReflectionVectors[RAYS_PER_INTERSECT_BATCH];
+                glm::vec3 ReflectionOrigins[RAYS_PER_INTERSECT_BATCH];
+                ShadePixelRecursionInfo ReflectionRecursionInfo[RAYS_PER_INTERSECT_BATCH];
+
+                RTGGXRayGenerator GGXRayGenerator(ViewVector, Norm, Roughness);
+                RTCosineWeightedRayGenerator CosineWeightedRayGenerator(ReflectionVector);
+                RTRayGenerator *pRayGenerator = m_bEnableGGXImportanceSampling ? (RTRayGenerator *)&GGXRayGenerator : &CosineWeightedRayGenerator;
+
+                // The preview frame only traces the mirror ray, skip the extra visibility rays there
+                RTEnvironmentMap *pEnvironmentMap = pScene->GetEnvironmentMap();
+                const bool bSampleEnvironment = m_bEnableEnvironmentMIS && !m_bForceMirrorRay;
+
+                std::fill(ReflectionOrigins, ReflectionOrigins + RAYS_PER_INTERSECT_BATCH, ReflOrigin);
+
+                for (UINT FirstRayIndex = 0; FirstRayIndex < m_NumGlossyRaysPerHit; FirstRayIndex += RAYS_PER_INTERSECT_BATCH)
                 {
-                    TotalDiffuse += matColor * LightColor * nDotL;
+                    const UINT NumCandidates = min(m_NumGlossyRaysPerHit - FirstRayIndex, (UINT)RAYS_PER_INTERSECT_BATCH);
+                    RTSampleID CandidateSampleIDs[RAYS_PER_INTERSECT_BATCH];
+                    glm::vec3 CandidateVectors[RAYS_PER_INTERSECT_BATCH];
+                    float CandidateX[RAYS_PER_INTERSECT_BATCH], CandidateY[RAYS_PER_INTERSECT_BATCH], CandidateZ[RAYS_PER_INTERSECT_BATCH];
+                    for (UINT CandidateIndex = 0; CandidateIndex < NumCandidates; CandidateIndex++)
+                    {
+                        const UINT RayIndex = FirstRayIndex + CandidateIndex;
+                        CandidateSampleIDs[CandidateIndex] = RecursionInfo.m_SampleID.GetChild(RayIndex, m_NumGlossyRaysPerHit);
+
+                        // Make sure the reflection vector is tested
+                        CandidateVectors[CandidateIndex] = (m_bForceMirrorRay && RayIndex == 0) ?
+                            ReflectionVector :
+                            pRayGenerator->GenerateRay(m_Sampler.Get2D(CandidateSampleIDs[CandidateIndex], RT_SAMPLE_DIMENSION_REFLECTION(RecursionInfo.m_NumRecursions)));
+                        CandidateX[CandidateIndex] = CandidateVectors[CandidateIndex].x;
+                        CandidateY[CandidateIndex] = CandidateVectors[CandidateIndex].y;
+                        CandidateZ[CandidateIndex] = CandidateVectors[CandidateIndex].z;
+                    }
+
+                    float CandidateBRDFValues[RAYS_PER_INTERSECT_BATCH], CandidateFresnels[RAYS_PER_INTERSECT_BATCH];
+                    CookTorrance().BRDFBatch(ViewVector, Norm, CandidateX, CandidateY, CandidateZ, Roughness, reflectivity, CandidateBRDFValues, CandidateFresnels, NumCandidates);
+
+                    UINT NumRaysBatched = 0;
+                    for (UINT CandidateIndex = 0; CandidateIndex < NumCandidates; CandidateIndex++)
+                    {
+                        // Every sample counts towards the average, rays culled here just contribute nothing
+                        TotalFresnel += CandidateFresnels[CandidateIndex];
+                        NumSamplesTaken++;
+
+                        const float BRDFValue = CandidateBRDFValues[CandidateIndex];
+                        const float SamplePDF = pRayGenerator->PDF(CandidateVectors[CandidateIndex]);
+                        if (RecursionInfo.m_TotalContribution * BRDFValue > MEDIUM_EPSILON && SamplePDF > 0.0f)
+                        {
+                            const float EnvironmentWeight = bSampleEnvironment ? PowerHeuristic(SamplePDF, pEnvironmentMap->PDF(CandidateVectors[CandidateIndex])) : 1.0f;
+                            ReflectionVectors[NumRaysBatched] = CandidateVectors[CandidateIndex];
+                            ReflectionWeights[NumRaysBatched] = BRDFValue / SamplePDF;
+                            ReflectionRecursionInfo[NumRaysBatched] = ShadePixelRecursionInfo(RecursionInfo.m_NumRecursions + 1, RecursionInfo.m_TotalContribution * BRDFValue, CandidateSampleIDs[CandidateIndex], ConeWidth, EnvironmentWeight);
+                            NumRaysBatched++;
+                        }
+                    }
+
+                    if (NumRaysBatched > 0)
+                    {
+                        Trace(pScene, ReflectionOrigins, ReflectionVectors, Colors, NumRaysBatched, ReflectionRecursionInfo);
+                        for (UINT ColorIndex = 0; ColorIndex < NumRaysBatched; ColorIndex++)
+                        {
+                            ReflectionColor += Colors[ColorIndex] * ReflectionWeights[ColorIndex];
+                        }
+                    }
 
-                    float fresnel;
-                    TotalSpecular += LightColor * CookTorrance().BRDF(ViewVector, Norm, LightDirection, Roughness, reflectivity, fresnel);
-                    TotalFresnel += fresnel;
+                    if (bSampleEnvironment)
+                    {
+                        glm::vec3 EnvironmentDirections[RAYS_PER_INTERSECT_BATCH];
+                        glm::vec3 EnvironmentRadiance[RAYS_PER_INTERSECT_BATCH];
+                        const UINT NumEnvironmentRays = GenerateEnvironmentSamples(
+                            pEnvironmentMap, 
+                            ViewVector, 
+                            Norm, 
+                            Roughness, 
+                            reflectivity, 
+                            *pRayGenerator, 
+                            CandidateSampleIDs, 
+                            RecursionInfo.m_NumRecursions, 
+                            RecursionInfo.m_TotalContribution, 
+                            EnvironmentDirections, 
+                            EnvironmentRadiance, 
+                            NumCandidates);
+                        if (NumEnvironmentRays > 0)
+                        {
+                            RayBatch VisibilityBatch(pScene->GetRTCScene(), ReflectionOrigins, EnvironmentDirections, NumEnvironmentRays, true);
+                            CountRays(RT_SHADOW_RAY, NumEnvironmentRays);
+                            for (UINT EnvironmentRayIndex = 0; EnvironmentRayIndex < NumEnvironmentRays; EnvironmentRayIndex++)
+                            {
+                                if (!VisibilityBatch.IsOccluded(EnvironmentRayIndex))
+                                {
+                                    ReflectionColor += EnvironmentRadiance[EnvironmentRayIndex];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            else
+            {
+                float fresnel;
+                float BRDFValue = CookTorrance().BRDF(ViewVector, Norm, ReflectionVector, Roughness, reflectivity, fresnel);
+                if (RecursionInfo.m_TotalContribution * BRDFValue > MEDIUM_EPSILON)
+                {
+                    const ShadePixelRecursionInfo ReflectionRecursionInfo(RecursionInfo.m_NumRecursions + 1, RecursionInfo.m_TotalContribution * BRDFValue, RecursionInfo.m_SampleID, ConeWidth);
+                    Trace(pScene, &ReflOrigin, &ReflectionVector, &ReflectionColor, 1, &ReflectionRecursionInfo);
                 }
                 NumSamplesTaken++;
+                ReflectionColor *= BRDFValue;
+                TotalFresnel += fresnel;
+
+            }
+        }
+
+        TotalSpecular += ReflectionColor;
+
+        TotalFresnel /= NumSamplesTaken;
+        TotalSpecular /= NumSamplesTaken;
+
+        return glm::clamp(TotalDiffuse * (1.0f - TotalFresnel) + TotalSpecular, glm::vec3(0.0f), glm::vec3(1.0f));
+    }
+    else
+    {
+        return RecursionInfo.m_EnvironmentWeight * pScene->GetEnvironmentMap()->GetColor(-ViewVector);
+    }
+}
+
+void RTRenderer::TraceWavefront(_In_ RTScene *pScene, _In_reads_(NumRays) const glm::vec3 *pRayOrigins, _In_reads_(NumRays) const glm::vec3 *pRayDirs, _In_reads_(NumRays) const RTSampleID *pSampleIDs, float PrimaryConeWidth, _Out_ glm::vec3 *pColors, UINT NumRays)
+{
+    // The reflection queues can get large (RAY_EMISSION_COUNT rays per primary hit),
+    // keep them around per-thread so they don't get reallocated for every range
+    thread_local RTWavefrontQueues Queues;
+    RTRayQueue *pRays = &Queues.m_PathRays[0];
+    RTRayQueue *pNextRays = &Queues.m_PathRays[1];
+
+    pRays->Clear();
+    for (UINT RayIndex = 0; RayIndex < NumRays; RayIndex++)
+    {
+        pColors[RayIndex] = glm::vec3(0.0f);
+        pRays->Push(pRayOrigins[RayIndex], pRayDirs[RayIndex], glm::vec3(1.0f), 1.0f, RayIndex, pSampleIDs[RayIndex], PrimaryConeWidth);
+    }
+
+    // Depth matches ShadePixelRecursionInfo::m_NumRecursions, rays stop being emitted 
+    // once MAX_RAY_RECURSION is hit so the queue is guaranteed to drain
+    for (UINT Depth = 1; pRays->Size() > 0; Depth++)
+    {
+        const UINT NumQueuedRays = pRays->Size();
+        IntersectRayQueue(pScene, *pRays, Queues.m_Hits);
+        CountRays(Depth == 1 ? RT_PRIMARY_RAY : RT_REFLECTION_RAY, NumQueuedRays);
+
+        // Shade grouped by material (and then by triangle) so that texture and vertex 
+        // data stay hot in the cache across consecutive hits
+        Queues.m_ShadingOrder.resize(NumQueuedRays);
+        for (UINT RayIndex = 0; RayIndex < NumQueuedRays; RayIndex++)
+        {
+            Queues.m_ShadingOrder[RayIndex] = RayIndex;
+        }
+
+        const RTHitQueue &Hits = Queues.m_Hits;
+        std::sort(Queues.m_ShadingOrder.begin(), Queues.m_ShadingOrder.end(), [&Hits](UINT a, UINT b) -> bool {
+            RTMaterial *pMaterialA = Hits.m_pGeometries[a] ? Hits.m_pGeometries[a]->GetRTMaterial() : nullptr;
+            RTMaterial *pMaterialB = Hits.m_pGeometries[b] ? Hits.m_pGeometries[b]->GetRTMaterial() : nullptr;
+            if (pMaterialA != pMaterialB) return pMaterialA < pMaterialB;
+            if (Hits.m_pGeometries[a] != Hits.m_pGeometries[b]) return Hits.m_pGeometries[a] < Hits.m_pGeometries[b];
+            return Hits.m_PrimIDs[a] < Hits.m_PrimIDs[b];
+        });
+
+        pNextRays->Clear();
+        Queues.m_ShadowRays.Clear();
+        Queues.m_HitRecords.clear();
+        for (UINT FirstOrderIndex = 0; FirstOrderIndex < NumQueuedRays; FirstOrderIndex += RAYS_PER_INTERSECT_BATCH)
+        {
+            // Hits are interpolated a batch at a time in shading order, so hits on the same triangle share their vertex fetches
+            const UINT BatchSize = min(NumQueuedRays - FirstOrderIndex, (UINT)RAYS_PER_INTERSECT_BATCH);
+            const UINT *pRayIndices = &Queues.m_ShadingOrder[FirstOrderIndex];
+            RTGeometry *pGeometries[RAYS_PER_INTERSECT_BATCH];
+            unsigned int PrimIDs[RAYS_PER_INTERSECT_BATCH];
+            glm::vec3 BaryocentricCoords[RAYS_PER_INTERSECT_BATCH];
+            float ConeWidths[RAYS_PER_INTERSECT_BATCH];
+            glm::vec3 RayDirections[RAYS_PER_INTERSECT_BATCH];
+            for (UINT BatchIndex = 0; BatchIndex < BatchSize; BatchIndex++)
+            {
+                const UINT RayIndex = pRayIndices[BatchIndex];
+                pGeometries[BatchIndex] = Hits.m_pGeometries[RayIndex];
+                PrimIDs[BatchIndex] = Hits.m_PrimIDs[RayIndex];
+                BaryocentricCoords[BatchIndex] = Hits.m_BaryocentricCoordinates[RayIndex];
+                ConeWidths[BatchIndex] = pRays->m_ConeWidths[RayIndex] + m_ConeSpreadAngle * Hits.m_HitDistances[RayIndex];
+                RayDirections[BatchIndex] = pRays->m_Directions[RayIndex];
+            }
+
+            RTHitAttributes HitAttributes[RAYS_PER_INTERSECT_BATCH];
+            InterpolateHitAttributes(pGeometries, PrimIDs, BaryocentricCoords, ConeWidths, RayDirections, HitAttributes, BatchSize);
+
+            for (UINT BatchIndex = 0; BatchIndex < BatchSize; BatchIndex++)
+            {
+                const UINT RayIndex = pRayIndices[BatchIndex];
+                if (pGeometries[BatchIndex])
+                {
+                    ShadeWavefrontHit(pScene, pGeometries[BatchIndex], HitAttributes[BatchIndex], ConeWidths[BatchIndex], Depth, RayIndex, *pRays, Queues, *pNextRays);
+                }
+                else
+                {
+                    pColors[pRays->m_PixelIndices[RayIndex]] += pRays->m_Weights[RayIndex] * pRays->m_EnvironmentWeights[RayIndex] * pScene->GetEnvironmentMap()->GetColor(pRays->m_Directions[RayIndex]);
+                }
+            }
+        }
+
+        ResolveShadowRayQueue(pScene, Queues.m_ShadowRays, Queues.m_HitRecords);
+
+        for (RTWavefrontHitRecord &HitRecord : Queues.m_HitRecords)
+        {
+            if (HitRecord.m_NumSamplesTaken > 0)
+            {
+                const float Fresnel = HitRecord.m_Fresnel / HitRecord.m_NumSamplesTaken;
+                const glm::vec3 Specular = HitRecord.m_Specular / (float)HitRecord.m_NumSamplesTaken;
+                pColors[HitRecord.m_PixelIndex] += HitRecord.m_Weight * (HitRecord.m_Diffuse * (1.0f - Fresnel) + Specular);
             }
         }
 
-        glm::vec3 ReflectionColor = glm::vec3(0.0f);
-        bool bGetReflectionFromEnvironmentMap = RecursionInfo.m_NumRecursions >= MAX_RAY_RECURSION;
-        glm::vec3 ReflOrigin = intersectPos + Norm * LARGE_EPSILON; //Offset a small amount to avoid self-intersection
-        glm::vec3 ReflectionVector = glm::reflect(-ViewVector, Norm);
+        std::swap(pRays, pNextRays);
+    }
+
+    // ShadePixel clamps the result of every bounce, the wavefront path only has 
+    // the summed contributions so the clamp is applied once to the final color
+    for (UINT RayIndex = 0; RayIndex < NumRays; RayIndex++)
+    {
+        pColors[RayIndex] = glm::clamp(pColors[RayIndex], glm::vec3(0.0f), glm::vec3(1.0f));
+    }
+}
+
+void RTRenderer::IntersectRayQueue(_In_ RTScene *pScene, _In_ const RTRayQueue &Rays, _Out_ RTHitQueue &Hits)
+{
+    const UINT NumRays = Rays.Size();
+    Hits.Resize(NumRays);
+    for (UINT FirstRayIndex = 0; FirstRayIndex < NumRays; FirstRayIndex += RAYS_PER_INTERSECT_BATCH)
+    {
+        const UINT BatchSize = min(NumRays - FirstRayIndex, (UINT)RAYS_PER_INTERSECT_BATCH);
+        RayBatch RayBatch(pScene->GetRTCScene(), &Rays.m_Origins[FirstRayIndex], &Rays.m_Directions[FirstRayIndex], BatchSize);
+        for (UINT RayIndex = 0; RayIndex < BatchSize; RayIndex++)
+        {
+            Hits.m_pGeometries[FirstRayIndex + RayIndex] = pScene->GetRTGeometry(RayBatch.GetInstanceID(RayIndex), RayBatch.GetGeometryID(RayIndex));
+            Hits.m_PrimIDs[FirstRayIndex + RayIndex] = RayBatch.GetPrimID(RayIndex);
+            Hits.m_BaryocentricCoordinates[FirstRayIndex + RayIndex] = RayBatch.GetBaryocentricCoordinate(RayIndex);
+            Hits.m_HitDistances[FirstRayIndex + RayIndex] = RayBatch.GetHitDistance(RayIndex);
+        }
+    }
+}
+
+void RTRenderer::OccludeShadowRayQueue(_In_ RTScene *pScene, _Inout_ RTShadowRayQueue &ShadowRays)
+{
+    const UINT NumRays = ShadowRays.Size();
+    ShadowRays.m_Visible.resize(NumRays);
+    CountRays(RT_SHADOW_RAY, NumRays);
+    for (UINT FirstRayIndex = 0; FirstRayIndex < NumRays; FirstRayIndex += RAYS_PER_INTERSECT_BATCH)
+    {
+        const UINT BatchSize = min(NumRays - FirstRayIndex, (UINT)RAYS_PER_INTERSECT_BATCH);
+        RayBatch RayBatch(pScene->GetRTCScene(), &ShadowRays.m_Origins[FirstRayIndex], &ShadowRays.m_Directions[FirstRayIndex], BatchSize, true);
+        for (UINT RayIndex = 0; RayIndex < BatchSize; RayIndex++)
+        {
+            ShadowRays.m_Visible[FirstRayIndex + RayIndex] = !RayBatch.IsOccluded(RayIndex);
+        }
+    }
+}
+
+void RTRenderer::ResolveShadowRayQueue(_In_ RTScene *pScene, _Inout_ RTShadowRayQueue &ShadowRays, _Inout_ std::vector<RTWavefrontHitRecord> &HitRecords)
+{
+    OccludeShadowRayQueue(pScene, ShadowRays);
+    for (UINT ShadowRayIndex = 0; ShadowRayIndex < ShadowRays.Size(); ShadowRayIndex++)
+    {
+        if (ShadowRays.m_Visible[ShadowRayIndex])
+        {
+            RTWavefrontHitRecord &HitRecord = HitRecords[ShadowRays.m_HitIndices[ShadowRayIndex]];
+            HitRecord.m_Diffuse += ShadowRays.m_Diffuse[ShadowRayIndex];
+            HitRecord.m_Specular += ShadowRays.m_Specular[ShadowRayIndex];
+            HitRecord.m_Fresnel += ShadowRays.m_Fresnel[ShadowRayIndex];
+        }
+    }
+}
+
+UINT RTRenderer::GenerateEnvironmentSamples(
+    _In_ RTEnvironmentMap *pEnvironmentMap,
+    const glm::vec3 &ViewVector,
+    const glm::vec3 &Normal,
+    float Roughness,
+    float Reflectivity,
+    _In_ RTRayGenerator &RayGenerator,
+    _In_reads_(NumSamples) const RTSampleID *pSampleIDs,
+    UINT Depth,
+    float TotalContribution,
+    _Out_writes_to_(NumSamples, return) glm::vec3 *pDirections,
+    _Out_writes_to_(NumSamples, return) glm::vec3 *pRadiance,
+    UINT NumSamples)
+{
+    assert(NumSamples <= RAY_EMISSION_COUNT);
+    glm::vec3 Directions[RAY_EMISSION_COUNT];
+    float EnvironmentPDFs[RAY_EMISSION_COUNT];
+    float DirectionX[RAY_EMISSION_COUNT], DirectionY[RAY_EMISSION_COUNT], DirectionZ[RAY_EMISSION_COUNT];
+    for (UINT SampleIndex = 0; SampleIndex < NumSamples; SampleIndex++)
+    {
+        Directions[SampleIndex] = pEnvironmentMap->Sample(m_Sampler.Get2D(pSampleIDs[SampleIndex], RT_SAMPLE_DIMENSION_ENVIRONMENT(Depth)), EnvironmentPDFs[SampleIndex]);
+        DirectionX[SampleIndex] = Directions[SampleIndex].x;
+        DirectionY[SampleIndex] = Directions[SampleIndex].y;
+        DirectionZ[SampleIndex] = Directions[SampleIndex].z;
+    }
+
+    float BRDFValues[RAY_EMISSION_COUNT], Fresnels[RAY_EMISSION_COUNT];
+    CookTorrance().BRDFBatch(ViewVector, Normal, DirectionX, DirectionY, DirectionZ, Roughness, Reflectivity, BRDFValues, Fresnels, NumSamples);
+
+    UINT NumGenerated = 0;
+    for (UINT SampleIndex = 0; SampleIndex < NumSamples; SampleIndex++)
+    {
+        if (EnvironmentPDFs[SampleIndex] <= 0.0f || TotalContribution * BRDFValues[SampleIndex] <= MEDIUM_EPSILON) continue;
+
+        const float Weight = PowerHeuristic(EnvironmentPDFs[SampleIndex], RayGenerator.PDF(Directions[SampleIndex]));
+        pDirections[NumGenerated] = Directions[SampleIndex];
+        pRadiance[NumGenerated] = pEnvironmentMap->GetColor(Directions[SampleIndex]) * BRDFValues[SampleIndex] * Weight / EnvironmentPDFs[SampleIndex];
+        NumGenerated++;
+    }
+    return NumGenerated;
+}
+
+void RTRenderer::ShadeWavefrontHit(RTScene *pScene, RTGeometry *pGeometry, const RTHitAttributes &HitAttributes, float ConeWidth, UINT Depth, UINT RayIndex, const RTRayQueue &Rays, RTWavefrontQueues &Queues, RTRayQueue &NextRays)
+{
+    const glm::vec3 ViewVector = -Rays.m_Directions[RayIndex];
+    const glm::vec3 &Weight = Rays.m_Weights[RayIndex];
+    const float Contribution = Rays.m_Contributions[RayIndex];
+
+    glm::vec3 matColor = HitAttributes.m_Color;
+    float reflectivity = pGeometry->GetRTMaterial()->GetReflectivity();
+    float Roughness = pGeometry->GetRTMaterial()->GetRoughness();
+    glm::vec3 Norm = HitAttributes.m_Normal;
+    glm::vec3 intersectPos = HitAttributes.m_Position;
+
+    const UINT HitIndex = (UINT)Queues.m_HitRecords.size();
+    RTWavefrontHitRecord HitRecord(Rays.m_PixelIndices[RayIndex], Weight);
 
-        if (bGetReflectionFromEnvironmentMap)
+    for (RTLight *pLight : pScene->GetLightList())
+    {
+        glm::vec3 LightColor = pLight->GetLightColor(intersectPos);
+        glm::vec3 LightDirection = pLight->GetLightDirection(intersectPos);
+
+        float nDotL = glm::dot(Norm, LightDirection);
+        if (nDotL > 0.0f)
         {
             float fresnel;
-            float BRDFValue = CookTorrance().BRDF(ViewVector, Norm, ReflectionVector, Roughness, reflectivity, fresnel);
-            ReflectionColor = pScene->GetEnvironmentMap()->GetColor(ReflectionVector);
-            ReflectionColor *= BRDFValue;
-            TotalFresnel += fresnel;
-            NumSamplesTaken++;
+            const float BRDFValue = CookTorrance().BRDF(ViewVector, Norm, LightDirection, Roughness, reflectivity, fresnel);
+            Queues.m_ShadowRays.Push(
+                intersectPos + LightDirection * .001f,
+                LightDirection,
+                matColor * LightColor * nDotL,
+                LightColor * BRDFValue,
+                fresnel,
+                HitIndex);
+            HitRecord.m_NumSamplesTaken++;
         }
-        else
-        {
-            if (m_bEnableMultiRayEmission && RecursionInfo.m_NumRecursions < 2)
-            {
-                glm::vec3 Colors[RAYS_PER_INTERSECT_BATCH];
-                float BRDFValues[RAYS_PER_INTERSECT_BATCH];
-                glm::vec3 ReflectionVectors[RAYS_PER_INTERSECT_BATCH];
-                glm::vec3 ReflectionOrigins[RAYS_PER_INTERSECT_BATCH];
-                const UINT NumBatches = (RAYS_PER_INTERSECT_BATCH - 1) / RAY_EMISSION_COUNT + 1;
+    }
 
-                RTCosineWeightedRayGenerator CosineWeightedRayGenerator(ReflectionVector);
-                RTRayGenerator *pRayGenerator = &CosineWeightedRayGenerator;
+    glm::vec3 ReflOrigin = intersectPos + Norm * LARGE_EPSILON; //Offset a small amount to avoid self-intersection
+    glm::vec3 ReflectionVector = glm::reflect(-ViewVector, Norm);
 
-                std::fill(ReflectionOrigins, ReflectionOrigins + RAYS_PER_INTERSECT_BATCH, ReflOrigin);
-                        
-                UINT NumRaysBatched = 0;
-                for (UINT RayIndex = 0; RayIndex < RAY_EMISSION_COUNT; RayIndex++)
-                {
-                    // Make sure the reflection vector is tested
-                    ReflectionVectors[NumRaysBatched] = (RayIndex == 0) ? ReflectionVector : pRayGenerator->GenerateRay();
-                    float fresnel;
-                    const float BRDFValue = CookTorrance().BRDF(ViewVector, Norm, ReflectionVectors[NumRaysBatched], Roughness, reflectivity, fresnel);
-                    if (RecursionInfo.m_TotalContribution * BRDFValue > MEDIUM_EPSILON)
-                    {
-                        BRDFValues[NumRaysBatched] = BRDFValue;
-                        NumRaysBatched++;
-                        if (NumRaysBatched == RAYS_PER_INTERSECT_BATCH || RayIndex == RAY_EMISSION_COUNT - 1)
-                        {
-                            NumRaysBatched = TruncateToCompatibleEmbreeCompatible(NumRaysBatched);
-                            Trace(pScene, ReflectionOrigins, ReflectionVectors, Colors, NumRaysBatched, ShadePixelRecursionInfo(RecursionInfo.m_NumRecursions + 1, RecursionInfo.m_TotalContribution * BRDFValue));
-                            for (UINT ColorIndex = 0; ColorIndex < NumRaysBatched; ColorIndex++)
-                            {
-                                ReflectionColor += Colors[ColorIndex] * BRDFValues[ColorIndex] / pRayGenerator->PDF(ReflectionVectors[ColorIndex]);
-                            }
-                            NumRaysBatched = 0;
-                        }
-                        TotalFresnel += fresnel;
-                        NumSamplesTaken++;
-                    }
-                }
-            }
-            else
-            {
-                float fresnel;
-                float BRDFValue = CookTorrance().BRDF(ViewVector, Norm, ReflectionVector, Roughness, reflectivity, fresnel);
-                if (RecursionInfo.m_TotalContribution * BRDFValue > MEDIUM_EPSILON)
-                {
-                    Trace(pScene, &ReflOrigin, &ReflectionVector, &ReflectionColor, 1, ShadePixelRecursionInfo(RecursionInfo.m_NumRecursions + 1, RecursionInfo.m_TotalContribution * BRDFValue));
-                }
-                NumSamplesTaken++;
-                ReflectionColor *= BRDFValue;
-                TotalFresnel += fresnel;
+    glm::vec3 ReflectionVectors[RAY_EMISSION_COUNT];
+    float ReflectionWeights[RAY_EMISSION_COUNT];
+    float ReflectionContributions[RAY_EMISSION_COUNT];
+    RTSampleID ReflectionSampleIDs[RAY_EMISSION_COUNT];
+    float ReflectionEnvironmentWeights[RAY_EMISSION_COUNT];
+    UINT NumReflectionRays = 0;
 
-            }
+    if (Depth >= MAX_RAY_RECURSION)
+    {
+        float fresnel;
+        float BRDFValue = CookTorrance().BRDF(ViewVector, Norm, ReflectionVector, Roughness, reflectivity, fresnel);
+        HitRecord.m_Specular += pScene->GetEnvironmentMap()->GetColor(ReflectionVector) * BRDFValue;
+        HitRecord.m_Fresnel += fresnel;
+        HitRecord.m_NumSamplesTaken++;
+    }
+    else if (m_bEnableMultiRayEmission && Depth < 2)
+    {
+        RTGGXRayGenerator GGXRayGenerator(ViewVector, Norm, Roughness);
+        RTCosineWeightedRayGenerator CosineWeightedRayGenerator(ReflectionVector);
+        RTRayGenerator *pRayGenerator = m_bEnableGGXImportanceSampling ? (RTRayGenerator *)&GGXRayGenerator : &CosineWeightedRayGenerator;
+
+        RTEnvironmentMap *pEnvironmentMap = pScene->GetEnvironmentMap();
+        const bool bSampleEnvironment = m_bEnableEnvironmentMIS && !m_bForceMirrorRay;
+
+        // Generate every direction up front so the BRDF can be evaluated for all of them in one pass
+        const UINT NumSamples = min(m_NumGlossyRaysPerHit, (UINT)RAY_EMISSION_COUNT);
+        glm::vec3 SampleVectors[RAY_EMISSION_COUNT];
+        RTSampleID SampleIDs[RAY_EMISSION_COUNT];
+        float SampleX[RAY_EMISSION_COUNT], SampleY[RAY_EMISSION_COUNT], SampleZ[RAY_EMISSION_COUNT];
+        for (UINT SampleIndex = 0; SampleIndex < NumSamples; SampleIndex++)
+        {
+            SampleIDs[SampleIndex] = Rays.m_SampleIDs[RayIndex].GetChild(SampleIndex, m_NumGlossyRaysPerHit);
+
+            // Make sure the reflection vector is tested
+            SampleVectors[SampleIndex] = (m_bForceMirrorRay && SampleIndex == 0) ?
+                ReflectionVector :
+                pRayGenerator->GenerateRay(m_Sampler.Get2D(SampleIDs[SampleIndex], RT_SAMPLE_DIMENSION_REFLECTION(Depth)));
+            SampleX[SampleIndex] = SampleVectors[SampleIndex].x;
+            SampleY[SampleIndex] = SampleVectors[SampleIndex].y;
+            SampleZ[SampleIndex] = SampleVectors[SampleIndex].z;
         }
 
-        TotalSpecular += ReflectionColor;
+        float BRDFValues[RAY_EMISSION_COUNT], Fresnels[RAY_EMISSION_COUNT];
+        CookTorrance().BRDFBatch(ViewVector, Norm, SampleX, SampleY, SampleZ, Roughness, reflectivity, BRDFValues, Fresnels, NumSamples);
 
-        TotalFresnel /= NumSamplesTaken;
-        TotalSpecular /= NumSamplesTaken;
+        for (UINT SampleIndex = 0; SampleIndex < NumSamples; SampleIndex++)
+        {
+            // Every sample counts towards the average, rays culled here just contribute nothing
+            HitRecord.m_Fresnel += Fresnels[SampleIndex];
+            HitRecord.m_NumSamplesTaken++;
 
-        return glm::clamp(TotalDiffuse * (1.0f - TotalFresnel) + TotalSpecular, glm::vec3(0.0f), glm::vec3(1.0f));
+            const float BRDFValue = BRDFValues[SampleIndex];
+            const float SamplePDF = pRayGenerator->PDF(SampleVectors[SampleIndex]);
+            if (Contribution * BRDFValue > MEDIUM_EPSILON && SamplePDF > 0.0f)
+            {
+                ReflectionVectors[NumReflectionRays] = SampleVectors[SampleIndex];
+                ReflectionWeights[NumReflectionRays] = BRDFValue / SamplePDF;
+                ReflectionContributions[NumReflectionRays] = Contribution * BRDFValue;
+                ReflectionSampleIDs[NumReflectionRays] = SampleIDs[SampleIndex];
+                ReflectionEnvironmentWeights[NumReflectionRays] = bSampleEnvironment ? PowerHeuristic(SamplePDF, pEnvironmentMap->PDF(SampleVectors[SampleIndex])) : 1.0f;
+                NumReflectionRays++;
+            }
+        }
+
+        // Environment samples only need a visibility test, so they ride along with the shadow rays
+        if (bSampleEnvironment)
+        {
+            glm::vec3 EnvironmentDirections[RAY_EMISSION_COUNT];
+            glm::vec3 EnvironmentRadiance[RAY_EMISSION_COUNT];
+            const UINT NumEnvironmentRays = GenerateEnvironmentSamples(
+                pEnvironmentMap,
+                ViewVector,
+                Norm,
+                Roughness,
+                reflectivity,
+                *pRayGenerator,
+                SampleIDs,
+                Depth,
+                Contribution,
+                EnvironmentDirections,
+                EnvironmentRadiance,
+                NumSamples);
+            for (UINT EnvironmentRayIndex = 0; EnvironmentRayIndex < NumEnvironmentRays; EnvironmentRayIndex++)
+            {
+                Queues.m_ShadowRays.Push(ReflOrigin, EnvironmentDirections[EnvironmentRayIndex], glm::vec3(0.0f), EnvironmentRadiance[EnvironmentRayIndex], 0.0f, HitIndex);
+            }
+        }
     }
     else
     {
-        return pScene->GetEnvironmentMap()->GetColor(-ViewVector);
+        float fresnel;
+        float BRDFValue = CookTorrance().BRDF(ViewVector, Norm, ReflectionVector, Roughness, reflectivity, fresnel);
+        if (Contribution * BRDFValue > MEDIUM_EPSILON)
+        {
+            ReflectionVectors[NumReflectionRays] = ReflectionVector;
+            ReflectionWeights[NumReflectionRays] = BRDFValue;
+            ReflectionContributions[NumReflectionRays] = Contribution * BRDFValue;
+            ReflectionSampleIDs[NumReflectionRays] = Rays.m_SampleIDs[RayIndex];
+            ReflectionEnvironmentWeights[NumReflectionRays] = 1.0f;
+            NumReflectionRays++;
+        }
+        HitRecord.m_Fresnel += fresnel;
+        HitRecord.m_NumSamplesTaken++;
+    }
+
+    // Every sample is averaged by the total number of samples taken at this hit, 
+    // fold that into the weight of the reflected rays up front
+    for (UINT ReflectionIndex = 0; ReflectionIndex < NumReflectionRays; ReflectionIndex++)
+    {
+        NextRays.Push(
+            ReflOrigin,
+            ReflectionVectors[ReflectionIndex],
+            Weight * ReflectionWeights[ReflectionIndex] / (float)HitRecord.m_NumSamplesTaken,
+            ReflectionContributions[ReflectionIndex],
+            HitRecord.m_PixelIndex,
+            ReflectionSampleIDs[ReflectionIndex],
+            ConeWidth,
+            ReflectionEnvironmentWeights[ReflectionIndex]);
     }
+
+    Queues.m_HitRecords.push_back(HitRecord);
 }
 
 Geometry *RTRenderer::GetGeometryAtPixel(Camera *pCamera, Scene *pScene, Vec2 PixelCoord)
@@ -802,8 +2324,7 @@ Geometry *RTRenderer::GetGeometryAtPixel(Camera *pCamera, Scene *pScene, Vec2 Pi
 
     RayBatch batch(pRTScene->GetRTCScene(), &LensPoints, &RayDirections, 1);
 
-    unsigned int meshID = batch.GetGeometryID(0);
-    return  meshID == RTC_INVALID_GEOMETRY_ID ? nullptr : pRTScene->GetRTGeometry(meshID);;
+    return pRTScene->GetRTGeometry(batch.GetInstanceID(0), batch.GetGeometryID(0));
 }
 
 
@@ -813,10 +2334,59 @@ void RTRenderer::DrawScene(Camera *pCamera, Scene *pScene, const RenderSettings
     RTScene *pRTScene = RT_RENDERER_CAST<RTScene*>(pScene);
     RTCamera *pRTCamera = RT_RENDERER_CAST<RTCamera*>(pCamera);
 
-#if RT_AVOID_RENDERING_REDUNDANT_FRAMES
+    UINT Width = pRTCamera->GetWidth();
+    UINT Height = pRTCamera->GetHeight();
+
     // TODO: Also need to ensure the canvas hasn't changed
+    const bool bSceneChanged =
+        pRTScene != m_pLastScene ||
+        pRTCamera != m_pLastCamera ||
+        pRTScene->GetVersionID() != m_LastSceneID ||
+        pRTCamera->GetVersionID() != m_LastCameraVersionID ||
+        !(m_LastRenderSettings == RenderFlags);
+
+#if RT_PROGRESSIVE_ACCUMULATION
+    // Frames where nothing changed refine the previous result with another jittered
+    // sample per pixel. The first frame after a change is a cheap preview that only
+    // follows the mirror reflection and isn't kept in the accumulation buffer
+    if (bSceneChanged || m_AccumulationBuffer.size() != Width * Height)
+    {
+        m_AccumulatedFrameCount = 0;
+    }
+    else if (m_AccumulatedFrameCount >= RT_MAX_ACCUMULATED_FRAMES)
+    {
+        return;
+    }
+
+    const bool bPreviewFrame = m_AccumulatedFrameCount == 0;
+    if (bPreviewFrame)
+    {
+        m_AccumulationBuffer.assign(Width * Height, AccumulatedPixel());
+    }
+    m_NumGlossyRaysPerHit = bPreviewFrame ? 1 : RT_GLOSSY_RAYS_PER_FRAME;
+    m_bForceMirrorRay = bPreviewFrame;
+    m_bJitterPrimaryRays = !bPreviewFrame;
+    m_bAccumulateSamples = !bPreviewFrame;
+    m_SamplesPerActivePixel = 1;
+
+    if (m_bEnableAdaptiveSampling && !bPreviewFrame)
+    {
+        // Hand the samples that converged pixels no longer need to the ones that are still noisy
+        UINT NumActivePixels = 0;
+        for (const AccumulatedPixel &Pixel : m_AccumulationBuffer)
+        {
+            NumActivePixels += !Pixel.m_bConverged;
+        }
+        if (NumActivePixels == 0)
+        {
+            return;
+        }
+        m_SamplesPerActivePixel = min((UINT)m_AccumulationBuffer.size() / NumActivePixels, (UINT)RT_ADAPTIVE_MAX_SAMPLES_PER_FRAME);
+    }
+    m_AccumulatedFrameCount++;
+#else
     // If both the camera and scene haven't changed, don't re-render the scene
-    if (pRTScene->GetVersionID() == m_LastSceneID && pRTCamera->GetVersionID() == m_LastCameraVersionID && m_LastRenderSettings == RenderFlags)
+    if (!bSceneChanged)
     {
         return;
     }
@@ -825,76 +2395,95 @@ void RTRenderer::DrawScene(Camera *pCamera, Scene *pScene, const RenderSettings
     m_LastSceneID = pRTScene->GetVersionID();
     m_LastCameraVersionID = pRTCamera->GetVersionID();
     m_LastRenderSettings = RenderFlags;
+    m_Sampler.SetType(RenderFlags.m_SamplerType);
+    m_pLastScene = pRTScene;
+    m_pLastCamera = pRTCamera;
 
-    pRTScene->PreDraw();
-
-    UINT Width = pRTCamera->GetWidth();
-    UINT Height = pRTCamera->GetHeight();
+    const std::chrono::steady_clock::time_point FrameStartTime = std::chrono::steady_clock::now();
+    if (m_bCollectRenderStats)
+    {
+        m_RenderStats.BeginFrame();
+    }
 
-    const UINT THREAD_BLOCK_SIZE = 16;
+    pRTScene->PreDraw();
 
-    SYSTEM_INFO sysinfo;
-    GetSystemInfo(&sysinfo);
-    const UINT numWorkerThreads = sysinfo.dwNumberOfProcessors;
+    // Reflections are treated as flat mirrors, so secondary cones keep spreading at the pixel angle
+    m_ConeSpreadAngle = (pRTCamera->GetLensHeight() / Height) / glm::length(pRTCamera->GetLensPosition() - pRTCamera->GetFocalPoint());
 
-    if (m_pLastScene != pRTScene || pRTCamera != m_pLastCamera)
+    if (m_bRecordPixelCosts && (m_PixelCostWidth != Width || m_PixelCostHeight != Height))
     {
-        const UINT NumTasks = ceil(Height / (float)THREAD_BLOCK_SIZE) * ceil(Width / (float)THREAD_BLOCK_SIZE);
-        m_ThreadArgs.reserve(NumTasks);
-        for (UINT y = 0; y < Height; y += THREAD_BLOCK_SIZE)
+        m_PixelCosts.assign(Width * Height, PixelCost());
+        m_PixelCostWidth = Width;
+        m_PixelCostHeight = Height;
+    }
+
+    m_TileScheduler.Run(Width, Height, [=, &RenderFlags](PixelRange &Tile) {
+        if (m_bCollectRenderStats || m_bRecordPixelCosts)
         {
-            for (UINT x = 0; x < Width; x += THREAD_BLOCK_SIZE)
+            RTRayCounters TileCounters;
+            g_pThreadRayCounters = &TileCounters;
+            const UINT64 StartCycles = __rdtsc();
+            try
             {
-                m_ThreadArgs.push_back(RayTraceThreadArgs(
-                    this, 
-                    pRTScene, 
-                    pRTCamera, 
-                    RenderFlags,
-                    PixelRange(x, y, min(Width - x, THREAD_BLOCK_SIZE), min(Height - y, THREAD_BLOCK_SIZE)),
-                    &m_RunningThreadCounter,
-                    m_TracingFinishedEvent));
+                RenderPixelRange(&Tile, pRTCamera, pRTScene, RenderFlags);
             }
-        }
-        m_pLastScene = pRTScene;
-        m_pLastCamera = pRTCamera;
-    }
-
-    m_RunningThreadCounter = m_ThreadArgs.size();
-    std::vector<RayTraceThreadArgs *> ThreadArgs;
-    std::vector<HANDLE>  hThreadArray;
+            catch (...)
+            {
+                // The scheduler passes the exception on to DrawScene's caller, don't leave the counters dangling
+                g_pThreadRayCounters = nullptr;
+                throw;
+            }
+            const UINT64 TileCycles = __rdtsc() - StartCycles;
+            g_pThreadRayCounters = nullptr;
 
-    auto RenderPixelBatch = [](PTP_CALLBACK_INSTANCE, PVOID pThreadData, PTP_WORK) -> void {
-        RayTraceThreadArgs *pArgs = (RayTraceThreadArgs *)pThreadData;
-        pArgs->m_pRenderer->RenderPixelRange(
-            &pArgs->m_PixelRange,
-            pArgs->m_pCamera,
-            pArgs->m_pScene,
-            pArgs->m_RenderFlags);
-        if (InterlockedDecrement(pArgs->m_pOngoingThreadCounter) == 0)
+            if (m_bCollectRenderStats)
+            {
+                m_RenderStats.AddRayCounters(TileCounters);
+            }
+            if (m_bRecordPixelCosts)
+            {
+                RecordTileCost(Tile, TileCycles, TileCounters);
+            }
+        }
+        else
         {
-            SetEvent(pArgs->m_TracingFinishedEvent);
+            RenderPixelRange(&Tile, pRTCamera, pRTScene, RenderFlags);
         }
-    };
+    });
 
-#if RT_MULTITHREAD
-    ResetEvent(m_TracingFinishedEvent);
-    for (auto &args : m_ThreadArgs)
+    if (m_bCollectRenderStats)
     {
-        PTP_WORK work = CreateThreadpoolWork(RenderPixelBatch, &args, nullptr);
-        SubmitThreadpoolWork(work);
+        m_RenderStats.SetSceneCommitTime(pRTScene->GetLastCommitTime());
+        m_RenderStats.EndFrame(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - FrameStartTime).count(), m_TileScheduler);
+        m_RenderStats.WriteJSON(m_RenderStatsFile);
+        m_RenderStatsFile.flush();
     }
-    WaitForSingleObject(m_TracingFinishedEvent, INFINITE);
-    CloseThreadpoolCleanupGroupMembers(m_ThreadPoolCleanupGroup, true, nullptr);
-#else
-    RenderPixelBatch(&RayTraceThreadArgs(this, pRTScene, pRTCamera, PixelRange(0, 0, Width, Height)));
-#endif
 }
 
-RTGeometry::RTGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor)
+RTGeometry::RTGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor) :
+    m_pPrototype(nullptr),
+    m_prototypeScene(nullptr),
+    m_bTransformed(false),
+    m_bTransformLocked(false),
+    m_TransformVersion(0),
+    m_Transform(1.0f),
+    m_WorldToObjectDirection(1.0f)
 {
     m_pMaterial = RT_RENDERER_CAST<RTMaterial *>(pCreateGeometryDescriptor->m_pMaterial);
 
-    m_vertexData.reserve(pCreateGeometryDescriptor->m_NumVertices);
+    if (g_bCompressVertexAttributes)
+    {
+        m_PackedTexCoords.reserve(pCreateGeometryDescriptor->m_NumVertices);
+        m_PackedNormals.reserve(pCreateGeometryDescriptor->m_NumVertices);
+        m_PackedTangents.reserve(pCreateGeometryDescriptor->m_NumVertices);
+    }
+    else
+    {
+        m_TexCoords.reserve(pCreateGeometryDescriptor->m_NumVertices);
+        m_Normals.reserve(pCreateGeometryDescriptor->m_NumVertices);
+        m_Tangents.reserve(pCreateGeometryDescriptor->m_NumVertices);
+        m_Binormals.reserve(pCreateGeometryDescriptor->m_NumVertices);
+    }
     m_rtcVertexData.reserve(pCreateGeometryDescriptor->m_NumVertices);
     m_indexData.reserve(pCreateGeometryDescriptor->m_NumIndices);
 
@@ -909,7 +2498,7 @@ RTGeometry::RTGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor)
         {
             auto &vertex = pCreateGeometryDescriptor->m_pVertices[i];
 
-            m_vertexData.push_back(RendererVertexToRTVertex(vertex));
+            AddVertex(RendererVertexToRTVertex(vertex));
             m_rtcVertexData.push_back(RendererVertexToRTCVertex(vertex));
         }
     }
@@ -919,16 +2508,170 @@ RTGeometry::RTGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor)
         {
             auto &vertex = pCreateGeometryDescriptor->m_pVertices[i];
 
-            m_vertexData.push_back(RendererVertexToRTVertex(vertex));
+            AddVertex(RendererVertexToRTVertex(vertex));
             m_rtcVertexData.push_back(RendererVertexToRTCVertex(vertex));
 
             m_indexData.push_back(i);
         }
     }
+
+    ComputeTextureLODConstants();
+}
+
+RTGeometry::RTGeometry(_In_ RTGeometry *pPrototype) :
+    m_pMaterial(pPrototype->GetRTMaterial()),
+    m_pPrototype(pPrototype->GetPrototype()),
+    m_prototypeScene(nullptr),
+    m_bTransformed(pPrototype->IsTransformed()),
+    m_bTransformLocked(false),
+    m_TransformVersion(0),
+    m_Transform(pPrototype->GetTransform()),
+    m_WorldToObjectDirection(glm::transpose(glm::mat3(pPrototype->GetTransform())))
+{
+}
+
+// Octahedral unit vector encoding from Cigolle et al., "A Survey of Efficient Representations 
+// for Independent Unit Vectors" (JCGT, 2014), packed as 2x16-bit snorm
+UINT PackOctahedral(const glm::vec3 &Vector)
+{
+    glm::vec2 Octahedral = glm::vec2(Vector.x, Vector.y) / (fabsf(Vector.x) + fabsf(Vector.y) + fabsf(Vector.z));
+    if (Vector.z < 0.0f)
+    {
+        // Fold the lower hemisphere over the diagonals
+        Octahedral = glm::vec2(
+            (1.0f - fabsf(Octahedral.y)) * (Octahedral.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - fabsf(Octahedral.x)) * (Octahedral.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return glm::packSnorm2x16(Octahedral);
+}
+
+glm::vec3 UnpackOctahedral(UINT Packed)
+{
+    const glm::vec2 Octahedral = glm::unpackSnorm2x16(Packed);
+    glm::vec3 Vector(Octahedral.x, Octahedral.y, 1.0f - fabsf(Octahedral.x) - fabsf(Octahedral.y));
+    if (Vector.z < 0.0f)
+    {
+        Vector.x = (1.0f - fabsf(Octahedral.y)) * (Octahedral.x >= 0.0f ? 1.0f : -1.0f);
+        Vector.y = (1.0f - fabsf(Octahedral.x)) * (Octahedral.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(Vector);
+}
+
+void RTGeometry::AddVertex(const RTVertexData &Vertex)
+{
+    if (g_bCompressVertexAttributes)
+    {
+        m_PackedTexCoords.push_back(glm::packUnorm2x16(Vertex.m_tex));
+        m_PackedNormals.push_back(PackOctahedral(Vertex.m_norm));
+        m_PackedTangents.push_back(PackOctahedral(Vertex.m_tangent));
+    }
+    else
+    {
+        m_TexCoords.push_back(Vertex.m_tex);
+        m_Normals.push_back(Vertex.m_norm);
+        m_Tangents.push_back(Vertex.m_tangent);
+        m_Binormals.push_back(Vertex.m_binormal);
+    }
+}
+
+glm::vec2 RTGeometry::GetTexCoord(unsigned int VertexIndex) const
+{
+    return g_bCompressVertexAttributes ? glm::unpackUnorm2x16(m_PackedTexCoords[VertexIndex]) : m_TexCoords[VertexIndex];
+}
+
+glm::vec3 RTGeometry::GetVertexNormal(unsigned int VertexIndex) const
+{
+    return g_bCompressVertexAttributes ? UnpackOctahedral(m_PackedNormals[VertexIndex]) : m_Normals[VertexIndex];
+}
+
+void RTGeometry::GetVertexTangentFrame(unsigned int VertexIndex, const glm::vec3 &Normal, _Out_ glm::vec3 &Tangent, _Out_ glm::vec3 &Binormal) const
+{
+    if (g_bCompressVertexAttributes)
+    {
+        // RTVertexData always derives the binormal as tangent x normal, so there's no handedness to store
+        Tangent = UnpackOctahedral(m_PackedTangents[VertexIndex]);
+        Binormal = glm::normalize(glm::cross(Tangent, Normal));
+    }
+    else
+    {
+        Tangent = m_Tangents[VertexIndex];
+        Binormal = m_Binormals[VertexIndex];
+    }
+}
+
+void RTGeometry::ComputeTextureLODConstants()
+{
+    m_TextureLODConstants.resize(GetNumTriangles());
+    for (UINT primID = 0; primID < GetNumTriangles(); primID++)
+    {
+        const unsigned int i0 = m_indexData[primID * 3];
+        const unsigned int i1 = m_indexData[primID * 3 + 1];
+        const unsigned int i2 = m_indexData[primID * 3 + 2];
+
+        const glm::vec3 p0 = RTCVertexToRendererVertex(m_rtcVertexData[i0]);
+        const float WorldArea = glm::length(glm::cross(
+            RTCVertexToRendererVertex(m_rtcVertexData[i1]) - p0, 
+            RTCVertexToRendererVertex(m_rtcVertexData[i2]) - p0));
+
+        const glm::vec2 uv0 = GetTexCoord(i0);
+        const glm::vec2 uv1 = GetTexCoord(i1) - uv0;
+        const glm::vec2 uv2 = GetTexCoord(i2) - uv0;
+        const float TextureArea = fabsf(uv1.x * uv2.y - uv2.x * uv1.y);
+
+        // Degenerate triangles fall back to the base level
+        m_TextureLODConstants[primID] = (WorldArea > 0.0f && TextureArea > 0.0f) ? 0.5f * log2f(TextureArea / WorldArea) : -FLT_MAX;
+    }
 }
 
 RTGeometry::~RTGeometry()
 {
+    if (m_prototypeScene)
+    {
+        rtcDeleteScene(m_prototypeScene);
+    }
+}
+
+RTCScene RTGeometry::GetPrototypeScene(RTCDevice Device)
+{
+    if (IsInstance())
+    {
+        return m_pPrototype->GetPrototypeScene(Device);
+    }
+
+    if (!m_prototypeScene)
+    {
+        m_prototypeScene = rtcDeviceNewScene(Device, cSceneFlags, RTC_INTERSECT1 | RTC_INTERSECT4 | RTC_INTERSECT8 | RTC_INTERSECT16);
+        UINT triangleMesh = rtcNewTriangleMesh(m_prototypeScene, cGeometryFlag, GetNumTriangles(), GetNumVertices());
+        rtcSetBuffer(m_prototypeScene, triangleMesh, RTC_VERTEX_BUFFER, GetVertexData(), 0, sizeof(RTCVertex));
+        rtcSetBuffer(m_prototypeScene, triangleMesh, RTC_INDEX_BUFFER, GetIndexBufferData(), 0, 3 * sizeof(unsigned int));
+        rtcCommit(m_prototypeScene);
+    }
+    return m_prototypeScene;
+}
+
+void RTGeometry::Translate(_In_ const Vec3 &translationVector)
+{
+    UpdateTransform(glm::translate(RealArrayToGlmVec3(translationVector)) * m_Transform);
+}
+
+void RTGeometry::Rotate(float row, float yaw, float pitch)
+{
+    // Spins the geometry about its own origin, any translation already applied is kept
+    const glm::mat4 Rotation = glm::rotate(yaw, glm::vec3(0, 1, 0)) * glm::rotate(pitch, glm::vec3(1, 0, 0)) * glm::rotate(row, glm::vec3(0, 0, 1));
+    UpdateTransform(m_Transform * Rotation);
+}
+
+void RTGeometry::UpdateTransform(const glm::mat4 &Transform)
+{
+    FAIL_CHK(m_bTransformLocked, "Geometry in a static scene can't be moved, create the scene as dynamic");
+
+    m_Transform = Transform;
+    m_bTransformed = true;
+    m_TransformVersion++;
+
+    // The inverse of a rotation is its transpose
+    m_WorldToObjectDirection = glm::transpose(glm::mat3(m_Transform));
+    NotifyChanged();
 }
 
 RTDirectionalLight::RTDirectionalLight(_In_ CreateLightDescriptor *pCreateLightDescriptor)
@@ -939,16 +2682,26 @@ RTDirectionalLight::RTDirectionalLight(_In_ CreateLightDescriptor *pCreateLightD
     m_Color = RealArrayToGlmVec3(pCreateLightDescriptor->m_Color);
 }
 
+glm::vec3 RTEnvironmentMap::Sample(const glm::vec2 &Sample, float &PDF)
+{
+    return UniformSampleSphere(Sample, PDF);
+}
+
+float RTEnvironmentMap::PDF(const glm::vec3 &Direction)
+{
+    return 1.0f / (4.0f * (float)M_PI);
+}
+
 RTEnvironmentColor::RTEnvironmentColor(CreateEnvironmentColor *pCreateEnvironmentColor) :
     m_Color(RealArrayToGlmVec3(pCreateEnvironmentColor->m_Color)) {}
 
 RTEnvironmentTextureCube::RTEnvironmentTextureCube(CreateEnvironmentTextureCube *pCreateEnvironmentTextureCube)
 {
     std::string texture0Name(pCreateEnvironmentTextureCube->m_TextureNames[0]);
-    if (texture0Name.substr(texture0Name.size() - 3, 3).compare("hdr"))
+    if (texture0Name.size() >= 3 && texture0Name.compare(texture0Name.size() - 3, 3, "hdr") == 0)
     {
         m_pTextureCube = std::unique_ptr<SphereciallySamplableTexture>(
-            new RTTexturePanorama(pCreateEnvironmentTextureCube->m_TextureNames[0], false));
+            new RTTexturePanorama(pCreateEnvironmentTextureCube->m_TextureNames[0], false, RT_IMAGE_FORMAT_RGB16F));
     }
     else
     {
@@ -957,41 +2710,154 @@ RTEnvironmentTextureCube::RTEnvironmentTextureCube(CreateEnvironmentTextureCube
     }
 }
 
-RTScene::RTScene(RTCDevice device, RTEnvironmentMap *pEnvironmentMap) :
+RTScene::RTScene(RTCDevice device, RTEnvironmentMap *pEnvironmentMap, bool bDynamic) :
+    m_bDynamic(bDynamic),
     m_bSceneCommitted(false),
-    m_pEnvironmentMap(pEnvironmentMap)
+    m_bFlatSceneCommitted(false),
+    m_LastCommitMilliseconds(0.0),
+    m_device(device),
+    m_pEnvironmentMap(pEnvironmentMap),
+    m_flatSceneInstanceID(RTC_INVALID_GEOMETRY_ID),
+    m_NumFlatMeshes(0)
 {
-    m_scene = rtcDeviceNewScene(device, cSceneFlags, RTC_INTERSECT1 | RTC_INTERSECT4 | RTC_INTERSECT8 | RTC_INTERSECT16);
+    const RTCSceneFlags SceneFlags = m_bDynamic ? RTC_SCENE_DYNAMIC : cSceneFlags;
+    const RTCAlgorithmFlags AlgorithmFlags = RTC_INTERSECT1 | RTC_INTERSECT4 | RTC_INTERSECT8 | RTC_INTERSECT16;
+    m_scene = rtcDeviceNewScene(device, SceneFlags, AlgorithmFlags);
+    m_flatScene = rtcDeviceNewScene(device, SceneFlags, AlgorithmFlags);
+    m_traceScene = m_flatScene;
 }
 
 RTScene::~RTScene()
 {
     rtcDeleteScene(m_scene);
+    rtcDeleteScene(m_flatScene);
+}
+
+RTGeometry *RTScene::GetRTGeometry(unsigned int instanceID, unsigned int meshID)
+{
+    if (meshID == RTC_INVALID_GEOMETRY_ID) return nullptr;
+
+    // Embree leaves instID untouched for hits outside of instances, which only happen when
+    // m_flatScene is traced directly
+    if (instanceID != RTC_INVALID_GEOMETRY_ID && instanceID != m_flatSceneInstanceID)
+    {
+        return m_instanceIDToRTGeometry[instanceID];
+    }
+    return m_meshIDToRTGeometry[meshID];
 }
 
 void RTScene::PreDraw()
 {
+    const std::chrono::steady_clock::time_point StartTime = std::chrono::steady_clock::now();
+    m_LastCommitMilliseconds = 0.0;
+
+    if (m_bDynamic)
+    {
+        for (SceneGeometry &Entry : m_SceneGeometries)
+        {
+            if (Entry.m_TransformVersion == Entry.m_pGeometry->GetTransformVersion()) continue;
+
+            if (Entry.m_bInstanced)
+            {
+                rtcSetTransform(m_scene, Entry.m_GeometryID, RTC_MATRIX_COLUMN_MAJOR_ALIGNED16, &Entry.m_pGeometry->GetTransform()[0][0]);
+                rtcUpdate(m_scene, Entry.m_GeometryID);
+            }
+            else
+            {
+                // The mesh was flattened into m_flatScene, from its first move on it's referenced as
+                // an instance so later moves only touch the transform. Leaving m_flatScene means the
+                // top level is all instances from here on, which keeps instID unambiguous
+                rtcDeleteGeometry(m_flatScene, Entry.m_GeometryID);
+                m_meshIDToRTGeometry.erase(Entry.m_GeometryID);
+                m_NumFlatMeshes--;
+                m_bFlatSceneCommitted = false;
+
+                Entry.m_GeometryID = AddInstance(Entry.m_pGeometry);
+                Entry.m_bInstanced = true;
+            }
+            Entry.m_TransformVersion = Entry.m_pGeometry->GetTransformVersion();
+            m_bSceneCommitted = false;
+        }
+    }
+
     if (!m_bSceneCommitted)
     {
-        rtcCommit(m_scene);
+        // Only rebuild the flattened meshes' BVH when one was added or moved out
+        const bool bFlatSceneChanged = !m_bFlatSceneCommitted;
+        if (bFlatSceneChanged)
+        {
+            rtcCommit(m_flatScene);
+            m_bFlatSceneCommitted = true;
+        }
+
+        if (!m_instanceIDToRTGeometry.empty())
+        {
+            if (m_flatSceneInstanceID == RTC_INVALID_GEOMETRY_ID && m_NumFlatMeshes > 0)
+            {
+                // rtcNewInstance starts out with an identity transform
+                m_flatSceneInstanceID = rtcNewInstance(m_scene, m_flatScene);
+            }
+            else if (m_flatSceneInstanceID != RTC_INVALID_GEOMETRY_ID && bFlatSceneChanged)
+            {
+                // The instance's bounds have to follow the flat scene's
+                rtcUpdate(m_scene, m_flatSceneInstanceID);
+            }
+            rtcCommit(m_scene);
+            m_traceScene = m_scene;
+        }
         m_bSceneCommitted = true;
+
+        // Includes updating moved instances and building the BVH of any newly instanced prototype
+        m_LastCommitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
     }
 }
 
+UINT RTScene::AddInstance(_In_ RTGeometry *pRTGeometry)
+{
+    // The prototype's BVH is built once and shared, the scene only stores a transform for it
+    UINT geometryID = rtcNewInstance(m_scene, pRTGeometry->GetPrototypeScene(m_device));
+    rtcSetTransform(m_scene, geometryID, RTC_MATRIX_COLUMN_MAJOR_ALIGNED16, &pRTGeometry->GetTransform()[0][0]);
+
+    m_instanceIDToRTGeometry[geometryID] = pRTGeometry;
+    return geometryID;
+}
+
 void RTScene::AddGeometry(_In_ Geometry *pGeometry)
 {
     RTGeometry *pRTGeometry = RT_RENDERER_CAST<RTGeometry*>(pGeometry);
-    UINT triangleMesh = rtcNewTriangleMesh(m_scene, cGeometryFlag, pRTGeometry->GetNumTriangles(), pRTGeometry->GetNumVertices());
 
-    RTCVertex*pVertexBuffer = (RTCVertex*)rtcMapBuffer(m_scene, triangleMesh, RTC_VERTEX_BUFFER);
-    memcpy(pVertexBuffer, pRTGeometry->GetVertexData(), pRTGeometry->GetVertexDataSize());
-    rtcUnmapBuffer(m_scene, triangleMesh, RTC_VERTEX_BUFFER);
+    SceneGeometry Entry;
+    Entry.m_pGeometry = pRTGeometry;
+    Entry.m_TransformVersion = pRTGeometry->GetTransformVersion();
+    Entry.m_bInstanced = pRTGeometry->IsInstance() || pRTGeometry->IsTransformed();
+    if (Entry.m_bInstanced)
+    {
+        Entry.m_GeometryID = AddInstance(pRTGeometry);
+    }
+    else
+    {
+        Entry.m_GeometryID = rtcNewTriangleMesh(m_flatScene, cGeometryFlag, pRTGeometry->GetNumTriangles(), pRTGeometry->GetNumVertices());
+
+        // Embree reads the geometry's own buffers rather than keeping a copy, so the geometry has to 
+        // outlive the scene. RTCVertex's padding covers the 4 readable bytes Embree needs past the last vertex
+        rtcSetBuffer(m_flatScene, Entry.m_GeometryID, RTC_VERTEX_BUFFER, pRTGeometry->GetVertexData(), 0, sizeof(RTCVertex));
+        rtcSetBuffer(m_flatScene, Entry.m_GeometryID, RTC_INDEX_BUFFER, pRTGeometry->GetIndexBufferData(), 0, 3 * sizeof(unsigned int));
+        m_meshIDToRTGeometry[Entry.m_GeometryID] = pRTGeometry;
+        m_NumFlatMeshes++;
+    }
+    m_SceneGeometries.push_back(Entry);
 
-    unsigned int*pIndexBuffer = (unsigned int*)rtcMapBuffer(m_scene, triangleMesh, RTC_INDEX_BUFFER);
-    memcpy(pIndexBuffer, pRTGeometry->GetIndexBufferData(), pRTGeometry->GetIndexBufferDataSize());
-    rtcUnmapBuffer(m_scene, triangleMesh, RTC_INDEX_BUFFER);
-    
-    m_meshIDToRTGeometry[triangleMesh] = pRTGeometry;
+    // Static scenes are committed once, geometry added afterwards isn't picked up
+    if (m_bDynamic)
+    {
+        m_bSceneCommitted = false;
+        m_bFlatSceneCommitted = m_bFlatSceneCommitted && Entry.m_bInstanced;
+    }
+    else
+    {
+        // Otherwise shading would use the new transform while Embree still intersects the old triangles
+        pRTGeometry->LockTransform();
+    }
 
     pRTGeometry->RegisterObserver(this);
     pRTGeometry->GetRTMaterial()->RegisterObserver(this);
@@ -1007,76 +2873,109 @@ void RTScene::AddLight(_In_ Light *pLight)
     NotifyChanged();
 }
 
-glm::vec3 RTGeometry::GetColor(unsigned int primID, float alpha, float beta)
+void RTGeometry::Interpolate(
+    _In_reads_(NumHits) const unsigned int *pPrimIDs,
+    _In_reads_(NumHits) const glm::vec3 *pBaryocentricCoords,
+    _In_reads_(NumHits) const float *pConeWidths,
+    _In_reads_(NumHits) const glm::vec3 *pRayDirections,
+    _Out_writes_(NumHits) RTHitAttributes *pAttributes,
+    UINT NumHits)
 {
-    glm::vec2 uv = GetUV(primID, alpha, beta);
-    return m_pMaterial->GetColor(uv);
-}
+    if (!IsTransformed())
+    {
+        GetPrototype()->InterpolateInObjectSpace(pPrimIDs, pBaryocentricCoords, pConeWidths, pRayDirections, pAttributes, NumHits);
+        return;
+    }
 
-glm::vec2 RTGeometry::GetUV(unsigned int primID, float alpha, float beta)
-{
-    assert(m_indexData.size() > primID * 3 + 2);
-    unsigned int i0 = m_indexData[primID * 3];
-    unsigned int i1 = m_indexData[primID * 3 + 1];
-    unsigned int i2 = m_indexData[primID * 3 + 2];
+    // Shade in the prototype's space and move the results out, the ray direction only 
+    // matters for its angle to the triangle so it's taken into the prototype's space instead
+    assert(NumHits <= RAYS_PER_INTERSECT_BATCH);
+    glm::vec3 ObjectRayDirections[RAYS_PER_INTERSECT_BATCH];
+    for (UINT HitIndex = 0; HitIndex < NumHits; HitIndex++)
+    {
+        ObjectRayDirections[HitIndex] = m_WorldToObjectDirection * pRayDirections[HitIndex];
+    }
 
-    assert(alpha + beta <= 1.0f);
-    float gamma = 1.0f - alpha - beta;
-    glm::vec2 uv = m_vertexData[i0].m_tex * gamma + m_vertexData[i1].m_tex * alpha + m_vertexData[i2].m_tex * beta;
+    GetPrototype()->InterpolateInObjectSpace(pPrimIDs, pBaryocentricCoords, pConeWidths, ObjectRayDirections, pAttributes, NumHits);
 
-    assert(uv.x <= 1.0 && uv.y <= 1.0);
-    return uv;
+    const glm::mat3 ObjectToWorldDirection(m_Transform);
+    for (UINT HitIndex = 0; HitIndex < NumHits; HitIndex++)
+    {
+        RTHitAttributes &Attributes = pAttributes[HitIndex];
+        Attributes.m_Position = glm::vec3(m_Transform * glm::vec4(Attributes.m_Position, 1.0f));
+        Attributes.m_Normal = ObjectToWorldDirection * Attributes.m_Normal;
+    }
 }
 
-glm::vec3 RTGeometry::GetPosition(unsigned int primID, float alpha, float beta)
+void RTGeometry::InterpolateInObjectSpace(
+    _In_reads_(NumHits) const unsigned int *pPrimIDs,
+    _In_reads_(NumHits) const glm::vec3 *pBaryocentricCoords,
+    _In_reads_(NumHits) const float *pConeWidths,
+    _In_reads_(NumHits) const glm::vec3 *pRayDirections,
+    _Out_writes_(NumHits) RTHitAttributes *pAttributes,
+    UINT NumHits)
 {
-    assert(m_indexData.size() > primID * 3 + 2);
-    unsigned int i0 = m_indexData[primID * 3];
-    unsigned int i1 = m_indexData[primID * 3 + 1];
-    unsigned int i2 = m_indexData[primID * 3 + 2];
+    const bool bHasNormalMap = GetRTMaterial()->HasNormalMap();
 
-    assert(alpha + beta <= 1.0f);
-    float gamma = 1.0f - alpha - beta;
-    return RTCVertexToRendererVertex(m_rtcVertexData[i0]) * gamma + 
-        RTCVertexToRendererVertex(m_rtcVertexData[i1]) * alpha + 
-        RTCVertexToRendererVertex(m_rtcVertexData[i2]) * beta;
+    unsigned int CachedPrimID = UINT_MAX;
+    glm::vec3 Positions[3], Normals[3], Tangents[3], Binormals[3];
+    glm::vec2 TexCoords[3];
+    glm::vec3 GeometricNormal;
+    for (UINT HitIndex = 0; HitIndex < NumHits; HitIndex++)
+    {
+        const unsigned int primID = pPrimIDs[HitIndex];
+        if (primID != CachedPrimID)
+        {
+            assert(m_indexData.size() > primID * 3 + 2);
+            for (UINT Corner = 0; Corner < 3; Corner++)
+            {
+                const unsigned int VertexIndex = m_indexData[primID * 3 + Corner];
+                Positions[Corner] = RTCVertexToRendererVertex(m_rtcVertexData[VertexIndex]);
+                TexCoords[Corner] = GetTexCoord(VertexIndex);
+                Normals[Corner] = GetVertexNormal(VertexIndex);
+                if (bHasNormalMap)
+                {
+                    GetVertexTangentFrame(VertexIndex, Normals[Corner], Tangents[Corner], Binormals[Corner]);
+                }
+            }
 
-}
+            const glm::vec3 Cross = glm::cross(Positions[1] - Positions[0], Positions[2] - Positions[0]);
+            GeometricNormal = Cross / max(glm::length(Cross), FLT_MIN);
+            CachedPrimID = primID;
+        }
 
-glm::vec3 RTGeometry::GetNormal(unsigned int primID, float alpha, float beta)
-{
-    assert(m_indexData.size() > primID * 3 + 2);
-    unsigned int i0 = m_indexData[primID * 3];
-    unsigned int i1 = m_indexData[primID * 3 + 1];
-    unsigned int i2 = m_indexData[primID * 3 + 2];
+        const float alpha = pBaryocentricCoords[HitIndex].x;
+        const float beta = pBaryocentricCoords[HitIndex].y;
+        assert(alpha + beta <= 1.0f);
+        const float gamma = 1.0f - alpha - beta;
 
-    assert(alpha + beta <= 1.0f);
-    float gamma = 1.0f - alpha - beta;
-    const glm::vec3 normal = glm::normalize(m_vertexData[i0].m_norm * gamma +
-        m_vertexData[i1].m_norm * alpha +
-        m_vertexData[i2].m_norm * beta);
+        RTHitAttributes &Attributes = pAttributes[HitIndex];
+        Attributes.m_Position = Positions[0] * gamma + Positions[1] * alpha + Positions[2] * beta;
+        Attributes.m_UV = TexCoords[0] * gamma + TexCoords[1] * alpha + TexCoords[2] * beta;
+        assert(Attributes.m_UV.x <= 1.0 && Attributes.m_UV.y <= 1.0);
 
-    if (GetRTMaterial()->HasNormalMap())
-    {
-        const glm::vec3 tangent = glm::normalize(m_vertexData[i0].m_tangent * gamma +
-            m_vertexData[i1].m_tangent * alpha +
-            m_vertexData[i2].m_tangent * beta);
+        const glm::vec3 normal = glm::normalize(Normals[0] * gamma + Normals[1] * alpha + Normals[2] * beta);
+        if (bHasNormalMap)
+        {
+            const glm::vec3 tangent = glm::normalize(Tangents[0] * gamma + Tangents[1] * alpha + Tangents[2] * beta);
+            const glm::vec3 binormal = glm::normalize(Binormals[0] * gamma + Binormals[1] * alpha + Binormals[2] * beta);
 
-        const glm::vec3 binormal = glm::normalize(m_vertexData[i0].m_binormal * gamma +
-            m_vertexData[i1].m_binormal * alpha +
-            m_vertexData[i2].m_binormal * beta);
+            glm::vec3 normalMapVector = GetRTMaterial()->GetNormal(Attributes.m_UV);
+            // TODO: Is this normalize necessary?
+            Attributes.m_Normal = glm::normalize(normalMapVector.x * tangent + normalMapVector.y * binormal + normalMapVector.z * normal);
+            assert(!isnan(Attributes.m_Normal.x) && !isnan(Attributes.m_Normal.y) && !isnan(Attributes.m_Normal.z));
+        }
+        else
+        {
+            Attributes.m_Normal = normal;
+        }
 
-        glm::vec3 normalMapVector = GetRTMaterial()->GetNormal(GetUV(primID, alpha, beta));
-        // TODO: Is this normalize necessary?
-        glm::vec3 result = glm::normalize(normalMapVector.x * tangent + normalMapVector.y * binormal + normalMapVector.z * normal);
-        assert(!isnan(result.x) && !isnan(result.y) && !isnan(result.z));
-        return result;
-    }
-    else
-    {
-        return normal;
+        // Ray cone texture LOD from Akenine-Moller et al., "Texture Level of Detail Strategies for 
+        // Real-Time Ray Tracing" (Ray Tracing Gems, 2019). Grazing angles stretch the footprint along the surface
+        const float CosTheta = fabsf(glm::dot(pRayDirections[HitIndex], GeometricNormal));
+        Attributes.m_TextureFootprint = m_TextureLODConstants[primID] + log2f(max(pConeWidths[HitIndex], FLT_MIN)) - log2f(max(CosTheta, EPSILON));
+        Attributes.m_Color = m_pMaterial->GetColor(Attributes.m_UV, Attributes.m_TextureFootprint);
     }
-
 }
 
 
@@ -1176,14 +3075,3 @@ void RTCamera::Rotate(float row, float yaw, float pitch)
     NotifyChanged();
 }
 
-float CookTorrance::BRDF(_In_ const glm::vec3 &ViewVector, _In_ const glm::vec3 &Normal, _In_ const glm::vec3 &IncomingRadianceVector, _In_ float Roughness, _In_ float BaseReflectivity, _Out_ float &FresnelFactor)
-{
-    glm::vec3 HalfwayVector = glm::normalize(ViewVector + IncomingRadianceVector);
-    float nDotL = saturate(glm::dot(Normal, IncomingRadianceVector));
-    float nDotV = saturate(glm::dot(Normal, ViewVector));
-
-    FresnelFactor = F(Normal, HalfwayVector, BaseReflectivity);
-    float Distribution = D(Normal, HalfwayVector, Roughness);
-    float GeometricAttenuation = G(ViewVector, Normal, IncomingRadianceVector, Roughness);
-    return FresnelFactor * Distribution * GeometricAttenuation / (4.0 * nDotL * nDotV);
-}
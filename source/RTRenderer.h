@@ -1,4 +1,10 @@
 #include "Renderer.h"
+#include "RTTileScheduler.h"
+#include "RTSampler.h"
+#include "RTBRDF.h"
+#include "RTAliasTable.h"
+#include "RTTexturePageCache.h"
+#include "RTRenderStats.h"
 
 #include "glm/vec3.hpp"
 #include "glm/vec2.hpp"
@@ -9,8 +15,12 @@
 #include "embree/inc/rtcore_ray.h"
 
 #include <unordered_map>
+#include <string>
+#include <mutex>
+#include <future>
 #include <memory>
 #include <algorithm>
+#include <fstream>
 #include <windows.h>
 #include <minmax.h>
 
@@ -25,13 +35,25 @@
 #define RAY_EMISSION_COUNT 128
 #define RAYS_PER_INTERSECT_BATCH 16
 #define RT_MULTITHREAD 1
-#define RT_AVOID_RENDERING_REDUNDANT_FRAMES 1
+#define RT_PROGRESSIVE_ACCUMULATION 1
+#define RT_GLOSSY_RAYS_PER_FRAME 4
+#define RT_MAX_ACCUMULATED_FRAMES 1024
+#define RT_ADAPTIVE_MIN_SAMPLES 8
+#define RT_ADAPTIVE_MAX_SAMPLES_PER_FRAME 8
+#define RT_ADAPTIVE_ERROR_THRESHOLD 0.02f
+
+// Sampler dimensions, the primary ray jitter uses the first pair and every bounce
+// the two pairs after, one for the reflection ray and one for the environment sample
+#define RT_SAMPLE_DIMENSION_PIXEL 0
+#define RT_SAMPLE_DIMENSION_REFLECTION(Depth) (4 * (Depth) - 2)
+#define RT_SAMPLE_DIMENSION_ENVIRONMENT(Depth) (4 * (Depth))
 
 
 class VersionedObject
 {
 public:
     typedef UINT VersionID;
+    VersionedObject() : m_VersionID(0) {}
     VersionID GetVersionID() { return m_VersionID; }
     void NotifyChanged() 
     {
@@ -84,7 +106,8 @@ private:
 class RTRayGenerator
 {
 public:
-    virtual glm::vec3 GenerateRay() = 0;
+    // Maps a uniformly distributed point in [0,1)^2 to a direction
+    virtual glm::vec3 GenerateRay(const glm::vec2 &Sample) = 0;
     virtual float PDF(const glm::vec3 &vector) = 0;
 };
 
@@ -92,42 +115,152 @@ class RTCosineWeightedRayGenerator : public RTRayGenerator
 {
 public:
     RTCosineWeightedRayGenerator(glm::vec3 normal) : m_normal(normal) {}
-    glm::vec3 GenerateRay();
+    glm::vec3 GenerateRay(const glm::vec2 &Sample);
     float PDF(const glm::vec3 &vector);
 private:
     glm::vec3 m_normal;
 };
 
+// Samples reflection directions proportional to the GGX distribution of normals
+// visible from the view vector (Heitz, "Sampling the GGX Distribution of Visible
+// Normals", JCGT 2018). Matches Distribution_GGX, i.e. alpha is the roughness
+class RTGGXRayGenerator : public RTRayGenerator
+{
+public:
+    RTGGXRayGenerator(const glm::vec3 &ViewVector, const glm::vec3 &Normal, float Roughness);
+    glm::vec3 GenerateRay(const glm::vec2 &Sample);
+    float PDF(const glm::vec3 &vector);
+private:
+    glm::vec3 m_ViewVector;
+    glm::vec3 m_Normal;
+    glm::vec3 m_Tangent;
+    glm::vec3 m_Bitangent;
+    float m_Alpha;
+};
+
+// Storage format of an RTImage's texels, float formats keep the full range of .hdr files
+enum RTImageFormat
+{
+    RT_IMAGE_FORMAT_RGB8,
+    RT_IMAGE_FORMAT_RGB16F,
+    RT_IMAGE_FORMAT_RGB32F
+};
+
 class RTImage
 {
 public:
     RTImage();
-    RTImage(const char *TextureName, bool IsSRGBFormat);
-    glm::vec3 Sample(glm::vec2 uv);
-    bool HasValidTexture() { return m_pImage != nullptr; }
+    RTImage(const char *TextureName, bool IsSRGBFormat, RTImageFormat Format = RT_IMAGE_FORMAT_RGB8);
+    ~RTImage();
+    glm::vec3 Sample(glm::vec2 uv) const;
+
+    // Trilinear lookup from the mip chain, Footprint is log2 of the lookup's width in 
+    // texture space as if the texture were 1x1 (see RTGeometry::GetTextureFootprint)
+    glm::vec3 Sample(glm::vec2 uv, float Footprint) const;
+    glm::vec3 GetTexel(int x, int y, UINT Level = 0) const;
+    bool HasValidTexture() const { return !m_MipLevels.empty(); }
+    int GetWidth() const { return m_Width; }
+    int GetHeight() const { return m_Height; }
 private:
+    struct MipLevel
+    {
+        int m_Width, m_Height;
+
+        // 0 while the texels are still row-major, see TileMipLevels
+        int m_TilesPerRow;
+
+        // Empty for paged images, the texels are read from m_FileOffset in the cache file on demand
+        std::vector<unsigned char> m_Texels;
+        UINT64 m_FileOffset;
+        UINT m_NumTexelBytes;
+    };
+
+    // The cache file a paged image reads its pages from
+    struct PageFile;
+
+    // With bAllowPaging large images only read the level headers and leave the texels in the file
+    bool LoadFromCache(const std::string &CachePath, UINT64 CacheKey, bool bAllowPaging);
+    void SaveToCache(const std::string &CachePath, UINT64 CacheKey);
+    void EncodeTexel(const glm::vec3 &Color, _Out_ unsigned char *pTexel);
+    glm::vec3 DecodeTexel(_In_ const unsigned char *pTexel) const;
+    void GenerateMipChain();
+    void TileMipLevels();
+    UINT GetTexelOffset(const MipLevel &Mip, int x, int y) const;
+    const unsigned char *GetTexelData(UINT Level, UINT Offset) const;
+    RTTexturePage LoadPage(UINT Level, UINT PageIndex) const;
+    glm::vec3 SampleBilinear(UINT Level, glm::vec2 uv) const;
 
     int m_Width, m_Height;
     int m_ComponentCount = 3;
-    unsigned char* m_pImage;
-    static const unsigned int cSizeofComponent = sizeof(unsigned char);
+    RTImageFormat m_Format;
+
+    // Size of a packed texel in row-major levels
+    int m_BytesPerTexel;
+
+    // Bytes between texels, tiled levels pad texels to a power of 2 so a texel never straddles a cache line
+    int m_TexelStride;
+    std::vector<MipLevel> m_MipLevels;
+
+    // Only set when the texels are paged in through RTTexturePageCache
+    std::unique_ptr<PageFile> m_pPageFile;
+    UINT m_ImageID;
+    UINT m_PageSize;
+
+    // Tiles are cTileSize x cTileSize texels with the texels inside a tile in Morton order, so for 
+    // RGB8 each 4x4 block (and so every bilinear footprint that doesn't cross a block) is one 64 byte line
+    static const int cTileSizeLog2 = 3;
+    static const int cTileSize = 1 << cTileSizeLog2;
+
+    // Pages are runs of whole tiles so a texel never straddles two pages
+    static const UINT cTilesPerPage = 64;
+};
+
+// Process-wide cache of decoded images. Everything that asks for the same file with the same
+// decode options shares one immutable RTImage, which is freed once the last handle is released
+class RTImageCache
+{
+public:
+    static std::shared_ptr<const RTImage> GetImage(const char *TextureName, bool IsSRGBFormat, RTImageFormat Format = RT_IMAGE_FORMAT_RGB8);
+private:
+    typedef std::shared_future<std::shared_ptr<const RTImage>> PendingImage;
+
+    struct CachedImage
+    {
+        std::weak_ptr<const RTImage> m_pImage;
+        // Valid while the image is being decoded, later requests wait on it instead of decoding it again
+        PendingImage m_PendingImage;
+    };
+
+    static std::mutex s_Lock;
+    static std::unordered_map<std::string, CachedImage> s_Images;
 };
 
 class SphereciallySamplableTexture
 {
 public:
     virtual glm::vec3 Sample(glm::vec3 dir) = 0;
+
+    // Picks a direction to gather light from, the default distributes directions uniformly over the sphere
+    virtual glm::vec3 SampleDirection(const glm::vec2 &Sample, float &PDF);
+    virtual float DirectionPDF(const glm::vec3 &Direction);
 };
 
 class RTTexturePanorama : public SphereciallySamplableTexture
 {
 public:
     RTTexturePanorama();
-    RTTexturePanorama(char *TextureNames, bool IsSRGBTexture);
+    RTTexturePanorama(char *TextureNames, bool IsSRGBTexture, RTImageFormat Format = RT_IMAGE_FORMAT_RGB8);
     glm::vec3 Sample(glm::vec3 dir);
-    bool HasValidTexture() { return m_pImage.HasValidTexture(); }
+    bool HasValidTexture() { return m_pImage && m_pImage->HasValidTexture(); }
+
+    // Importance samples the panorama by luminance
+    glm::vec3 SampleDirection(const glm::vec2 &Sample, float &PDF);
+    float DirectionPDF(const glm::vec3 &Direction);
 private:
-    RTImage m_pImage;
+    glm::vec2 DirectionToUV(const glm::vec3 &Direction);
+
+    std::shared_ptr<const RTImage> m_pImage;
+    RTDistribution2D m_LuminanceDistribution;
 };
 
 class RTTextureCube : public SphereciallySamplableTexture
@@ -136,10 +269,10 @@ public:
     RTTextureCube();
     RTTextureCube(char **TextureNames, bool IsSRGBTexture);
     glm::vec3 Sample(glm::vec3 dir);
-    bool HasValidTexture() { return m_pImages[0].HasValidTexture(); }
+    bool HasValidTexture() { return m_pImages[0] && m_pImages[0]->HasValidTexture(); }
 private:
     TextureFace GetTextureFace(glm::vec3 dir);
-    RTImage m_pImages[TEXTURES_PER_CUBE];
+    std::shared_ptr<const RTImage> m_pImages[TEXTURES_PER_CUBE];
 };
 
 class RTMaterial : public Material, public Observable
@@ -147,20 +280,20 @@ class RTMaterial : public Material, public Observable
 public:
     RTMaterial(CreateMaterialDescriptor *pCreateMaterialDescriptor);
 
-    glm::vec3 GetColor(glm::vec2 uv);
+    glm::vec3 GetColor(glm::vec2 uv, float Footprint);
     glm::vec3 GetNormal(glm::vec2 uv);
     float GetReflectivity() const { return m_Reflectivity; }
     float GetRoughness() const { return m_Roughness; }
 
     void SetRoughness(float Roughness) { m_Roughness = Roughness; NotifyChanged(); }
     void SetReflectivity(float Reflectivity) { m_Reflectivity = Reflectivity; NotifyChanged(); }
-    bool HasNormalMap() { return m_NormalMap.HasValidTexture(); }
+    bool HasNormalMap() { return m_pNormalMap->HasValidTexture(); }
 private:
     glm::vec3 m_Diffuse;
     float m_Reflectivity;
     float m_Roughness;
-    RTImage m_Image;
-    RTImage m_NormalMap;
+    std::shared_ptr<const RTImage> m_pImage;
+    std::shared_ptr<const RTImage> m_pNormalMap;
 };
 
 class RTRay
@@ -229,19 +362,46 @@ public:
     }
 };
 
+// Everything shading needs to know about a hit, see RTGeometry::Interpolate
+struct RTHitAttributes
+{
+    glm::vec3 m_Position;
+    glm::vec3 m_Normal; // Normal map already applied
+    glm::vec2 m_UV;
+    float m_TextureFootprint; // See RTImage::Sample
+    glm::vec3 m_Color;
+};
+
 class RTGeometry : public Geometry, public Observable
 {
 public:
     RTGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor);
+
+    // Instances share the prototype's vertices, material and Embree scene and only add a 
+    // transform. The prototype has to outlive every instance made from it
+    RTGeometry(_In_ RTGeometry *pPrototype);
     ~RTGeometry();
 
-    void Rotate(float row, float yaw, float pitch) { assert(false); }
-    void Translate(_In_ const Vec3 &translationVector) { assert(false); }
+    // Moving geometry that's already in a scene takes effect at the scene's next PreDraw. Embree
+    // can't move geometry in a static scene, so once added to one the transform is fixed and
+    // moving it throws
+    void Rotate(float row, float yaw, float pitch);
+    void Translate(_In_ const Vec3 &translationVector);
+
+    bool IsInstance() const { return m_pPrototype != nullptr; }
+    bool IsTransformed() const { return m_bTransformed; }
+    RTGeometry *GetPrototype() { return IsInstance() ? m_pPrototype : this; }
+    const glm::mat4 &GetTransform() const { return m_Transform; }
+    UINT GetTransformVersion() const { return m_TransformVersion; }
+    void LockTransform() { m_bTransformLocked = true; }
+
+    // Embree scene holding only this geometry's triangles, built on first use so instances can reference it
+    RTCScene GetPrototypeScene(RTCDevice Device);
 
     RTMaterial *GetRTMaterial() const { return m_pMaterial; }
     Material *GetMaterial() const { return GetRTMaterial(); }
 
-    unsigned int GetNumVertices() { return m_vertexData.size(); }
+    unsigned int GetNumVertices() { return m_rtcVertexData.size(); }
     unsigned int GetNumTriangles() { return m_indexData.size() / 3; }
 
     RTCVertex *GetVertexData() { return &m_rtcVertexData[0]; }
@@ -250,16 +410,63 @@ public:
     unsigned int *GetIndexBufferData() { return &m_indexData[0]; }
     size_t GetIndexBufferDataSize() { return sizeof(unsigned int)* m_indexData.size(); }
 
-    glm::vec3 GetColor(unsigned int primID, float alpha, float beta);
-    glm::vec2 GetUV(unsigned int primID, float alpha, float beta);
-    glm::vec3 GetPosition(unsigned int primID, float alpha, float beta);
-    glm::vec3 GetNormal(unsigned int primID, float alpha, float beta);
+    // Fills in the attributes of every hit, a triangle's vertices are only fetched again when the 
+    // primID changes so hits sorted by triangle share the work. ConeWidth is the width of the ray 
+    // cone where RayDirection hit the triangle, it selects the texture LOD
+    void Interpolate(
+        _In_reads_(NumHits) const unsigned int *pPrimIDs,
+        _In_reads_(NumHits) const glm::vec3 *pBaryocentricCoords,
+        _In_reads_(NumHits) const float *pConeWidths,
+        _In_reads_(NumHits) const glm::vec3 *pRayDirections,
+        _Out_writes_(NumHits) RTHitAttributes *pAttributes,
+        UINT NumHits);
 
 private:
-    std::vector<RTVertexData> m_vertexData;
+    void AddVertex(const RTVertexData &Vertex);
+    void ComputeTextureLODConstants();
+    void UpdateTransform(const glm::mat4 &Transform);
+
+    // Interpolate without the transform, everything stays in the space the vertices were given in
+    void InterpolateInObjectSpace(
+        _In_reads_(NumHits) const unsigned int *pPrimIDs,
+        _In_reads_(NumHits) const glm::vec3 *pBaryocentricCoords,
+        _In_reads_(NumHits) const float *pConeWidths,
+        _In_reads_(NumHits) const glm::vec3 *pRayDirections,
+        _Out_writes_(NumHits) RTHitAttributes *pAttributes,
+        UINT NumHits);
+
+    // Hide whether the vertex attributes are compressed
+    glm::vec2 GetTexCoord(unsigned int VertexIndex) const;
+    glm::vec3 GetVertexNormal(unsigned int VertexIndex) const;
+    void GetVertexTangentFrame(unsigned int VertexIndex, const glm::vec3 &Normal, _Out_ glm::vec3 &Tangent, _Out_ glm::vec3 &Binormal) const;
+
+    // Vertex attributes are kept in separate streams so a hit only pulls in what it uses
+    std::vector<glm::vec2> m_TexCoords;
+    std::vector<glm::vec3> m_Normals;
+    std::vector<glm::vec3> m_Tangents;
+    std::vector<glm::vec3> m_Binormals;
+
+    // Compressed streams used instead of the ones above with g_bCompressVertexAttributes. UVs are 
+    // 2x16-bit unorm, normals and tangents are 2x16-bit octahedral, binormals are rebuilt from them
+    std::vector<UINT> m_PackedTexCoords;
+    std::vector<UINT> m_PackedNormals;
+    std::vector<UINT> m_PackedTangents;
+    // Shared with Embree (see RTScene::AddGeometry), these must not be resized once the geometry is created
     std::vector<unsigned int> m_indexData;
     std::vector<RTCVertex> m_rtcVertexData;
+    std::vector<float> m_TextureLODConstants; // 0.5 * log2(uv area / world area) per triangle
     RTMaterial *m_pMaterial;
+
+    RTGeometry *m_pPrototype;
+    RTCScene m_prototypeScene;
+
+    // Object to world, only rotations and translations can be applied so the texture LOD
+    // constants and ray cone widths carry over unchanged
+    bool m_bTransformed;
+    bool m_bTransformLocked;
+    UINT m_TransformVersion;
+    glm::mat4 m_Transform;
+    glm::mat3 m_WorldToObjectDirection;
 };
 
 class RTLight : public Light, public Observable
@@ -320,6 +527,11 @@ class RTEnvironmentMap : public EnvironmentMap
 {
 public:
     virtual glm::vec3 GetColor(glm::vec3 ray) = 0;
+
+    // Picks a direction to gather light from for multiple importance sampling,
+    // the default distributes directions uniformly over the sphere
+    virtual glm::vec3 Sample(const glm::vec2 &Sample, float &PDF);
+    virtual float PDF(const glm::vec3 &Direction);
 };
 
 class RTEnvironmentColor : public RTEnvironmentMap
@@ -336,23 +548,22 @@ class RTEnvironmentTextureCube : public RTEnvironmentMap
 public:
     RTEnvironmentTextureCube(CreateEnvironmentTextureCube *pCreateEnvironmentTextureCube);
     glm::vec3 GetColor(glm::vec3 ray) { return m_pTextureCube->Sample(ray); }
+    glm::vec3 Sample(const glm::vec2 &Sample, float &PDF) { return m_pTextureCube->SampleDirection(Sample, PDF); }
+    float PDF(const glm::vec3 &Direction) { return m_pTextureCube->DirectionPDF(Direction); }
 
 private:
     std::unique_ptr<SphereciallySamplableTexture> m_pTextureCube;
 };
 
-struct PixelRange
-{
-    PixelRange() : m_X(0), m_Y(0), m_Width(0), m_Height(0) {}
-    PixelRange(unsigned int x, unsigned int y, unsigned int width, unsigned int height) : m_X(x), m_Y(y), m_Width(width), m_Height(height) {}
-
-    unsigned int m_X, m_Y, m_Width, m_Height;
-};
-
 class RTScene : public Scene, public VersionedObject, public Observer
 {
 public:
-    RTScene(RTCDevice, RTEnvironmentMap *pEnvironmentMap);
+    // Dynamic scenes let geometry move after the first commit. Embree keeps a BVH per mesh or instance
+    // under a top-level BVH, so a commit only rebuilds the top level and meshes that didn't move keep
+    // theirs. Static scenes build one BVH over everything, which traces faster but can't change.
+    // Untransformed meshes are flattened into m_flatScene. Once the scene has any instance, that flat scene
+    // is itself referenced through an identity instance so every top-level hit reports a meaningful instID
+    RTScene(RTCDevice, RTEnvironmentMap *pEnvironmentMap, bool bDynamic);
     ~RTScene();
 
     void AddGeometry(_In_ Geometry *pGeometry);
@@ -361,55 +572,67 @@ public:
     std::vector<RTGeometry *> &GetGeometryList() { return m_GeometryList; }
     std::vector<RTLight *> &GetLightList() { return m_LightList; }
 
-    RTCScene GetRTCScene() { return m_scene; }
-    RTGeometry *GetRTGeometry(unsigned int meshID) { return meshID != RTC_INVALID_GEOMETRY_ID ? m_meshIDToRTGeometry[meshID] : nullptr; }
+    // Only valid after PreDraw
+    RTCScene GetRTCScene() { return m_traceScene; }
+    RTGeometry *GetRTGeometry(unsigned int instanceID, unsigned int meshID);
     RTEnvironmentMap *GetEnvironmentMap() { return m_pEnvironmentMap; }
     void Notify() { NotifyChanged(); }
 
+    // Commits the Embree scene, picking up any geometry that moved since the last call
     void PreDraw();
+    // Time the last PreDraw spent updating and committing the BVH, 0 if it had nothing to do
+    double GetLastCommitTime() const { return m_LastCommitMilliseconds; }
 private:
+    UINT AddInstance(_In_ RTGeometry *pRTGeometry);
+
+    struct SceneGeometry
+    {
+        RTGeometry *m_pGeometry;
+        UINT m_GeometryID;
+        UINT m_TransformVersion; // Last transform handed to Embree
+        bool m_bInstanced; // Otherwise the triangles were added to m_flatScene directly
+    };
+
+    const bool m_bDynamic;
     bool m_bSceneCommitted;
+    bool m_bFlatSceneCommitted;
+    double m_LastCommitMilliseconds;
     
+    RTCDevice m_device;
+    std::vector<SceneGeometry> m_SceneGeometries;
     RTEnvironmentMap *m_pEnvironmentMap;
     std::vector<RTGeometry *> m_GeometryList;
     std::vector<RTLight *> m_LightList;
-    std::unordered_map<unsigned int, RTGeometry *> m_meshIDToRTGeometry;
-
-    RTCScene m_scene;
-};
-
-class RTRenderer;
-struct RayTraceThreadArgs
-{
-    RayTraceThreadArgs() : m_RenderFlags(nullptr) {}
-    RayTraceThreadArgs(RTRenderer *pRenderer, RTScene *pScene, RTCamera *pCamera, const RenderSettings &RenderFlags, PixelRange range, LONG *pOngoingThreadCounter, HANDLE TracingFinishedEvent) :
-        m_pRenderer(pRenderer), 
-        m_pScene(pScene), 
-        m_pCamera(pCamera), 
-        m_PixelRange(range), 
-        m_pOngoingThreadCounter(pOngoingThreadCounter),
-        m_TracingFinishedEvent(TracingFinishedEvent),
-        m_RenderFlags(RenderFlags)
-        {}
-
-    PixelRange m_PixelRange;
-    RTRenderer *m_pRenderer;
-    RTScene *m_pScene;
-    RTCamera *m_pCamera;
-    LONG *m_pOngoingThreadCounter;
-    HANDLE m_TracingFinishedEvent;
-    const RenderSettings &m_RenderFlags;
+    std::unordered_map<unsigned int, RTGeometry *> m_meshIDToRTGeometry; // IDs within m_flatScene
+    std::unordered_map<unsigned int, RTGeometry *> m_instanceIDToRTGeometry; // IDs within m_scene
+
+    RTCScene m_scene; // Instances only
+    RTCScene m_flatScene;
+    UINT m_flatSceneInstanceID; // Instance of m_flatScene within m_scene, RTC_INVALID_GEOMETRY_ID until needed
+    UINT m_NumFlatMeshes;
+    RTCScene m_traceScene; // m_flatScene until the scene has instances, m_scene afterwards
 };
 
 class RayBatch
 {
 public:
-    RayBatch(RTCScene Scene, _In_reads_(NumRays) const glm::vec3 *RayOrigins, _In_reads_(NumRays) const glm::vec3 *RayDirections, unsigned int NumRays);
+    // bOcclusionOnly traces with rtcOccluded, only IsOccluded() is valid afterwards
+    RayBatch(RTCScene Scene, _In_reads_(NumRays) const glm::vec3 *RayOrigins, _In_reads_(NumRays) const glm::vec3 *RayDirections, unsigned int NumRays, bool bOcclusionOnly = false);
 
+    bool IsOccluded(unsigned int RayIndex) { return GetGeometryID(RayIndex) != RTC_INVALID_GEOMETRY_ID; }
+    // Pass both to RTScene::GetRTGeometry, the geometry ID alone is ambiguous once the scene has instances
+    unsigned int GetInstanceID(unsigned int RayIndex);
     unsigned int GetGeometryID(unsigned int RayIndex);
     unsigned int GetPrimID(unsigned int RayIndex);
     glm::vec3 GetBaryocentricCoordinate(unsigned int RayIndex);
+    float GetHitDistance(unsigned int RayIndex);
 private:
+    template<class RayType>
+    unsigned int GetInstanceIDInternal(typename const RayType &RayStruct, unsigned int RayIndex)
+    {
+        return RayStruct.instID[RayIndex];
+    }
+
     template<class RayType>
     unsigned int GetGeometryIDInternal(typename const RayType &RayStruct, unsigned int RayIndex)
     {
@@ -422,6 +645,12 @@ private:
         return RayStruct.primID[RayIndex];
     }
 
+    template<class RayType>
+    float GetHitDistanceInternal(typename const RayType &RayStruct, unsigned int RayIndex)
+    {
+        return RayStruct.tfar[RayIndex];
+    }
+
     template<class RayType>
     void GetBaryocentricCoordinateInternal(typename const RayType &RayStruct, unsigned int RayIndex, float &u, float &v)
     {
@@ -438,6 +667,7 @@ private:
             RayStruct.tfar[RayIndex] = FLT_MAX;
             RayStruct.geomID[RayIndex] = RTC_INVALID_GEOMETRY_ID;
             RayStruct.primID[RayIndex] = RTC_INVALID_GEOMETRY_ID;
+            RayStruct.instID[RayIndex] = RTC_INVALID_GEOMETRY_ID;
             RayStruct.mask[RayIndex] = -1;
             
             RayStruct.dirx[RayIndex] = RayDirections[RayIndex].x;
@@ -468,6 +698,132 @@ private:
     };
 };
 
+// Rays waiting on intersection, stored as structure-of-arrays so that a whole
+// bounce can be streamed through Embree in full RAYS_PER_INTERSECT_BATCH packets
+class RTRayQueue
+{
+public:
+    void Clear()
+    {
+        m_Origins.clear();
+        m_Directions.clear();
+        m_Weights.clear();
+        m_Contributions.clear();
+        m_PixelIndices.clear();
+        m_SampleIDs.clear();
+        m_EnvironmentWeights.clear();
+        m_ConeWidths.clear();
+    }
+
+    void Push(const glm::vec3 &Origin, const glm::vec3 &Direction, const glm::vec3 &Weight, float Contribution, UINT PixelIndex, const RTSampleID &SampleID, float ConeWidth, float EnvironmentWeight = 1.0f)
+    {
+        m_Origins.push_back(Origin);
+        m_Directions.push_back(Direction);
+        m_Weights.push_back(Weight);
+        m_Contributions.push_back(Contribution);
+        m_PixelIndices.push_back(PixelIndex);
+        m_SampleIDs.push_back(SampleID);
+        m_EnvironmentWeights.push_back(EnvironmentWeight);
+        m_ConeWidths.push_back(ConeWidth);
+    }
+
+    UINT Size() const { return (UINT)m_Origins.size(); }
+
+    std::vector<glm::vec3> m_Origins;
+    std::vector<glm::vec3> m_Directions;
+    std::vector<glm::vec3> m_Weights; // Throughput between the pixel and this ray
+    std::vector<float> m_Contributions; // Matches ShadePixelRecursionInfo::m_TotalContribution
+    std::vector<UINT> m_PixelIndices;
+    std::vector<RTSampleID> m_SampleIDs;
+    std::vector<float> m_EnvironmentWeights; // Matches ShadePixelRecursionInfo::m_EnvironmentWeight
+    std::vector<float> m_ConeWidths; // Matches ShadePixelRecursionInfo::m_ConeWidth
+};
+
+// Shadow rays only need to resolve visibility. The lighting they carry is
+// added to the owning hit record if the light turns out to be unoccluded
+class RTShadowRayQueue
+{
+public:
+    void Clear()
+    {
+        m_Origins.clear();
+        m_Directions.clear();
+        m_Diffuse.clear();
+        m_Specular.clear();
+        m_Fresnel.clear();
+        m_HitIndices.clear();
+        m_Visible.clear();
+    }
+
+    void Push(const glm::vec3 &Origin, const glm::vec3 &Direction, const glm::vec3 &Diffuse, const glm::vec3 &Specular, float Fresnel, UINT HitIndex)
+    {
+        m_Origins.push_back(Origin);
+        m_Directions.push_back(Direction);
+        m_Diffuse.push_back(Diffuse);
+        m_Specular.push_back(Specular);
+        m_Fresnel.push_back(Fresnel);
+        m_HitIndices.push_back(HitIndex);
+    }
+
+    UINT Size() const { return (UINT)m_Origins.size(); }
+
+    std::vector<glm::vec3> m_Origins;
+    std::vector<glm::vec3> m_Directions;
+    std::vector<glm::vec3> m_Diffuse;
+    std::vector<glm::vec3> m_Specular;
+    std::vector<float> m_Fresnel;
+    std::vector<UINT> m_HitIndices;
+    std::vector<bool> m_Visible; // Filled in by RTRenderer::OccludeShadowRayQueue
+};
+
+struct RTHitQueue
+{
+    void Resize(UINT NumHits)
+    {
+        m_pGeometries.resize(NumHits);
+        m_PrimIDs.resize(NumHits);
+        m_BaryocentricCoordinates.resize(NumHits);
+        m_HitDistances.resize(NumHits);
+    }
+
+    std::vector<RTGeometry *> m_pGeometries;
+    std::vector<UINT> m_PrimIDs;
+    std::vector<glm::vec3> m_BaryocentricCoordinates;
+    std::vector<float> m_HitDistances;
+};
+
+// Lighting gathered for a single hit. Resolved into the pixel once the
+// shadow rays for the bounce have been traced
+struct RTWavefrontHitRecord
+{
+    RTWavefrontHitRecord(UINT PixelIndex, const glm::vec3 &Weight) :
+        m_PixelIndex(PixelIndex), m_Weight(Weight), m_Diffuse(0.0f), m_Specular(0.0f), m_Fresnel(0.0f), m_NumSamplesTaken(0)
+    {}
+
+    UINT m_PixelIndex;
+    glm::vec3 m_Weight;
+    glm::vec3 m_Diffuse;
+    glm::vec3 m_Specular;
+    float m_Fresnel;
+    UINT m_NumSamplesTaken;
+};
+
+struct RTWavefrontQueues
+{
+    RTRayQueue m_PathRays[2];
+    RTShadowRayQueue m_ShadowRays;
+    RTHitQueue m_Hits;
+    std::vector<UINT> m_ShadingOrder;
+    std::vector<RTWavefrontHitRecord> m_HitRecords;
+};
+
+// What a cost heatmap shows, both are recorded together
+enum RTCostMetric
+{
+    RT_COST_CYCLES,
+    RT_COST_RAYS
+};
+
 class RTRenderer : public Renderer
 {
 public:
@@ -476,6 +832,7 @@ public:
     
     void SetCanvas(Canvas *pCanvas) { m_pCanvas = pCanvas; }
     Geometry *CreateGeometry(_In_ CreateGeometryDescriptor *pCreateGeometryDescriptor);
+    Geometry *CreateGeometryInstance(_In_ Geometry *pPrototype);
     void DestroyGeometry(_In_ Geometry *pGeometry);
 
     Light *CreateLight(_In_ CreateLightDescriptor *pCreateLightDescriptor);
@@ -490,120 +847,148 @@ public:
     EnvironmentMap *CreateEnvironmentMap(CreateEnvironmentMapDescriptor *pCreateEnvironmnetMapDescriptor);
     void DestroyEnviromentMap(EnvironmentMap *pEnvironmentMap);
 
-    Scene *CreateScene(EnvironmentMap *pEnvironmentMap);
+    Scene *CreateScene(EnvironmentMap *pEnvironmentMap, bool bDynamic);
     void DestroyScene(Scene *pScene);
 
     void DrawScene(Camera *pCamera, Scene *pScene, const RenderSettings &RenderFlags);
     Geometry *GetGeometryAtPixel(Camera *pCamera, Scene *pScene, Vec2 PixelCoord);
 
     void RenderPixelRange(PixelRange *pRange, RTCamera *pCamera, RTScene *pScene, const RenderSettings &RenderFlags);
+
+    // Opt-in instrumentation. Once enabled every rendered frame is appended to JSONFileName as a
+    // single line of JSON, pass nullptr to stop collecting
+    void EnableRenderStats(_In_opt_ const char *JSONFileName);
+    const RTRenderStats &GetRenderStats() const { return m_RenderStats; }
+
+    // Opt-in, records the CPU cycles and rays each tile took, spread evenly over the tile's pixels.
+    // Costs add up over every frame rendered until it's disabled or the image size changes
+    void EnableCostHeatmap(bool bEnable);
+    // Writes the recorded cost to pCanvas in false color, from blue for the cheapest pixels to red for the most expensive
+    void DrawCostHeatmap(_In_ Canvas *pCanvas, RTCostMetric Metric);
 private:
+    struct AccumulatedPixel
+    {
+        AccumulatedPixel() : m_Mean(0.0f), m_LuminanceM2(0.0f), m_NumSamples(0), m_bConverged(false) {}
+
+        glm::vec3 m_Mean;
+        float m_LuminanceM2; // Sum of squared differences from the mean luminance
+        UINT m_NumSamples;
+        bool m_bConverged;
+    };
+
+    struct PixelCost
+    {
+        PixelCost() : m_Cycles(0.0), m_NumRays(0.0) {}
+
+        double m_Cycles;
+        double m_NumRays;
+    };
+
+    void RecordTileCost(const PixelRange &Tile, UINT64 Cycles, const RTRayCounters &RayCounters);
+
+    // Index of the pixel's next sample, 0 unless samples are accumulated across frames
+    UINT GetFirstPixelSampleIndex(UINT x, UINT y, UINT Width);
+    RTSampleID GetPixelSampleID(UINT x, UINT y, UINT Width, UINT SampleIndex);
+    glm::vec2 GetPrimaryRayJitter(const RTSampleID &SampleID);
+    // Converged pixels aren't traced again, but canvases are write-discard so callers still have to write their m_Mean
+    bool IsPixelConverged(UINT x, UINT y, UINT Width);
+    // Returns the color to display, the running mean when samples are accumulated
+    glm::vec3 ResolvePixel(UINT x, UINT y, UINT Width, glm::vec3 Color);
+    void WriteTile(const PixelRange &Range, _In_reads_(Range.m_Width * Range.m_Height) const glm::vec3 *pColors, const RenderSettings &RenderFlags);
+
     struct ShadePixelRecursionInfo
     {
-        ShadePixelRecursionInfo(UINT NumRecursions = 1, float TotalContribution = 1.0f) :
-            m_NumRecursions(NumRecursions), m_TotalContribution(TotalContribution)
+        ShadePixelRecursionInfo(UINT NumRecursions = 1, float TotalContribution = 1.0f, const RTSampleID &SampleID = RTSampleID(), float ConeWidth = 0.0f, float EnvironmentWeight = 1.0f) :
+            m_NumRecursions(NumRecursions), m_TotalContribution(TotalContribution), m_SampleID(SampleID), m_ConeWidth(ConeWidth), m_EnvironmentWeight(EnvironmentWeight)
         {}
 
         UINT m_NumRecursions;
         float m_TotalContribution;
+        RTSampleID m_SampleID;
+
+        // Width of the ray cone at the ray origin, it grows by m_ConeSpreadAngle per unit travelled
+        float m_ConeWidth;
+
+        // MIS weight applied if the ray escapes to the environment, which was also sampled directly
+        float m_EnvironmentWeight;
     };
 
-    void Trace(_In_ RTScene *pScene, _In_reads_(NumRays) const glm::vec3 *pRayOrigins, _In_reads_(NumRays) const glm::vec3 *pRayDirs, _Out_ glm::vec3 *pColors, UINT NumRays, ShadePixelRecursionInfo &RecursionInfo);
-    glm::vec3 ShadePixel(RTScene *pScene, unsigned int primID, RTGeometry *pGeometry, glm::vec3 baryocentricCoord, glm::vec3 ViewVector, ShadePixelRecursionInfo &RecursionInfo);
+    struct DirectLighting
+    {
+        DirectLighting() : m_Diffuse(0.0f), m_Specular(0.0f), m_Fresnel(0.0f), m_NumSamplesTaken(0) {}
 
-    PTP_POOL m_ThreadPool;
-    PTP_CLEANUP_GROUP m_ThreadPoolCleanupGroup;
+        glm::vec3 m_Diffuse;
+        glm::vec3 m_Specular;
+        float m_Fresnel;
+        UINT m_NumSamplesTaken;
+    };
+
+    void Trace(_In_ RTScene *pScene, _In_reads_(NumRays) const glm::vec3 *pRayOrigins, _In_reads_(NumRays) const glm::vec3 *pRayDirs, _Out_ glm::vec3 *pColors, UINT NumRays, _In_reads_(NumRays) const ShadePixelRecursionInfo *pRecursionInfo);
+    void GatherDirectLighting(_In_ RTScene *pScene, _In_reads_(NumRays) RTGeometry *const *ppGeometries, _In_reads_(NumRays) const RTHitAttributes *pHitAttributes, _In_reads_(NumRays) const glm::vec3 *pRayDirs, _Out_writes_(NumRays) DirectLighting *pLighting, UINT NumRays);
+    glm::vec3 ShadePixel(RTScene *pScene, RTGeometry *pGeometry, const RTHitAttributes &HitAttributes, glm::vec3 ViewVector, float ConeWidth, const DirectLighting &Lighting, const ShadePixelRecursionInfo &RecursionInfo);
+    void OccludeShadowRayQueue(_In_ RTScene *pScene, _Inout_ RTShadowRayQueue &ShadowRays);
+
+    // Wavefront alternative to Trace/ShadePixel. Rays are queued per bounce for the
+    // whole batch, intersected as a stream and shaded grouped by material
+    void TraceWavefront(_In_ RTScene *pScene, _In_reads_(NumRays) const glm::vec3 *pRayOrigins, _In_reads_(NumRays) const glm::vec3 *pRayDirs, _In_reads_(NumRays) const RTSampleID *pSampleIDs, float PrimaryConeWidth, _Out_ glm::vec3 *pColors, UINT NumRays);
+    void IntersectRayQueue(_In_ RTScene *pScene, _In_ const RTRayQueue &Rays, _Out_ RTHitQueue &Hits);
+    void ResolveShadowRayQueue(_In_ RTScene *pScene, _Inout_ RTShadowRayQueue &ShadowRays, _Inout_ std::vector<RTWavefrontHitRecord> &HitRecords);
+    // Draws one environment sample per sample ID for multiple importance sampling against RayGenerator. Returns 
+    // the samples worth testing for visibility along with the weighted radiance they carry if unoccluded
+    UINT GenerateEnvironmentSamples(
+        _In_ RTEnvironmentMap *pEnvironmentMap,
+        const glm::vec3 &ViewVector,
+        const glm::vec3 &Normal,
+        float Roughness,
+        float Reflectivity,
+        _In_ RTRayGenerator &RayGenerator,
+        _In_reads_(NumSamples) const RTSampleID *pSampleIDs,
+        UINT Depth,
+        float TotalContribution,
+        _Out_writes_to_(NumSamples, return) glm::vec3 *pDirections,
+        _Out_writes_to_(NumSamples, return) glm::vec3 *pRadiance,
+        UINT NumSamples);
+
+    void ShadeWavefrontHit(RTScene *pScene, RTGeometry *pGeometry, const RTHitAttributes &HitAttributes, float ConeWidth, UINT Depth, UINT RayIndex, const RTRayQueue &Rays, RTWavefrontQueues &Queues, RTRayQueue &NextRays);
+
+    RTTileScheduler m_TileScheduler;
 
     RTCDevice  m_device;
     Canvas *m_pCanvas;
-
-    RTCamera *m_pLastCamera;
-    RTScene *m_pLastScene;
-    LONG m_RunningThreadCounter;
-    std::vector<RayTraceThreadArgs> m_ThreadArgs;
-    HANDLE m_TracingFinishedEvent;
+    RTSampler m_Sampler;
 
     const bool m_bEnableMultiRayEmission = true;
+    const bool m_bEnableWavefrontTracing = true;
+    const bool m_bEnableAdaptiveSampling = true;
+    const bool m_bEnableGGXImportanceSampling = true;
+    const bool m_bEnableEnvironmentMIS = true;
     VersionedObject::VersionID m_LastCameraVersionID;
     VersionedObject::VersionID m_LastSceneID;
     RenderSettings m_LastRenderSettings;
-};
-
-class BRDFShader
-{
-public:
-    virtual float BRDF(_In_ const glm::vec3 &ViewVector, _In_ const glm::vec3 &Normal, _In_ const glm::vec3 &IncomingRadianceVector, _In_ float roughness, _In_ float baseReflectivity, _Out_ float &FresnelFactor) = 0;
-};
-
-typedef float(*FresnelFunction)(const glm::vec3 &Normal, const glm::vec3 &HalfwayVector, float BaseReflectivity);
-typedef float(*DistributionFunction)(const glm::vec3 &Normal, const glm::vec3 &IncomingRadianceDirection, float Roughness);
-typedef float(*GeometryAttenuationFunction)(const glm::vec3 &ViewDirection, const glm::vec3 &Normal, const glm::vec3 &HalfwayVector, float Roughness);
-
-static float saturate(float n)
-{
-    return min(1.0f, max(n, 0.0f));
-}
-
-static float Fresnel_ShlicksApproximation(const glm::vec3 &Normal, const glm::vec3 &HalfwayVector, float BaseReflectivity)
-{
-    return (BaseReflectivity + (1.0 - BaseReflectivity) * pow(1.0f - saturate(glm::dot(HalfwayVector, Normal)), 5));
-}
-
-static float GeometryAttenuationPartial_Schlicks(const glm::vec3 &Normal, const glm::vec3 &IncomingRadiationDirection, float k)
-{
-    float nDotV = saturate(glm::dot(Normal, IncomingRadiationDirection));
-    return nDotV / (nDotV * (1 - k) + k);
-}
-
-static float GeometricAttenuation_Schlick(const glm::vec3 &ViewDirection, const glm::vec3 &Normal, const glm::vec3 &IncomingRadianceDirection, float Roughness)
-{
-    float k = Roughness * sqrt(2.0 / M_PI);
-    return GeometryAttenuationPartial_Schlicks(Normal, ViewDirection, k) * GeometryAttenuationPartial_Schlicks(Normal, IncomingRadianceDirection, k);
-}
+    RTCamera *m_pLastCamera;
+    RTScene *m_pLastScene;
 
+    // Per-frame sampling state, set by DrawScene before any tile is rendered
+    UINT m_NumGlossyRaysPerHit;
+    bool m_bForceMirrorRay;
+    bool m_bJitterPrimaryRays;
+    bool m_bAccumulateSamples;
+    UINT m_SamplesPerActivePixel;
 
-static float Distribution_GGX(const glm::vec3 &Normal, const glm::vec3 &HalfwayVector, float Roughness)
-{
-    float nDotH = saturate(glm::dot(Normal, HalfwayVector));
-    float nDotHSquared = nDotH * nDotH;
-    float roughnessSquared = Roughness * Roughness;
+    // Angle subtended by a pixel, ray cones widen by this much per unit of distance
+    float m_ConeSpreadAngle;
 
-    float Quotient = nDotHSquared * (roughnessSquared - 1) + 1;
-    return roughnessSquared / (M_PI * Quotient * Quotient);
-}
+    std::vector<AccumulatedPixel> m_AccumulationBuffer;
+    UINT m_AccumulatedFrameCount;
 
-class CookTorrance : public BRDFShader
-{
-public:
-    float BRDF(_In_ const glm::vec3 &ViewVector, _In_ const glm::vec3 &Normal, _In_ const glm::vec3 &IncomingRadianceVector, _In_ float roughness, _In_ float baseReflectivity, _Out_ float &FresnelFactor);
+    bool m_bCollectRenderStats;
+    RTRenderStats m_RenderStats;
+    std::ofstream m_RenderStatsFile;
 
-private:
-    const FresnelFunction F = Fresnel_ShlicksApproximation;
-    const DistributionFunction D = Distribution_GGX;
-    const GeometryAttenuationFunction G = GeometricAttenuation_Schlick;
+    bool m_bRecordPixelCosts;
+    UINT m_PixelCostWidth;
+    UINT m_PixelCostHeight;
+    std::vector<PixelCost> m_PixelCosts;
 };
 
-
-const UINT g_EmbreeCompatibleIntersectCountInDescendingOrder[] = { 8, 4, 2, 1 };
-inline bool IsIntersectCountEmbreeCompatible(UINT num)
-{
-    for (UINT count : g_EmbreeCompatibleIntersectCountInDescendingOrder)
-    {
-        if (count == num) return true;
-    }
-    return false;
-}
-
-inline UINT TruncateToCompatibleEmbreeCompatible(UINT num)
-{
-    assert(num != 0);
-    for (UINT count : g_EmbreeCompatibleIntersectCountInDescendingOrder)
-    {
-        if (num >= count) return count;
-    }
-}
-
-
-
-
 #define RT_RENDERER_CAST reinterpret_cast
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "RTSampler.h"
+
+#include <math.h>
+
+const UINT g_HaltonPrimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+
+inline UINT HashUInt(UINT x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+inline UINT HashCombine(UINT Seed, UINT Value)
+{
+    return Seed ^ (HashUInt(Value) + 0x9e3779b9 + (Seed << 6) + (Seed >> 2));
+}
+
+inline UINT ReverseBits(UINT x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+// Hash-based Owen scrambling from Burley, "Practical Hash-based Owen Scrambling" (JCGT 2020)
+inline UINT LaineKarrasPermutation(UINT x, UINT Seed)
+{
+    x += Seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return x;
+}
+
+inline UINT NestedUniformScramble(UINT x, UINT Seed)
+{
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), Seed));
+}
+
+// Second dimension of the Sobol sequence, the first is just the bit-reversed index
+inline UINT SobolDimension1(UINT Index)
+{
+    UINT Result = 0;
+    for (UINT Direction = 1u << 31; Index; Index >>= 1, Direction ^= Direction >> 1)
+    {
+        if (Index & 1) Result ^= Direction;
+    }
+    return Result;
+}
+
+inline float UIntToUnitFloat(UINT x)
+{
+    // Only keep the 24 bits a float can represent so the result stays below 1
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+inline float RadicalInverse(UINT Base, UINT Index)
+{
+    const float InverseBase = 1.0f / Base;
+    float InverseBaseN = 1.0f;
+    float Result = 0.0f;
+    while (Index)
+    {
+        InverseBaseN *= InverseBase;
+        Result += (Index % Base) * InverseBaseN;
+        Index /= Base;
+    }
+    return fminf(Result, 0.99999994f);
+}
+
+RTPcgRandom::RTPcgRandom(UINT64 Seed, UINT64 Stream) :
+    m_State(0),
+    m_Increment((Stream << 1) | 1)
+{
+    NextUInt();
+    m_State += Seed;
+    NextUInt();
+}
+
+UINT RTPcgRandom::NextUInt()
+{
+    const UINT64 OldState = m_State;
+    m_State = OldState * 6364136223846793005ull + m_Increment;
+    const UINT XorShifted = (UINT)(((OldState >> 18) ^ OldState) >> 27);
+    const UINT Rotation = (UINT)(OldState >> 59);
+    return (XorShifted >> Rotation) | (XorShifted << ((32 - Rotation) & 31));
+}
+
+float RTPcgRandom::NextFloat()
+{
+    return UIntToUnitFloat(NextUInt());
+}
+
+float RTSampler::Get1D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const
+{
+    return Get2D(PixelIndex, SampleIndex, Dimension).x;
+}
+
+glm::vec2 RTSampler::Get2D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const
+{
+    switch (m_Type)
+    {
+    case HALTON_SAMPLER:
+        return GetHalton2D(PixelIndex, SampleIndex, Dimension);
+    case SOBOL_SAMPLER:
+        return GetSobol2D(PixelIndex, SampleIndex, Dimension);
+    case RANDOM_SAMPLER:
+    default:
+        return GetRandom2D(PixelIndex, SampleIndex, Dimension);
+    }
+}
+
+glm::vec2 RTSampler::GetRandom2D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const
+{
+    RTPcgRandom Random(((UINT64)PixelIndex << 32) | SampleIndex, Dimension);
+    const float u = Random.NextFloat();
+    const float v = Random.NextFloat();
+    return glm::vec2(u, v);
+}
+
+glm::vec2 RTSampler::GetHalton2D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const
+{
+    if (Dimension + 1 >= ARRAYSIZE(g_HaltonPrimes))
+    {
+        // Large prime bases correlate badly, fall back to random numbers for deep dimensions
+        return GetRandom2D(PixelIndex, SampleIndex, Dimension);
+    }
+
+    // Cranley-Patterson rotation per pixel so neighbouring pixels don't share sample positions
+    const UINT Seed = HashCombine(HashUInt(PixelIndex), Dimension);
+    const float u = RadicalInverse(g_HaltonPrimes[Dimension], SampleIndex) + UIntToUnitFloat(HashUInt(Seed));
+    const float v = RadicalInverse(g_HaltonPrimes[Dimension + 1], SampleIndex) + UIntToUnitFloat(HashUInt(Seed + 1));
+    return glm::vec2(u - floorf(u), v - floorf(v));
+}
+
+glm::vec2 RTSampler::GetSobol2D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const
+{
+    // Every dimension pair uses the first two Sobol dimensions, padded by shuffling the
+    // sample index and Owen scrambling the result with a seed unique to the pixel and dimension
+    const UINT Seed = HashCombine(HashUInt(PixelIndex), Dimension);
+    const UINT ShuffledIndex = NestedUniformScramble(SampleIndex, Seed);
+
+    const UINT u = NestedUniformScramble(ReverseBits(ShuffledIndex), HashCombine(Seed, 0));
+    const UINT v = NestedUniformScramble(SobolDimension1(ShuffledIndex), HashCombine(Seed, 1));
+    return glm::vec2(UIntToUnitFloat(u), UIntToUnitFloat(v));
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "Renderer.h"
+
+#include "glm/vec2.hpp"
+
+#include <windows.h>
+
+// PCG32 generator (see pcg-random.org). Small enough to create on the stack
+// wherever random numbers are needed instead of sharing global state
+class RTPcgRandom
+{
+public:
+    RTPcgRandom(UINT64 Seed, UINT64 Stream = 0);
+
+    UINT NextUInt();
+    float NextFloat();
+private:
+    UINT64 m_State;
+    UINT64 m_Increment;
+};
+
+// Identifies which sample of which pixel a ray path belongs to
+struct RTSampleID
+{
+    RTSampleID(UINT PixelIndex = 0, UINT SampleIndex = 0) : m_PixelIndex(PixelIndex), m_SampleIndex(SampleIndex) {}
+
+    // Rays spawned together from one sample continue the same sequence with their own indices
+    RTSampleID GetChild(UINT ChildIndex, UINT NumChildren) const { return RTSampleID(m_PixelIndex, m_SampleIndex * NumChildren + ChildIndex); }
+
+    UINT m_PixelIndex;
+    UINT m_SampleIndex;
+};
+
+// Stateless sample generator indexed by (pixel, sample, dimension). For a fixed
+// pixel and dimension, consecutive sample indices walk a low-discrepancy sequence,
+// while different pixels and dimensions are decorrelated by scrambling. Because
+// nothing is shared, every worker thread can sample without synchronization
+class RTSampler
+{
+public:
+    RTSampler(SamplerType Type = SOBOL_SAMPLER) : m_Type(Type) {}
+
+    void SetType(SamplerType Type) { m_Type = Type; }
+    SamplerType GetType() const { return m_Type; }
+
+    float Get1D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const;
+
+    // Consumes Dimension and Dimension + 1
+    glm::vec2 Get2D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const;
+    glm::vec2 Get2D(const RTSampleID &SampleID, UINT Dimension) const { return Get2D(SampleID.m_PixelIndex, SampleID.m_SampleIndex, Dimension); }
+
+private:
+    glm::vec2 GetRandom2D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const;
+    glm::vec2 GetHalton2D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const;
+    glm::vec2 GetSobol2D(UINT PixelIndex, UINT SampleIndex, UINT Dimension) const;
+
+    SamplerType m_Type;
+};
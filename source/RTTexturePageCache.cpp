@@ -0,0 +1,78 @@
+#include "RTTexturePageCache.h"
+
+const size_t cDefaultTexturePageBudget = 1024ull * 1024ull * 1024ull;
+
+RTTexturePageCache RTTexturePageCache::s_Instance;
+
+RTTexturePageCache::RTTexturePageCache() :
+    m_MemoryBudget(cDefaultTexturePageBudget),
+    m_ResidentBytes(0)
+{
+}
+
+RTTexturePage RTTexturePageCache::FindPage(UINT64 Key)
+{
+    std::lock_guard<std::mutex> Lock(m_Lock);
+    auto PageIter = m_PageLookup.find(Key);
+    if (PageIter == m_PageLookup.end())
+    {
+        return nullptr;
+    }
+
+    m_Pages.splice(m_Pages.begin(), m_Pages, PageIter->second);
+    return PageIter->second->second;
+}
+
+RTTexturePage RTTexturePageCache::AddPage(UINT64 Key, const RTTexturePage &pPage)
+{
+    std::lock_guard<std::mutex> Lock(m_Lock);
+    auto PageIter = m_PageLookup.find(Key);
+    if (PageIter != m_PageLookup.end())
+    {
+        m_Pages.splice(m_Pages.begin(), m_Pages, PageIter->second);
+        return PageIter->second->second;
+    }
+
+    m_Pages.push_front(std::make_pair(Key, pPage));
+    m_PageLookup[Key] = m_Pages.begin();
+    m_ResidentBytes += pPage->size();
+    EvictToBudget();
+    return pPage;
+}
+
+void RTTexturePageCache::EvictImage(UINT ImageID)
+{
+    std::lock_guard<std::mutex> Lock(m_Lock);
+    for (auto PageIter = m_Pages.begin(); PageIter != m_Pages.end();)
+    {
+        if ((UINT)(PageIter->first >> 32) == ImageID)
+        {
+            m_ResidentBytes -= PageIter->second->size();
+            m_PageLookup.erase(PageIter->first);
+            PageIter = m_Pages.erase(PageIter);
+        }
+        else
+        {
+            PageIter++;
+        }
+    }
+}
+
+void RTTexturePageCache::SetMemoryBudget(size_t NumBytes)
+{
+    std::lock_guard<std::mutex> Lock(m_Lock);
+    m_MemoryBudget = NumBytes;
+    EvictToBudget();
+}
+
+void RTTexturePageCache::EvictToBudget()
+{
+    // Always keep the page that was just added, even if it's larger than the whole budget
+    while (m_ResidentBytes > m_MemoryBudget && m_Pages.size() > 1)
+    {
+        const auto &LeastRecentlyUsed = m_Pages.back();
+        m_ResidentBytes -= LeastRecentlyUsed.second->size();
+        m_PageLookup.erase(LeastRecentlyUsed.first);
+        m_Pages.pop_back();
+    }
+}
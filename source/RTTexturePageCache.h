@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <windows.h>
+
+// A page is a run of consecutive texel tiles from one mip level of a paged RTImage
+typedef std::shared_ptr<const std::vector<unsigned char>> RTTexturePage;
+
+// Process-wide LRU of texture pages, shared by every paged RTImage so the memory budget
+// covers all of them. Pages handed out stay valid for as long as the caller holds on to
+// them, eviction only drops the cache's reference. RTImage keeps the last page each thread
+// touched, so the worst case is the budget plus one page per rendering thread
+class RTTexturePageCache
+{
+public:
+    static RTTexturePageCache &GetInstance() { return s_Instance; }
+
+    // Keys are built from the image, mip level and page so every page in the process is unique
+    static UINT64 GetPageKey(UINT ImageID, UINT Level, UINT PageIndex) { return ((UINT64)ImageID << 32) | ((UINT64)Level << 24) | PageIndex; }
+
+    // Returns nullptr if the page isn't resident, otherwise marks it as most recently used
+    RTTexturePage FindPage(UINT64 Key);
+
+    // If another thread added the same page first, that page is returned and pPage is dropped
+    RTTexturePage AddPage(UINT64 Key, const RTTexturePage &pPage);
+
+    // Called when an image is destroyed so its pages don't take up budget until they age out
+    void EvictImage(UINT ImageID);
+
+    void SetMemoryBudget(size_t NumBytes);
+    size_t GetMemoryBudget() const { return m_MemoryBudget; }
+    size_t GetResidentBytes() const { return m_ResidentBytes; }
+private:
+    RTTexturePageCache();
+    void EvictToBudget();
+
+    typedef std::list<std::pair<UINT64, RTTexturePage>> PageList;
+
+    std::mutex m_Lock;
+
+    // Most recently used page at the front
+    PageList m_Pages;
+    std::unordered_map<UINT64, PageList::iterator> m_PageLookup;
+
+    size_t m_MemoryBudget;
+    size_t m_ResidentBytes;
+
+    static RTTexturePageCache s_Instance;
+};
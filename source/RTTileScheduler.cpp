@@ -0,0 +1,267 @@
+#include "RTTileScheduler.h"
+
+#include <algorithm>
+
+RTTileScheduler::RTTileScheduler(unsigned int NumWorkers) :
+    m_FrameIndex(0),
+    m_NumBusyThreads(0),
+    m_bShutdown(false),
+    m_bCollectTimings(false),
+    m_pTileFunction(nullptr),
+    m_PixelsRemaining(0),
+    m_bFrameAborted(false),
+    m_NumIdleWorkers(0)
+{
+    NumWorkers = std::max(NumWorkers, 1u);
+    for (unsigned int i = 0; i < NumWorkers; i++)
+    {
+        m_WorkerQueues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+
+    // Worker 0 is whichever thread calls Run()
+    for (unsigned int i = 1; i < NumWorkers; i++)
+    {
+        m_Threads.push_back(std::thread(&RTTileScheduler::WorkerThreadMain, this, i));
+    }
+}
+
+RTTileScheduler::~RTTileScheduler()
+{
+    {
+        std::lock_guard<std::mutex> Lock(m_FrameLock);
+        m_bShutdown = true;
+    }
+    m_FrameStartedCondition.notify_all();
+
+    for (auto &Thread : m_Threads)
+    {
+        Thread.join();
+    }
+}
+
+void RTTileScheduler::Run(unsigned int Width, unsigned int Height, const TileFunction &Function)
+{
+    if (Width == 0 || Height == 0) return;
+
+    const unsigned int NumWorkers = GetNumWorkers();
+    const unsigned int TilesX = (Width + cInitialTileSize - 1) / cInitialTileSize;
+    const unsigned int TilesY = (Height + cInitialTileSize - 1) / cInitialTileSize;
+    const unsigned int NumTiles = TilesX * TilesY;
+
+    // Hand each worker a contiguous run of tiles so neighbouring pixels stay on
+    // the same core, stealing takes care of any imbalance
+    for (unsigned int TileIndex = 0; TileIndex < NumTiles; TileIndex++)
+    {
+        const unsigned int x = (TileIndex % TilesX) * cInitialTileSize;
+        const unsigned int y = (TileIndex / TilesX) * cInitialTileSize;
+        const unsigned int WorkerIndex = (unsigned int)(((unsigned long long)TileIndex * NumWorkers) / NumTiles);
+        m_WorkerQueues[WorkerIndex]->m_Tiles.push_back(PixelRange(
+            x,
+            y,
+            std::min(Width - x, cInitialTileSize),
+            std::min(Height - y, cInitialTileSize)));
+    }
+
+    for (auto &pQueue : m_WorkerQueues)
+    {
+        pQueue->m_Timing = WorkerTiming();
+        pQueue->m_TileTimings.clear();
+    }
+
+    m_pTileFunction = &Function;
+    m_PixelsRemaining = Width * Height;
+    m_bFrameAborted = false;
+    m_NumIdleWorkers = 0;
+    m_FrameStartTime = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> Lock(m_FrameLock);
+        m_NumBusyThreads = (unsigned int)m_Threads.size();
+        m_FrameIndex++;
+    }
+    m_FrameStartedCondition.notify_all();
+
+    ProcessTiles(0);
+
+    // Workers may still be looking for tiles after the last pixel is written,
+    // wait for them to settle before the tile function goes out of scope
+    std::unique_lock<std::mutex> Lock(m_FrameLock);
+    m_FrameFinishedCondition.wait(Lock, [this] { return m_NumBusyThreads == 0; });
+    m_pTileFunction = nullptr;
+
+    if (m_bFrameAborted)
+    {
+        // Tiles nobody got to would otherwise be rendered as part of the next frame
+        for (auto &pQueue : m_WorkerQueues)
+        {
+            pQueue->m_Tiles.clear();
+        }
+
+        std::exception_ptr pException = m_pFrameException;
+        m_pFrameException = nullptr;
+        std::rethrow_exception(pException);
+    }
+
+    if (m_bCollectTimings)
+    {
+        // Anything a worker didn't spend rendering counts as idle, including the time it took to wake up
+        const double FrameMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_FrameStartTime).count();
+        for (auto &pQueue : m_WorkerQueues)
+        {
+            pQueue->m_Timing.m_IdleMilliseconds = std::max(FrameMilliseconds - pQueue->m_Timing.m_BusyMilliseconds, 0.0);
+        }
+    }
+}
+
+void RTTileScheduler::WorkerThreadMain(unsigned int WorkerIndex)
+{
+    unsigned long long LastFrameIndex = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> Lock(m_FrameLock);
+            m_FrameStartedCondition.wait(Lock, [&] { return m_bShutdown || m_FrameIndex != LastFrameIndex; });
+            if (m_bShutdown) return;
+            LastFrameIndex = m_FrameIndex;
+        }
+
+        ProcessTiles(WorkerIndex);
+
+        bool bLastThread;
+        {
+            std::lock_guard<std::mutex> Lock(m_FrameLock);
+            bLastThread = --m_NumBusyThreads == 0;
+        }
+        if (bLastThread)
+        {
+            m_FrameFinishedCondition.notify_all();
+        }
+    }
+}
+
+void RTTileScheduler::ProcessTiles(unsigned int WorkerIndex)
+{
+    bool bIdle = false;
+    while (m_PixelsRemaining > 0 && !m_bFrameAborted)
+    {
+        PixelRange Tile;
+        if (PopTile(WorkerIndex, Tile) || StealTile(WorkerIndex, Tile))
+        {
+            if (bIdle)
+            {
+                m_NumIdleWorkers--;
+                bIdle = false;
+            }
+
+            SplitTileWhileWorkersIdle(WorkerIndex, Tile);
+
+            const unsigned int NumPixels = Tile.m_Width * Tile.m_Height;
+            RunTileFunction(WorkerIndex, Tile);
+            m_PixelsRemaining -= NumPixels;
+        }
+        else
+        {
+            if (!bIdle)
+            {
+                m_NumIdleWorkers++;
+                bIdle = true;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    if (bIdle)
+    {
+        m_NumIdleWorkers--;
+    }
+}
+
+void RTTileScheduler::RunTileFunction(unsigned int WorkerIndex, PixelRange &Tile)
+{
+    // An exception can't be allowed to leave a worker thread, it's handed to Run() instead
+    try
+    {
+        if (m_bCollectTimings)
+        {
+            const PixelRange RenderedTile = Tile;
+            const std::chrono::steady_clock::time_point TileStartTime = std::chrono::steady_clock::now();
+            (*m_pTileFunction)(Tile);
+            const double TileMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - TileStartTime).count();
+
+            WorkerQueue &Queue = *m_WorkerQueues[WorkerIndex];
+            Queue.m_Timing.m_BusyMilliseconds += TileMilliseconds;
+            Queue.m_Timing.m_NumTiles++;
+            Queue.m_TileTimings.push_back({ RenderedTile, WorkerIndex, TileMilliseconds });
+        }
+        else
+        {
+            (*m_pTileFunction)(Tile);
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> Lock(m_FrameLock);
+        if (!m_pFrameException)
+        {
+            m_pFrameException = std::current_exception();
+        }
+        m_bFrameAborted = true;
+    }
+}
+
+bool RTTileScheduler::PopTile(unsigned int WorkerIndex, PixelRange &Tile)
+{
+    WorkerQueue &Queue = *m_WorkerQueues[WorkerIndex];
+    std::lock_guard<std::mutex> Lock(Queue.m_Lock);
+    if (Queue.m_Tiles.empty()) return false;
+
+    Tile = Queue.m_Tiles.back();
+    Queue.m_Tiles.pop_back();
+    return true;
+}
+
+bool RTTileScheduler::StealTile(unsigned int WorkerIndex, PixelRange &Tile)
+{
+    const unsigned int NumWorkers = GetNumWorkers();
+    for (unsigned int i = 1; i < NumWorkers; i++)
+    {
+        // Steal the oldest tile, it is the one least likely to have been split already
+        WorkerQueue &Victim = *m_WorkerQueues[(WorkerIndex + i) % NumWorkers];
+        std::lock_guard<std::mutex> Lock(Victim.m_Lock);
+        if (Victim.m_Tiles.empty()) continue;
+
+        Tile = Victim.m_Tiles.front();
+        Victim.m_Tiles.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void RTTileScheduler::SplitTileWhileWorkersIdle(unsigned int WorkerIndex, PixelRange &Tile)
+{
+    WorkerQueue &Queue = *m_WorkerQueues[WorkerIndex];
+    while (m_NumIdleWorkers > 0 && (Tile.m_Width > cMinimumTileSize || Tile.m_Height > cMinimumTileSize))
+    {
+        const unsigned int LeftWidth = Tile.m_Width > cMinimumTileSize ? Tile.m_Width / 2 : Tile.m_Width;
+        const unsigned int TopHeight = Tile.m_Height > cMinimumTileSize ? Tile.m_Height / 2 : Tile.m_Height;
+        const unsigned int RightWidth = Tile.m_Width - LeftWidth;
+        const unsigned int BottomHeight = Tile.m_Height - TopHeight;
+
+        // Keep the top-left quadrant and make the rest available to idle workers
+        std::lock_guard<std::mutex> Lock(Queue.m_Lock);
+        if (RightWidth)
+        {
+            Queue.m_Tiles.push_front(PixelRange(Tile.m_X + LeftWidth, Tile.m_Y, RightWidth, TopHeight));
+        }
+        if (BottomHeight)
+        {
+            Queue.m_Tiles.push_front(PixelRange(Tile.m_X, Tile.m_Y + TopHeight, LeftWidth, BottomHeight));
+        }
+        if (RightWidth && BottomHeight)
+        {
+            Queue.m_Tiles.push_front(PixelRange(Tile.m_X + LeftWidth, Tile.m_Y + TopHeight, RightWidth, BottomHeight));
+        }
+        Tile.m_Width = LeftWidth;
+        Tile.m_Height = TopHeight;
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <exception>
+
+struct PixelRange
+{
+    PixelRange() : m_X(0), m_Y(0), m_Width(0), m_Height(0) {}
+    PixelRange(unsigned int x, unsigned int y, unsigned int width, unsigned int height) : m_X(x), m_Y(y), m_Width(width), m_Height(height) {}
+
+    unsigned int m_X, m_Y, m_Width, m_Height;
+};
+
+// Persistent pool of worker threads that render a frame as a set of tiles.
+// Each worker owns a deque of tiles, pops work from the back of its own deque
+// and steals from the front of other workers' deques once it runs dry. While
+// any worker is idle, tiles are split in quadrants before being rendered so
+// that expensive regions of the image end up spread across all workers.
+class RTTileScheduler
+{
+public:
+    typedef std::function<void(PixelRange &)> TileFunction;
+
+    struct TileTiming
+    {
+        PixelRange m_Tile;
+        unsigned int m_WorkerIndex;
+        double m_Milliseconds;
+    };
+
+    struct WorkerTiming
+    {
+        WorkerTiming() : m_BusyMilliseconds(0.0), m_IdleMilliseconds(0.0), m_NumTiles(0) {}
+
+        double m_BusyMilliseconds; // Inside the tile function
+        double m_IdleMilliseconds; // Waking up, looking for tiles or waiting on the rest of the frame
+        unsigned int m_NumTiles;
+    };
+
+    static const unsigned int cInitialTileSize = 32;
+    static const unsigned int cMinimumTileSize = 8;
+
+    // NumWorkers includes the thread calling Run(), a value of 1 renders on the calling thread only
+    RTTileScheduler(unsigned int NumWorkers);
+    ~RTTileScheduler();
+
+    // Blocks until TileFunction has been called on every pixel in the Width x Height image. If
+    // TileFunction throws on any worker the rest of the frame is abandoned and the first exception
+    // is rethrown here, tiles that were already rendered stay written
+    void Run(unsigned int Width, unsigned int Height, const TileFunction &Function);
+
+    unsigned int GetNumWorkers() const { return (unsigned int)m_WorkerQueues.size(); }
+
+    // Off by default, when enabled every tile is timed and the results of the last Run() can be read back
+    void EnableTimings(bool bEnable) { m_bCollectTimings = bEnable; }
+    const WorkerTiming &GetWorkerTiming(unsigned int WorkerIndex) const { return m_WorkerQueues[WorkerIndex]->m_Timing; }
+    const std::vector<TileTiming> &GetTileTimings(unsigned int WorkerIndex) const { return m_WorkerQueues[WorkerIndex]->m_TileTimings; }
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex m_Lock;
+        std::deque<PixelRange> m_Tiles;
+
+        // Only touched by the owning worker while a frame is running
+        WorkerTiming m_Timing;
+        std::vector<TileTiming> m_TileTimings;
+    };
+
+    void WorkerThreadMain(unsigned int WorkerIndex);
+    void ProcessTiles(unsigned int WorkerIndex);
+    void RunTileFunction(unsigned int WorkerIndex, PixelRange &Tile);
+    bool PopTile(unsigned int WorkerIndex, PixelRange &Tile);
+    bool StealTile(unsigned int WorkerIndex, PixelRange &Tile);
+    void SplitTileWhileWorkersIdle(unsigned int WorkerIndex, PixelRange &Tile);
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_WorkerQueues;
+    std::vector<std::thread> m_Threads;
+
+    std::mutex m_FrameLock;
+    std::condition_variable m_FrameStartedCondition;
+    std::condition_variable m_FrameFinishedCondition;
+    unsigned long long m_FrameIndex;
+    unsigned int m_NumBusyThreads;
+    bool m_bShutdown;
+
+    bool m_bCollectTimings;
+    std::chrono::steady_clock::time_point m_FrameStartTime;
+
+    const TileFunction *m_pTileFunction;
+    std::atomic<unsigned int> m_PixelsRemaining;
+    std::atomic<bool> m_bFrameAborted;
+    std::exception_ptr m_pFrameException; // Guarded by m_FrameLock
+    std::atomic<unsigned int> m_NumIdleWorkers;
+};
@@ -0,0 +1,157 @@
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdio.h>
+
+#include "SceneLoader.h"
+
+Vec3 ConvertVec3(const SceneParser::Vector3 &vec)
+{
+    return Vec3(vec.x, vec.y, vec.z);
+}
+
+Vec2 ConvertVec2(const SceneParser::Vector2 &vec)
+{
+    return Vec2(vec.x, vec.y);
+}
+
+void InitEnvironmentMap(_In_ Renderer *pRenderer, const char *CubeMapName, const char* irradMapName, _Out_ EnvironmentMap **ppEnviromentMap)
+{
+    CreateEnvironmentMapDescriptor EnvMapDescriptor;
+    char textureCubFileNames[TEXTURES_PER_CUBE][MAX_ALLOWED_STR_LENGTH];
+    char irradTextureCubFileNames[TEXTURES_PER_CUBE][MAX_ALLOWED_STR_LENGTH];
+    EnvMapDescriptor.m_EnvironmentType = CreateEnvironmentMapDescriptor::EnvironmentType::TEXTURE_CUBE;
+    CreateEnvironmentTextureCube &TexCubeDescriptor = EnvMapDescriptor.m_TextureCube;
+    for (UINT i = 0; i < TEXTURES_PER_CUBE; i++)
+    {
+        sprintf_s(textureCubFileNames[i], "%s", CubeMapName);
+        TexCubeDescriptor.m_TextureNames[i] = textureCubFileNames[i];
+    }
+
+    *ppEnviromentMap = pRenderer->CreateEnvironmentMap(&EnvMapDescriptor);
+}
+
+void InitSceneAndCamera(_In_ Renderer *pRenderer, _In_ EnvironmentMap *pEnvMap, _In_ const SceneParser::Scene &fileScene, bool bDynamic, _Out_ std::unordered_map<std::string, Material*> &MaterialList, _Out_ Scene **ppScene, _Out_ Camera **ppCamera)
+{
+    *ppScene = pRenderer->CreateScene(pEnvMap, bDynamic);
+    Scene *pScene = *ppScene;
+
+    const UINT materialCount = fileScene.m_Materials.size();
+    MaterialList.reserve(materialCount);
+    for (auto &materialKeyValuePair : fileScene.m_Materials)
+    {
+        const SceneParser::Material &material = materialKeyValuePair.second;
+
+        CreateMaterialDescriptor CreateMaterialDescriptor = {};
+        CreateMaterialDescriptor.m_TextureName = material.m_DiffuseTextureFilename.c_str();
+
+        CreateMaterialDescriptor.m_DiffuseColor.x = material.m_Diffuse.r;
+        CreateMaterialDescriptor.m_DiffuseColor.y = material.m_Diffuse.g;
+        CreateMaterialDescriptor.m_DiffuseColor.z = material.m_Diffuse.b;
+
+        // TODO: Need to add these
+        const float shininess = 0.5f;
+        CreateMaterialDescriptor.m_Reflectivity = 0.5f;
+        CreateMaterialDescriptor.m_Roughness = sqrt(2.0 / (shininess + 2.0f));
+
+        MaterialList[materialKeyValuePair.first] = pRenderer->CreateMaterial(&CreateMaterialDescriptor);
+    }
+
+    {
+        std::vector<Vertex> vertexList;
+        std::vector<unsigned int> indexList;
+        for (const SceneParser::Mesh &mesh : fileScene.m_Meshes)
+        {
+            UINT numVerts = mesh.m_VertexBuffer.size();
+            UINT numIndices = mesh.m_IndexBuffer.size();
+
+            vertexList.resize(numVerts);
+            indexList.resize(numIndices);
+            for (UINT vertIdx = 0; vertIdx < numVerts; vertIdx++)
+            {
+                const SceneParser::Vertex &inputVertex = mesh.m_VertexBuffer[vertIdx];
+                Vertex &vertex = vertexList[vertIdx];
+                vertex.m_Position = ConvertVec3(inputVertex.Position);
+                vertex.m_Normal = ConvertVec3(inputVertex.Normal);
+                vertex.m_Tex = ConvertVec2(inputVertex.UV);
+                vertex.m_Tangent = ConvertVec3(inputVertex.Tangents);
+            }
+            
+            for (UINT ibIdx = 0; ibIdx < mesh.m_IndexBuffer.size(); ibIdx++)
+            {
+                assert(mesh.m_IndexBuffer[ibIdx] >= 0);
+                indexList[ibIdx] = (UINT)mesh.m_IndexBuffer[ibIdx];
+            }
+
+            CreateGeometryDescriptor geometryDescriptor;
+            geometryDescriptor.m_pVertices = vertexList.data();
+            geometryDescriptor.m_NumVertices = numVerts;
+            geometryDescriptor.m_pIndices = indexList.data();
+            geometryDescriptor.m_NumIndices = numIndices;
+            geometryDescriptor.m_pMaterial = MaterialList[mesh.m_pMaterial->m_MaterialName];
+            assert(geometryDescriptor.m_pMaterial);
+
+            Geometry *pGeometry = pRenderer->CreateGeometry(&geometryDescriptor);
+            pScene->AddGeometry(pGeometry);
+        }
+    }
+
+    {
+        CreateLightDescriptor CreateLight;
+        CreateDirectionalLight CreateDirectional;
+        CreateDirectional.m_EmissionDirection = Vec3(1.0f, -1.0, -1.0);
+        CreateLight.m_Color = Vec3(1.0f, 1.0f, 1.0f);
+        CreateLight.m_LightType = CreateLightDescriptor::DIRECTIONAL_LIGHT;
+        CreateLight.m_pCreateDirectionalLight = &CreateDirectional;
+
+        Light *pLight = pRenderer->CreateLight(&CreateLight);
+        pScene->AddLight(pLight);
+    }
+
+    const float LensHeight = 2.0f;
+    const float AspectRatio = (float)fileScene.m_Film.m_ResolutionX / fileScene.m_Film.m_ResolutionY;
+    const float LensWidth = LensHeight * AspectRatio;
+
+    const float fovInRadians = fileScene.m_Camera.m_FieldOfView * M_PI / 180.0f;
+
+    float VerticalFov;
+    if (fileScene.m_Film.m_ResolutionY > fileScene.m_Film.m_ResolutionX)
+    {
+        const float FocalLength = LensWidth / (2.0f* tan(fovInRadians / 2.0f));
+        VerticalFov = 2 * atan(LensHeight / (2.0f * FocalLength));
+    }
+    else
+    {
+        VerticalFov = fovInRadians;
+    }
+
+    CreateCameraDescriptor CameraDescriptor = {};
+    CameraDescriptor.m_Height = fileScene.m_Film.m_ResolutionY;
+    CameraDescriptor.m_Width = fileScene.m_Film.m_ResolutionX;
+    CameraDescriptor.m_FocalPoint = ConvertVec3(fileScene.m_Camera.m_Position);
+    CameraDescriptor.m_LookAt = ConvertVec3(fileScene.m_Camera.m_LookAt);
+    CameraDescriptor.m_Up = ConvertVec3(fileScene.m_Camera.m_Up);
+    CameraDescriptor.m_NearClip = fileScene.m_Camera.m_NearPlane;
+    CameraDescriptor.m_FarClip = fileScene.m_Camera.m_FarPlane;
+    CameraDescriptor.m_VerticalFieldOfView = VerticalFov;
+
+    *ppCamera = pRenderer->CreateCamera(&CameraDescriptor);
+}
+
+SamplerType GetSamplerType(_In_ const SceneParser::Scene &fileScene, SamplerType DefaultSampler)
+{
+    // Unsupported PBRT samplers (stratified, random, ...) fall back to plain random numbers
+    const std::string &SamplerName = fileScene.m_Sampler.m_SamplerName;
+    if (SamplerName.compare("sobol") == 0 || SamplerName.compare("zerotwosequence") == 0)
+    {
+        return SOBOL_SAMPLER;
+    }
+    else if (SamplerName.compare("halton") == 0)
+    {
+        return HALTON_SAMPLER;
+    }
+    else if (SamplerName.size() > 0)
+    {
+        return RANDOM_SAMPLER;
+    }
+    return DefaultSampler;
+}
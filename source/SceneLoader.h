@@ -0,0 +1,16 @@
+#pragma once
+#include "Renderer.h"
+#include "SceneParser.h"
+
+#include <string>
+#include <unordered_map>
+#include <windows.h>
+
+// Builds renderer objects out of a parsed scene file, shared by the interactive app and the batch renderer
+
+void InitEnvironmentMap(_In_ Renderer *pRenderer, const char *CubeMapName, const char *irradMapName, _Out_ EnvironmentMap **ppEnviromentMap);
+// bDynamic scenes let geometry be moved after they're built, at some cost in trace speed
+void InitSceneAndCamera(_In_ Renderer *pRenderer, _In_ EnvironmentMap *pEnvMap, _In_ const SceneParser::Scene &fileScene, bool bDynamic, _Out_ std::unordered_map<std::string, Material *> &MaterialList, _Out_ Scene **ppScene, _Out_ Camera **ppCamera);
+
+// Sampler named by the scene's Sampler directive, DefaultSampler if there wasn't one
+SamplerType GetSamplerType(_In_ const SceneParser::Scene &fileScene, SamplerType DefaultSampler);
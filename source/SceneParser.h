@@ -69,6 +69,15 @@ namespace SceneParser
         std::string m_Filename;
     };
 
+    struct Sampler
+    {
+        Sampler() : m_PixelSamples(0) {}
+
+        // PBRT sampler name, i.e. "sobol" or "halton". Empty if the scene didn't specify one
+        std::string m_SamplerName;
+        UINT m_PixelSamples;
+    };
+
     struct Camera
     {
         // In Degrees. The is the narrower of the view frustrums width/height
@@ -127,6 +136,7 @@ namespace SceneParser
     {
         Camera m_Camera;
         Film m_Film;
+        Sampler m_Sampler;
         std::unordered_map<std::string, Material> m_Materials;
         std::vector<AreaLight> m_AreaLights;
         std::vector<Mesh> m_Meshes;